@@ -271,6 +271,15 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to a SyncedMemory of at least this
+   *        Blob's size that is also used by other Blob%s at other times,
+   *        e.g. by Net::PlanInferenceMemory.
+   *
+   * A later Reshape beyond the current capacity gives the Blob its own
+   * memory again.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& memory);
 
   bool ShapeEquals(const BlobProto& other);
 
@@ -8,6 +8,7 @@
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/base_conv_layer.hpp"
+#include "caffe/util/quantize.hpp"
 
 namespace caffe {
 
@@ -64,6 +65,9 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
 
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
   virtual inline const char* type() const { return "Convolution"; }
 
   virtual void zero_backward_relevance(const vector<Blob<Dtype>*>& top,
@@ -82,6 +86,32 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+  // apply the fused ReLU, if any, to the whole top blob
+  void fused_relu_cpu(Blob<Dtype>* top);
+  void fused_relu_gpu(Blob<Dtype>* top);
+  // int8 convolution of one example, used on the CPU when the layer has a
+  // quantization_param: direct for sparse 3D input, otherwise im2col and
+  // int8 GEMM.  Bias and fused ReLU are applied while dequantizing.
+  void forward_cpu_quantized(const Dtype* input, Dtype* output);
+
+  // Use direct 3D convolution instead of im2col + GEMM on the CPU.  Chosen
+  // for ungrouped, undilated 3D kernels larger than 1x1x1 with sparse_input
+  // set: skipping empty rows is what makes it pay, since per core it is
+  // several times slower than GEMM on dense input.
+  bool direct_cpu_;
+  // The direct path skips input rows with no nonzero value; active_rows_
+  // flags them for the current example.
+  bool sparse_input_;
+  vector<unsigned char> active_rows_;
+  const unsigned char* find_active_rows(const Dtype* input);
+  bool fused_relu_;
+  Dtype relu_negative_slope_;
+  bool quantized_;
+  Dtype input_range_;
+  QuantizedWeights<Dtype> quantized_weights_;
+  vector<int8_t> quantized_input_;
+  vector<int8_t> quantized_col_;
+  vector<int32_t> quantized_output_;
 };
 
 }  // namespace caffe
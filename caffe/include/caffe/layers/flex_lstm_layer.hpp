@@ -76,6 +76,9 @@ class LSTMDataGetterLayer : public Layer<Dtype> {
     virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
         const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+    void SubcubeOffsets(unsigned timestep, unsigned& x_offset,
+        unsigned& y_offset, unsigned& z_offset) const;
+
     AccessPattern pattern;
     unsigned num_timesteps;
     unsigned batch_size;
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/quantize.hpp"
 
 namespace caffe {
 
@@ -47,6 +48,12 @@ class InnerProductLayer : public Layer<Dtype> {
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
+  /// int8 forward pass on the CPU, set by a quantization_param
+  bool quantized_;
+  Dtype input_range_;
+  QuantizedWeights<Dtype> quantized_weights_;
+  vector<int8_t> quantized_input_;
+  vector<int32_t> quantized_output_;
 };
 
 }  // namespace caffe
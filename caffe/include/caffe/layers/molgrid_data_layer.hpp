@@ -1,12 +1,14 @@
 #ifndef CAFFE_MOLGRID_DATA_LAYER_HPP_
 #define CAFFE_MOLGRID_DATA_LAYER_HPP_
 
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 #include <unordered_map>
 #include <map>
 #include <cmath>
+#include <random>
 
 #include <boost/array.hpp>
 #include <boost/thread/locks.hpp>
@@ -33,11 +35,20 @@ namespace caffe {
 /*
  * @brief Provides data to the Net from files of examples.
  * libmolgrid is used to sample and select from provided example files
- * and to do the gridding.
+ * and to do the gridding.  With prefetch set, batches read from files are
+ * prepared ahead in a background thread, with the examples of a batch
+ * gridded in parallel and each drawing its random transformation from its
+ * own seed.  In data parallel training each solver reads its own shard,
+ * every solver_count-th example of the stream starting at its rank.  The
+ * solvers' providers shuffle and sample with generators seeded alike, so
+ * they produce the same stream and the shards are disjoint.
+ * Test data is gridded the same way on every pass, so with cache_test_grids
+ * the grids of the first pass are kept, with zeros run length encoded, and
+ * copied into later batches.
  */
 
 template<typename Dtype>
-class MolGridDataLayer : public BaseDataLayer<Dtype> {
+class MolGridDataLayer : public BaseDataLayer<Dtype>, public InternalThread {
   public:
     typedef qt quaternion;
 
@@ -102,6 +113,31 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     virtual void setLigand(const vector<float3>& coords, const vector<smt>& smtypes,
                            bool calcCenter = true);
 
+    //in memory only: indices of receptor and ligand atoms left out of the
+    //grid at each batch position, in the order they were set; positions
+    //past the end of a vector keep every atom
+    void setExcludedAtoms(const vector<vector<unsigned> >& receptor,
+        const vector<vector<unsigned> >& ligand) {
+      excluded_rec = receptor;
+      excluded_lig = ligand;
+    }
+    //also restores the atoms left out by the last forward, so later
+    //forwards grid every atom without the molecules being set again
+    void clearExcludedAtoms() {
+      unsigned n = std::max(excluded_rec.size(), excluded_lig.size());
+      for (unsigned i = 0; i < n && i < batch_info.size(); i++) {
+        mol_info& minfo = batch_info[i];
+        minfo.transformed_rec_atoms.copyInto(minfo.orig_rec_atoms);
+        minfo.transformed_lig_atoms.copyInto(minfo.orig_lig_atoms);
+      }
+      excluded_rec.clear();
+      excluded_lig.clear();
+    }
+
+    unsigned getBatchSize() const {
+      return batch_info.size();
+    }
+
     //set center to use for memory ligand
     void setGridCenter(const vec& center) {
       grid_center = center;
@@ -133,6 +169,11 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
       return numchannels;
     }
 
+    //receptor channels come first in the data blob
+    unsigned getNumReceptorChannels() const {
+      return numReceptorTypes;
+    }
+
     virtual void dumpDiffDX(const std::string& prefix, Blob<Dtype>* top,  double scale) const;
     virtual void dumpGridDX(const std::string& prefix, Dtype* top, double scale = 1.0) const;
 
@@ -250,12 +291,42 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     libmolgrid::ExampleProvider data;
     libmolgrid::ExampleProvider data2;
 
+    //a batch made by the prefetch thread, with everything forward sets
+    struct prefetch_batch : public Batch<Dtype> {
+      vector<mol_info> info;
+      vector<Dtype> labels;
+      vector<Dtype> affinities;
+      vector<Dtype> rmsds;
+      vector<Dtype> seqcont;
+      vector<output_transform> perturbations;
+    };
+    vector<shared_ptr<prefetch_batch> > prefetch;
+    BlockingQueue<Batch<Dtype>*> prefetch_free;
+    BlockingQueue<Batch<Dtype>*> prefetch_full;
+    //last transformation at each batch position, for groups that continue
+    //into the next batch; only used by the prefetch thread
+    vector<libmolgrid::Transform> prefetch_transforms;
+
+    //test grids from earlier passes through the data, NULL if not caching
+    struct grid_cache;
+    shared_ptr<grid_cache> test_cache;
+    unsigned cache_pos = 0; //position in the data of the next example
+    vector<Dtype> cache_grid; //host copy of a grid when gridding on the gpu
+
+    //data parallel solvers each take every shard_stride-th example
+    unsigned shard_stride = 1;
+    //stands in for libmolgrid's process wide generator while a sharded
+    //provider is used; seeded the same in every solver
+    std::default_random_engine shard_engine;
+
     float data_ratio = 0.0;
     unsigned example_size = 0; //channels*numgridpoints
 
     vector<int> top_shape;
     gfloat3 grid_center = gfloat3(NAN,NAN,NAN);
     bool inmem = false;
+    vector<vector<unsigned> > excluded_rec; //see setExcludedAtoms
+    vector<vector<unsigned> > excluded_lig;
 
     //batch labels split into individual vectors
     vector<Dtype> labels;
@@ -293,12 +364,26 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     vector<typename MolGridDataLayer<Dtype>::mol_info> batch_info;
 
     ////////////////////   PROTECTED METHODS   //////////////////////
+    //random transformations come from rng if given, else from the global
+    //caffe and libmolgrid generators
     void set_grid_ex(Dtype *grid, const libmolgrid::Example& ex,
         typename MolGridDataLayer<Dtype>::mol_info& minfo,
-        int pose, output_transform& pertub, bool gpu, bool keeptransform);
+        int pose, output_transform& pertub, bool gpu, bool keeptransform,
+        rng_t* rng = NULL);
     virtual void set_grid_minfo(Dtype *grid,
         typename MolGridDataLayer<Dtype>::mol_info& minfo,
-        output_transform& peturb, bool gpu, bool keeptransform);
+        output_transform& peturb, bool gpu, bool keeptransform,
+        rng_t* rng = NULL);
+
+    void next_example(libmolgrid::ExampleProvider& provider,
+        libmolgrid::Example& ex);
+    bool cached_example(Dtype *grid, unsigned nposes, bool hasaffinity,
+        bool hasrmsd, bool gpu);
+    void cache_example(const Dtype *grid, unsigned nposes,
+        const libmolgrid::Example& ex, bool gpu);
+
+    virtual void InternalThreadEntry();
+    void load_batch(prefetch_batch& batch);
 
     //stuff for outputing dx grids
     std::string getIndexName(const vector<int>& map, unsigned index) const;
@@ -95,6 +95,19 @@ class Net {
    */
   void ClearBlobs();
 
+  /**
+   * @brief Let intermediate blobs whose lifetimes do not overlap share memory.
+   *
+   * For nets that are only run forward.  A blob is live from the layer that
+   * produces it to the last layer that reads it; blobs a layer aliases
+   * (Split, Flatten, Reshape) are treated as one.  Data layer tops and net
+   * outputs keep their own memory so they can be filled and read between
+   * passes, and the diffs of shared blobs are released.  After this,
+   * intermediate blobs only hold valid data during Forward and the net can
+   * not be run backward.
+   */
+  void PlanInferenceMemory();
+
   Dtype ForwardBackward() {
     Dtype loss;
     Forward(&loss);
@@ -343,6 +356,8 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether PlanInferenceMemory has shared activation memory.
+  bool inference_memory_planned_;
   // Callbacks
   vector<Callback*> before_forward_;
   vector<Callback*> after_forward_;
@@ -1,8 +1,6 @@
 #ifndef CAFFE_PARALLEL_HPP_
 #define CAFFE_PARALLEL_HPP_
 
-#ifdef USE_NCCL
-
 #include <boost/thread.hpp>
 
 #include <string>
@@ -16,7 +14,9 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
+#endif
 
 namespace caffe {
 
@@ -48,6 +48,91 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
+// Params stored in host memory.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  explicit CPUParams(shared_ptr<Solver<Dtype> > root_solver);
+  virtual ~CPUParams();
+
+  void Configure(Solver<Dtype>* solver) const;
+
+ protected:
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+// Data parallel training on the CPU.  Solvers run in threads of one process,
+// each with its own net and so its own data layer shard, and average their
+// gradients through shared memory.  With layer_wise_reduce, gradients are
+// reduced in buckets of consecutive layers as soon as every solver has
+// computed them; the solver that finishes a bucket last reduces it while the
+// others continue their backward pass.
+template<typename Dtype>
+class CPUSync : public CPUParams<Dtype>,
+                public Solver<Dtype>::Callback,
+                public Net<Dtype>::Callback {
+ public:
+  // State shared by the solvers of one Run.
+  struct Shared {
+    Shared(int solvers, int buckets);
+
+    boost::barrier barrier;
+    boost::mutex mutex;
+    boost::condition_variable reduced_cond;
+    vector<CPUSync<Dtype>*> syncs;
+    vector<int> arrived;  // solvers done computing each bucket
+    size_t reduced;       // buckets reduced since the start of Run
+  };
+
+  explicit CPUSync(shared_ptr<Solver<Dtype> > solver);
+  ~CPUSync() {}
+
+  // Registers this solver with the others and installs callbacks.
+  void Attach(Shared* shared);
+
+  /**
+   * Copy weights from rank 0 to the other solvers.
+   */
+  void Broadcast();
+
+  /**
+   * Single process, solver_count solvers in as many threads; rank 0 runs
+   * on the calling thread.
+   */
+  void Run(const char* restore);
+
+  int buckets() const {
+    return bucket_begin_.size();
+  }
+
+ protected:
+  void on_start() {}
+  void run(int layer);  // Net callback
+  void on_gradients_ready();
+  // Called by every solver once its part of a bucket is computed.
+  void Arrive(int bucket);
+  // Average a bucket over all solvers.
+  void Reduce(int bucket);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  Shared* shared_;
+  bool layer_wise_;
+  // Buckets as ranges of the parameter buffers, in backward order.
+  vector<size_t> bucket_begin_;
+  vector<size_t> bucket_end_;
+  // Bucket completed by the backward pass of each layer, -1 if none.
+  vector<int> layer_bucket_;
+  // Reduced buckets to wait for before applying the update.
+  size_t expected_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+#ifdef USE_NCCL
+
 // Params stored in GPU memory.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
@@ -117,7 +202,8 @@ class NCCL : public GPUParams<Dtype>,
   using Params<Dtype>::diff_;
 };
 
+#endif  // USE_NCCL
+
 }  // namespace caffe
 
-#endif  // USE_NCCL
 #endif  // header
@@ -33,6 +33,8 @@ class SGDSolver : public Solver<Dtype> {
   virtual void ClipGradients();
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
+  virtual bool SolverStateToProto(const string& model_filename,
+      SolverState* state);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
   virtual void RestoreSolverStateFromHDF5(const string& state_file);
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file);
@@ -6,6 +6,7 @@
 
 #include "caffe/net.hpp"
 #include "caffe/solver_factory.hpp"
+#include "caffe/util/async_writer.hpp"
 #include "caffe/util/benchmark.hpp"
 
 namespace caffe {
@@ -64,8 +65,10 @@ class Solver {
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
-  // written to disk together with the learned net.
+  // written to disk together with the learned net. With async_snapshot, the
+  // files may still be written after it returns; see WaitForSnapshots().
   string Snapshot();
+  void WaitForSnapshots();
   virtual ~Solver() {}
   inline const SolverParameter& param() const { return param_; }
   inline shared_ptr<Net<Dtype> > net() { return net_; }
@@ -114,6 +117,12 @@ class Solver {
   // The test routine
   void Test(const int test_net_id = 0);
   virtual void SnapshotSolverState(const string& model_filename) = 0;
+  // Copies the solver state for an asynchronous snapshot; solvers that
+  // return false are snapshotted synchronously.
+  virtual bool SolverStateToProto(const string& model_filename,
+      SolverState* state) {
+    return false;
+  }
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
   void DisplayOutputBlobs(const int net_id);
@@ -135,6 +144,9 @@ class Solver {
   // True iff a request to stop early was received.
   bool requested_early_exit_;
 
+  // Writes asynchronous snapshots, NULL unless async_snapshot is set.
+  shared_ptr<AsyncWriter> snapshot_writer_;
+
   // Timing information, handy to tune e.g. nbr of GPUs
   Timer iteration_timer_;
   float iterations_last_;
@@ -0,0 +1,37 @@
+#ifndef CAFFE_UTIL_ASYNC_WRITER_HPP_
+#define CAFFE_UTIL_ASYNC_WRITER_HPP_
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Runs jobs that write files, e.g. snapshots, each in its own background
+// thread. At most max_pending jobs run at a time; Run blocks until one
+// finishes when that many are pending.
+class AsyncWriter {
+ public:
+  explicit AsyncWriter(int max_pending);
+  // Waits for pending jobs.
+  ~AsyncWriter();
+
+  void Run(const boost::function<void()>& job);
+  // Blocks until every pending job is done.
+  void Wait();
+
+ protected:
+  void Entry(boost::function<void()> job);
+
+  const int max_pending_;
+  int pending_;
+  boost::mutex mutex_;
+  boost::condition_variable done_;
+
+DISABLE_COPY_AND_ASSIGN(AsyncWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_ASYNC_WRITER_HPP_
@@ -0,0 +1,67 @@
+#ifndef _CAFFE_UTIL_DIRECT_CONV_HPP_
+#define _CAFFE_UTIL_DIRECT_CONV_HPP_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// Direct (no im2col buffer) 3D convolution of a single example.
+// Shapes are depth, height, width; weights are laid out as in
+// ConvolutionLayer (num_output x channels x kd x kh x kw) and dilation is
+// not supported.  Loops run over output channels and depth planes, which
+// are split across threads with caffe_parallel_for, and the innermost loop
+// is a unit stride sweep along a row that the compiler can vectorize.
+//
+// For mostly empty inputs (e.g. molecular density grids) active_rows can
+// flag, per channel, depth and height, the rows that hold any nonzero
+// value; the other rows are skipped, so the work scales with the occupied
+// volume rather than the box.  NULL means every row is used.
+
+// Fills active_rows (channels x depth x height) from data_in and returns
+// the number of active rows.
+template <typename Dtype>
+int direct_conv3d_active_rows(const Dtype* data_in, const int channels,
+    const int* in_shape, unsigned char* active_rows);
+
+// data_out = weights * data_in + bias (overwritten).  bias may be NULL.
+// If relu is set each output plane is rectified, with the given negative
+// slope, while it is still in cache.
+template <typename Dtype>
+void direct_conv3d_cpu(const Dtype* data_in, const int channels,
+    const int* in_shape, const Dtype* weights, const int num_output,
+    const int* out_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, const Dtype* bias,
+    const bool relu, const Dtype negative_slope, Dtype* data_out);
+
+// int8 version of direct_conv3d_cpu for quantized layers: data_in and the
+// weights are int8 values of scale input_scale and weight_scales[o]
+// (per output channel).  The int32 sums of each output plane are scaled
+// back, offset by bias and rectified while they are in cache.
+template <typename Dtype>
+void direct_conv3d_s8_cpu(const int8_t* data_in, const Dtype input_scale,
+    const int channels, const int* in_shape, const int8_t* weights,
+    const Dtype* weight_scales, const int num_output, const int* out_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const unsigned char* active_rows, const Dtype* bias, const bool relu,
+    const Dtype negative_slope, Dtype* data_out);
+
+// diff_in = transpose convolution of diff_out (overwritten).  Rows that
+// are not active are set to zero rather than computed, which is only
+// correct for consumers that read the diff where the input is nonzero
+// (atom gradients of a density grid).
+template <typename Dtype>
+void direct_conv3d_backward_cpu(const Dtype* diff_out, const int num_output,
+    const int* out_shape, const Dtype* weights, const int channels,
+    const int* in_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, Dtype* diff_in);
+
+// weight_diff += correlation of data_in with diff_out
+template <typename Dtype>
+void direct_conv3d_weight_cpu(const Dtype* data_in, const int channels,
+    const int* in_shape, const Dtype* diff_out, const int num_output,
+    const int* out_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, Dtype* weight_diff);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DIRECT_CONV_HPP_
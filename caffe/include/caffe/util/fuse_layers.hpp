@@ -0,0 +1,24 @@
+#ifndef _CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define _CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy a trained TEST phase NetParameter (layers with their blobs, as
+// written by Net::ToProto) with elementwise layers folded away for
+// inference:
+//  - BatchNorm using global statistics and per channel Scale layers that
+//    read only the output of a Convolution are folded into its weights
+//    and bias,
+//  - a ReLU that reads only the output of a Convolution is applied inside
+//    it (ConvolutionParameter.fused_relu),
+//  - remaining BatchNorm layers become Scale layers and chains of Scale
+//    layers are merged into one.
+// The result computes the same outputs with fewer passes over activations
+// but cannot be trained or run backward through the fused convolutions.
+void FuseInferenceLayers(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_FUSE_LAYERS_HPP_
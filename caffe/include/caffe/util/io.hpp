@@ -90,6 +90,14 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Writes a temporary file, syncs it to disk and renames it to filename, so
+// filename is never left partially written.
+void WriteProtoToBinaryFileAtomic(const Message& proto, const char* filename);
+inline void WriteProtoToBinaryFileAtomic(
+    const Message& proto, const string& filename) {
+  WriteProtoToBinaryFileAtomic(proto, filename.c_str());
+}
+
 bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
 
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
@@ -0,0 +1,34 @@
+#ifndef CAFFE_UTIL_PARALLEL_FOR_HPP_
+#define CAFFE_UTIL_PARALLEL_FOR_HPP_
+
+#include <boost/function.hpp>
+
+namespace caffe {
+
+// Splits [0, n) into contiguous chunks and calls body(begin, end) on each,
+// one chunk per CPU thread, returning once every chunk is done.  Built with
+// OpenMP the chunks run on the OpenMP team; otherwise they run on a
+// process-wide pool of boost threads (hardware_concurrency - 1 workers
+// plus the calling thread, unless capped by caffe_set_parallel_threads), so
+// the default build is threaded too.  An
+// exception thrown by a chunk is rethrown to the caller once all chunks
+// have finished.
+//
+// Only one loop uses the pool at a time.  A call made while the pool is
+// busy, e.g. from a chunk of another loop or from a second thread that is
+// already running nets in parallel, runs serially on the calling thread
+// instead of oversubscribing the CPUs.
+void caffe_parallel_for(const int n,
+    const boost::function<void(int, int)>& body);
+
+// Number of threads caffe_parallel_for splits loops over.
+int caffe_parallel_threads();
+
+// Split later loops over at most threads threads, including the caller,
+// e.g. to honor an application's thread count on a shared node.  Defaults
+// to the number of CPUs.
+void caffe_set_parallel_threads(const int threads);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_FOR_HPP_
@@ -0,0 +1,53 @@
+#ifndef _CAFFE_UTIL_QUANTIZE_HPP_
+#define _CAFFE_UTIL_QUANTIZE_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Symmetric int8 quantization: x ~= scale * q with q in [-127, 127].
+
+// Scale that maps [-range, range] onto the int8 values.
+template <typename Dtype>
+inline Dtype quantization_scale(const Dtype range) {
+  return range > 0 ? range / 127 : Dtype(1);
+}
+
+// q = round(x / scale), saturated
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* q);
+
+// C = A * op(B) for row major int8 A (M x K) and B (K x N, or N x K when
+// TransB is CblasTrans), accumulated in int32 (overwritten).
+void caffe_cpu_gemm_s8(const CBLAS_TRANSPOSE TransB, const int M,
+    const int N, const int K, const int8_t* A, const int8_t* B, int32_t* C);
+
+// The weights of a Convolution or InnerProduct layer quantized with one
+// scale per output.  Update is cheap when nothing changed: the weights are
+// requantized only when the blob's memory is replaced (e.g. by
+// Net::ShareTrainedLayersWith), so weights edited in place after the first
+// quantized forward pass are not picked up.
+template <typename Dtype>
+class QuantizedWeights {
+ public:
+  QuantizedWeights() : source_(NULL) {}
+  // weights hold num_output rows, or num_output columns if transposed
+  void Update(const Blob<Dtype>& weights, const int num_output,
+      const bool transposed = false);
+  const int8_t* data() const { return &data_[0]; }
+  const Dtype* scales() const { return &scales_[0]; }
+
+ private:
+  const void* source_;
+  std::vector<int8_t> data_;
+  std::vector<Dtype> scales_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZE_HPP_
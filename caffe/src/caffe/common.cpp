@@ -61,6 +61,8 @@ Caffe::~Caffe() { }
 void Caffe::set_random_seed(const unsigned int seed) {
   // RNG seed
   Get().random_generator_.reset(new RNG(seed));
+
+  libmolgrid::random_engine.seed(seed);
 }
 
 void Caffe::SetDevice(const int device_id) {
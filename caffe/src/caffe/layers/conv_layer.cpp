@@ -1,9 +1,121 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/direct_conv.hpp"
+#include "caffe/util/im2col.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  direct_cpu_ = conv_param.sparse_input() && this->num_spatial_axes_ == 3
+      && this->group_ == 1 && !this->is_1x1_;
+  const int* dilation_data = this->dilation_.cpu_data();
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    if (dilation_data[i] != 1) direct_cpu_ = false;
+  }
+  sparse_input_ = direct_cpu_;
+  fused_relu_ = conv_param.fused_relu();
+  relu_negative_slope_ = conv_param.fused_relu_negative_slope();
+  input_range_ = this->layer_param_.quantization_param().input_range();
+  quantized_ = input_range_ > 0;
+  if (quantized_ && this->group_ != 1) {
+    LOG(WARNING) << "Layer " << this->layer_param_.name()
+        << " is grouped and will not be quantized";
+    quantized_ = false;
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_quantized(const Dtype* input,
+    Dtype* output) {
+  quantized_weights_.Update(*this->blobs_[0], this->num_output_);
+  const int kernel_dim = this->col_buffer_shape_[0];
+  const int spatial_dim = this->out_spatial_dim_;
+  const Dtype input_scale = quantization_scale(input_range_);
+  quantized_input_.resize(this->bottom_dim_);
+  caffe_cpu_quantize(this->bottom_dim_, input, input_scale,
+      &quantized_input_[0]);
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  if (direct_cpu_) {
+    // sparse 3D input: quantized rows are convolved in place, skipping the
+    // empty ones, with no column buffer
+    direct_conv3d_s8_cpu(&quantized_input_[0], input_scale,
+        this->channels_, this->conv_input_shape_.cpu_data() + 1,
+        quantized_weights_.data(), quantized_weights_.scales(),
+        this->num_output_, this->output_shape_.data(),
+        this->kernel_shape_.cpu_data(), this->pad_.cpu_data(),
+        this->stride_.cpu_data(), find_active_rows(input), bias, fused_relu_,
+        relu_negative_slope_, output);
+    return;
+  }
+  const int8_t* col = &quantized_input_[0];
+  if (!this->is_1x1_) {
+    quantized_col_.resize(kernel_dim * spatial_dim);
+    if (!this->force_nd_im2col_ && this->num_spatial_axes_ == 2) {
+      im2col_cpu(col, this->channels_,
+          this->conv_input_shape_.cpu_data()[1],
+          this->conv_input_shape_.cpu_data()[2],
+          this->kernel_shape_.cpu_data()[0], this->kernel_shape_.cpu_data()[1],
+          this->pad_.cpu_data()[0], this->pad_.cpu_data()[1],
+          this->stride_.cpu_data()[0], this->stride_.cpu_data()[1],
+          this->dilation_.cpu_data()[0], this->dilation_.cpu_data()[1],
+          &quantized_col_[0]);
+    } else {
+      im2col_nd_cpu(col, this->num_spatial_axes_,
+          this->conv_input_shape_.cpu_data(), this->col_buffer_shape_.data(),
+          this->kernel_shape_.cpu_data(), this->pad_.cpu_data(),
+          this->stride_.cpu_data(), this->dilation_.cpu_data(),
+          &quantized_col_[0]);
+    }
+    col = &quantized_col_[0];
+  }
+  quantized_output_.resize(this->num_output_ * spatial_dim);
+  caffe_cpu_gemm_s8(CblasNoTrans, this->num_output_, spatial_dim, kernel_dim,
+      quantized_weights_.data(), col, &quantized_output_[0]);
+  for (int o = 0; o < this->num_output_; ++o) {
+    const Dtype scale = quantized_weights_.scales()[o] * input_scale;
+    const Dtype shift = bias ? bias[o] : Dtype(0);
+    const int32_t* acc = &quantized_output_[o * spatial_dim];
+    Dtype* out = output + o * spatial_dim;
+    for (int p = 0; p < spatial_dim; ++p) {
+      out[p] = acc[p] * scale + shift;
+    }
+    if (fused_relu_) {
+      for (int p = 0; p < spatial_dim; ++p) {
+        out[p] = std::max(out[p], Dtype(0))
+            + relu_negative_slope_ * std::min(out[p], Dtype(0));
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+const unsigned char* ConvolutionLayer<Dtype>::find_active_rows(
+    const Dtype* input) {
+  if (!sparse_input_) return NULL;
+  const int* in_shape = this->conv_input_shape_.cpu_data() + 1;
+  active_rows_.resize(this->channels_ * in_shape[0] * in_shape[1]);
+  direct_conv3d_active_rows(input, this->channels_, in_shape,
+      &active_rows_[0]);
+  return &active_rows_[0];
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::fused_relu_cpu(Blob<Dtype>* top) {
+  if (!fused_relu_) return;
+  Dtype* top_data = top->mutable_cpu_data();
+  for (int i = 0, n = top->count(); i < n; ++i) {
+    top_data[i] = std::max(top_data[i], Dtype(0))
+        + relu_negative_slope_ * std::min(top_data[i], Dtype(0));
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::compute_output_shape() {
   const int* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -29,6 +141,23 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
     for (int n = 0; n < this->num_; ++n) {
+      if (quantized_) {
+        forward_cpu_quantized(bottom_data + n * this->bottom_dim_,
+            top_data + n * this->top_dim_);
+        continue;
+      }
+      if (direct_cpu_) {
+        // bias and activation are applied inside the convolution loop
+        const Dtype* input = bottom_data + n * this->bottom_dim_;
+        direct_conv3d_cpu(input,
+            this->channels_, this->conv_input_shape_.cpu_data() + 1, weight,
+            this->num_output_, this->output_shape_.data(),
+            this->kernel_shape_.cpu_data(), this->pad_.cpu_data(),
+            this->stride_.cpu_data(), find_active_rows(input),
+            this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL,
+            fused_relu_, relu_negative_slope_, top_data + n * this->top_dim_);
+        continue;
+      }
       this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
       if (this->bias_term_) {
@@ -36,14 +165,22 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
       }
     }
+    if (!direct_cpu_ && !quantized_) fused_relu_cpu(top[i]);
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!fused_relu_) << "Layer " << this->layer_param_.name()
+      << " has a fused ReLU and can only be run forward";
+  CHECK(!quantized_) << "Layer " << this->layer_param_.name()
+      << " is quantized and can only be run forward";
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  // not allocated for frozen weights, e.g. when only input gradients are
+  // needed
+  Dtype* weight_diff = this->param_propagate_down_[0] ?
+      this->blobs_[0]->mutable_cpu_diff() : NULL;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
@@ -57,15 +194,35 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int n = 0; n < this->num_; ++n) {
+        const unsigned char* active_rows =
+            find_active_rows(bottom_data + n * this->bottom_dim_);
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
-              top_diff + n * this->top_dim_, weight_diff);
+          if (direct_cpu_) {
+            direct_conv3d_weight_cpu(bottom_data + n * this->bottom_dim_,
+                this->channels_, this->conv_input_shape_.cpu_data() + 1,
+                top_diff + n * this->top_dim_, this->num_output_,
+                this->output_shape_.data(), this->kernel_shape_.cpu_data(),
+                this->pad_.cpu_data(), this->stride_.cpu_data(), active_rows,
+                weight_diff);
+          } else {
+            this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+                top_diff + n * this->top_dim_, weight_diff);
+          }
         }
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
+          if (direct_cpu_) {
+            direct_conv3d_backward_cpu(top_diff + n * this->top_dim_,
+                this->num_output_, this->output_shape_.data(), weight,
+                this->channels_, this->conv_input_shape_.cpu_data() + 1,
+                this->kernel_shape_.cpu_data(), this->pad_.cpu_data(),
+                this->stride_.cpu_data(), active_rows,
+                bottom_diff + n * this->bottom_dim_);
+          } else {
+            this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+                bottom_diff + n * this->bottom_dim_);
+          }
         }
       }
     }
@@ -4,6 +4,24 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void FusedReLUForward(const int n, Dtype* data,
+    Dtype negative_slope) {
+  CUDA_KERNEL_LOOP(index, n) {
+    data[index] = data[index] > 0 ? data[index] : data[index] * negative_slope;
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::fused_relu_gpu(Blob<Dtype>* top) {
+  if (!fused_relu_) return;
+  const int count = top->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  FusedReLUForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+      count, top->mutable_gpu_data(), relu_negative_slope_);
+  CUDA_POST_KERNEL_CHECK;
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -19,14 +37,18 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         this->forward_gpu_bias(top_data + n * this->top_dim_, bias);
       }
     }
+    fused_relu_gpu(top[i]);
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!fused_relu_) << "Layer " << this->layer_param_.name()
+      << " has a fused ReLU and can only be run forward";
   const Dtype* weight = this->blobs_[0]->gpu_data();
-  Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
+  Dtype* weight_diff = this->param_propagate_down_[0] ?
+      this->blobs_[0]->mutable_gpu_diff() : NULL;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->gpu_diff();
     // Bias gradient, if necessary.
@@ -56,5 +78,7 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS(ConvolutionLayer);
+template void ConvolutionLayer<float>::fused_relu_gpu(Blob<float>* top);
+template void ConvolutionLayer<double>::fused_relu_gpu(Blob<double>* top);
 
 }  // namespace caffe
@@ -52,6 +52,8 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  input_range_ = this->layer_param_.quantization_param().input_range();
+  quantized_ = input_range_ > 0;
 }
 
 template <typename Dtype>
@@ -85,6 +87,25 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
+  if (quantized_) {
+    quantized_weights_.Update(*this->blobs_[0], N_, transpose_);
+    const Dtype input_scale = quantization_scale(input_range_);
+    quantized_input_.resize(M_ * K_);
+    quantized_output_.resize(M_ * N_);
+    caffe_cpu_quantize(M_ * K_, bottom_data, input_scale,
+        &quantized_input_[0]);
+    caffe_cpu_gemm_s8(CblasTrans, M_, N_, K_, &quantized_input_[0],
+        quantized_weights_.data(), &quantized_output_[0]);
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    for (int m = 0; m < M_; ++m) {
+      for (int n = 0; n < N_; ++n) {
+        top_data[m * N_ + n] = quantized_output_[m * N_ + n]
+            * quantized_weights_.scales()[n] * input_scale
+            + (bias ? bias[n] : Dtype(0));
+      }
+    }
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   caffe_cpu_gemm<Dtype>(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans,
       M_, N_, K_, (Dtype)1.,
@@ -100,6 +121,8 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!quantized_) << "Layer " << this->layer_param_.name()
+      << " is quantized and can only be run forward";
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
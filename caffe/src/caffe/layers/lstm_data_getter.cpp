@@ -1,5 +1,9 @@
+#include <cstring>
+
 #include "caffe/layer.hpp"
 #include "caffe/layers/flex_lstm_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -10,6 +14,8 @@ void LSTMDataGetterLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   //data members. 
   const LSTMDataGetterParameter& param = this->layer_param_.lstm_datagetter_param();
   cube_stride = param.stride();
+  batch_size = bottom[0]->shape(0);
+  ntypes = bottom[0]->shape(1);
   if (cube_stride) {
     pattern = AccessPatterns::strided_cube;
     Dtype subgrid_dim_in_angstroms = param.subgrid_dim();
@@ -24,8 +30,6 @@ void LSTMDataGetterLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     std::cerr << "Flex LSTM layer currently only supports a strided cube access pattern";
     exit(-1);
   }
-  batch_size = bottom[0]->shape(0);
-  ntypes = bottom[0]->shape(1);
   current_timestep = this->layer_param_.lstm_datagetter_param().timestep();
   Reshape(bottom, top);
 }
@@ -71,54 +75,68 @@ void LSTMDataGetterLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+//the subcube at a timestep starts at these offsets in the full grid
+template <typename Dtype>
+void LSTMDataGetterLayer<Dtype>::SubcubeOffsets(unsigned timestep,
+    unsigned& x_offset, unsigned& y_offset, unsigned& z_offset) const {
+  unsigned factor = (((dim - subgrid_dim) / cube_stride) + 1);
+  x_offset = ((timestep / (factor * factor)) % factor) * cube_stride;
+  y_offset = ((timestep / factor) % factor) * cube_stride;
+  z_offset = (timestep % factor) * cube_stride;
+}
+
+//strided cube version: each (batch, type) pair of a subcube is
+//subgrid_dim^2 runs of subgrid_dim contiguous values, at a stride of dim
+//in the full grid; pairs are independent so they are spread over threads
+//with caffe_parallel_for
 template <typename Dtype>
 void GetData(const Dtype* src, Dtype* dest, unsigned dim, unsigned subgrid_dim, 
     unsigned x_offset, unsigned y_offset, unsigned z_offset, unsigned batch_size, 
     unsigned ntypes) {
-  //strided cube version:
   //extract a single subcube corresponding to the correct stride,
   //starting at our properly offset (x,y,z) indices
-  unsigned overall_size = dim * dim * dim;
-  unsigned example_size = ntypes * dim * dim * dim;
-  for (unsigned batch_idx=0; batch_idx < batch_size; ++batch_idx) {
-    for (unsigned grid=0; grid < ntypes; ++grid) {
-      for (unsigned i=0; i<subgrid_dim; ++i) {
-        for (unsigned j=0; j<subgrid_dim; ++j) {
-          for (unsigned k=0; k<subgrid_dim; ++k) {
-            dest[(((batch_idx * ntypes + grid) * subgrid_dim + i) * subgrid_dim + j) * 
-              subgrid_dim + k] = src[batch_idx * example_size + grid * overall_size + 
-              x_offset * dim * dim + y_offset * dim + z_offset + 
-              ((i * dim) + j) * dim + k];
-          }
+  const int overall_size = dim * dim * dim;
+  const int subgrid_size = subgrid_dim * subgrid_dim * subgrid_dim;
+  const int start = (x_offset * dim + y_offset) * dim + z_offset;
+  const int ngrids = batch_size * ntypes;
+  caffe_parallel_for(ngrids, [&](int begin, int end) {
+    for (int g = begin; g < end; ++g) {
+      const Dtype* from = src + g * overall_size + start;
+      Dtype* to = dest + g * subgrid_size;
+      for (unsigned i = 0; i < subgrid_dim; ++i) {
+        for (unsigned j = 0; j < subgrid_dim; ++j) {
+          memcpy(to, from + (i * dim + j) * dim, subgrid_dim * sizeof(Dtype));
+          to += subgrid_dim;
         }
       }
     }
-  }
+  });
 }
 
 template <typename Dtype>
 void AccumulateDiff(const Dtype* src, Dtype* dest, unsigned dim, unsigned subgrid_dim, 
     unsigned x_offset, unsigned y_offset, unsigned z_offset, unsigned batch_size, 
     unsigned ntypes) {
-  //strided cube version:
   //accumulate diff for subcube into the correct location in the full grid
-  unsigned overall_size = dim * dim * dim;
-  unsigned example_size = ntypes * dim * dim * dim;
-  for (unsigned batch_idx=0; batch_idx < batch_size; ++batch_idx) {
-    for (unsigned grid=0; grid < ntypes; ++grid) {
-      for (unsigned i=0; i<subgrid_dim; ++i) {
-        for (unsigned j=0; j<subgrid_dim; ++j) {
-          for (unsigned k=0; k<subgrid_dim; ++k) {
-            dest[batch_idx * example_size + grid * overall_size + 
-               x_offset * dim * dim + y_offset * dim + z_offset + 
-               ((i * dim) + j) * dim + k] += 
-            src[(((batch_idx * ntypes + grid) * subgrid_dim + i) * subgrid_dim + j) * 
-              subgrid_dim + k];
+  const int overall_size = dim * dim * dim;
+  const int subgrid_size = subgrid_dim * subgrid_dim * subgrid_dim;
+  const int start = (x_offset * dim + y_offset) * dim + z_offset;
+  const int ngrids = batch_size * ntypes;
+  caffe_parallel_for(ngrids, [&](int begin, int end) {
+    for (int g = begin; g < end; ++g) {
+      const Dtype* from = src + g * subgrid_size;
+      Dtype* to = dest + g * overall_size + start;
+      for (unsigned i = 0; i < subgrid_dim; ++i) {
+        for (unsigned j = 0; j < subgrid_dim; ++j) {
+          Dtype* row = to + (i * dim + j) * dim;
+          for (unsigned k = 0; k < subgrid_dim; ++k) {
+            row[k] += from[k];
           }
+          from += subgrid_dim;
         }
       }
     }
-  }
+  });
 }
 
 template <typename Dtype>
@@ -134,10 +152,8 @@ void LSTMDataGetterLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         //use the current_timestep to find the location of the first value in
         //the subcube we're going to use at this timestep; this is our starting
         //offset
-        unsigned factor = (((dim - subgrid_dim) / cube_stride) + 1);
-        unsigned x_offset = ((current_timestep / (factor * factor)) % factor) * cube_stride;
-        unsigned y_offset = ((current_timestep / factor) % factor) * cube_stride;
-        unsigned z_offset = (current_timestep % factor) * cube_stride;
+        unsigned x_offset, y_offset, z_offset;
+        SubcubeOffsets(current_timestep, x_offset, y_offset, z_offset);
         GetData(src, dest, dim, subgrid_dim, x_offset, y_offset, z_offset, batch_size, ntypes);
         break;
       }
@@ -161,24 +177,20 @@ void LSTMDataGetterLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   //computed their diffs with it, so now we set up the contents to work for the
   //layers before it
   Dtype* total_diff = bottom[0]->mutable_cpu_diff();
-  //if we're just starting backward, zero grid diff...is this necessary?
+  //if we're just starting backward, zero grid diff
   if (current_timestep == num_timesteps-1) {
-    memset(total_diff, 0, num_timesteps * batch_size * ntypes * dim * dim * dim);
+    caffe_set(bottom[0]->count(), Dtype(0), total_diff);
   }
   switch(pattern) {
     case AccessPatterns::strided_cube:
       {
-        unsigned factor = (((dim - subgrid_dim) / cube_stride) + 1);
-        unsigned x_offset = ((current_timestep / (factor * factor)) % factor) * cube_stride;
-        unsigned y_offset = ((current_timestep/ factor) % factor) * cube_stride;
-        unsigned z_offset = (current_timestep % factor) * cube_stride;
+        unsigned x_offset, y_offset, z_offset;
+        SubcubeOffsets(current_timestep, x_offset, y_offset, z_offset);
         //accumulate gradients for the current timestep in the right location
         AccumulateDiff(top[0]->cpu_diff(), total_diff, dim, subgrid_dim, 
             x_offset, y_offset, z_offset, batch_size, ntypes);
         if (current_timestep > 0) {
-          x_offset -= cube_stride;
-          y_offset -= cube_stride;
-          z_offset -= cube_stride;
+          SubcubeOffsets(current_timestep - 1, x_offset, y_offset, z_offset);
           GetData(bottom[0]->cpu_data(), top[0]->mutable_cpu_data(), dim, subgrid_dim, 
               x_offset, y_offset, z_offset, batch_size, ntypes);
         }
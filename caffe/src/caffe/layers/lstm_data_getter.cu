@@ -1,5 +1,6 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/flex_lstm_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -73,9 +74,10 @@ __global__ void LSTMFlexBackward(const int nthreads, const Dtype* src, Dtype* de
     unsigned y_offset_prev; 
     unsigned z_offset_prev; 
     if (current_timestep > 0) {
-      x_offset_prev = x_offset - cube_stride;
-      y_offset_prev = y_offset - cube_stride;
-      z_offset_prev = z_offset - cube_stride;
+      unsigned prev = current_timestep - 1;
+      x_offset_prev = ((prev / (factor * factor)) % factor) * cube_stride;
+      y_offset_prev = ((prev / factor) % factor) * cube_stride;
+      z_offset_prev = (prev % factor) * cube_stride;
     }
 
     unsigned subgrid_count = batch_size * ntypes * subgrid_dim * subgrid_dim * subgrid_dim;
@@ -138,8 +140,7 @@ void LSTMDataGetterLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   Dtype* total_diff = bottom[0]->mutable_gpu_diff();
   const Dtype* partial_diff = top[0]->gpu_diff();
   if (current_timestep == num_timesteps-1) {
-    //TODO: this is a synchronous call, right?
-    CUDA_CHECK(cudaMemset(total_diff, 0, bottom[0]->count()));
+    caffe_gpu_set(bottom[0]->count(), Dtype(0), total_diff);
   }
   const int count = top[0]->count();
   const Dtype* src = bottom[0]->gpu_data();
@@ -6,6 +6,7 @@
 #include <memory>
 
 #include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
@@ -18,7 +19,9 @@
 #include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
+#include <boost/thread.hpp>
 #include <boost/timer/timer.hpp>
 
 #include <libmolgrid/grid_io.h>
@@ -28,6 +31,26 @@ using namespace std;
 
 namespace caffe {
 
+//libmolgrid shuffles with one process wide generator, so providers of
+//solvers training in parallel threads must not draw from it concurrently
+static boost::mutex provider_mutex;
+
+//shuffle seed of each sharded data layer, drawn by the rank 0 solver, which
+//is set up before the others; guarded by provider_mutex
+static map<string, unsigned> shard_seeds;
+
+//while in scope, libmolgrid draws from engine instead of its process wide
+//generator
+class scoped_molgrid_engine {
+    std::default_random_engine* engine;
+  public:
+    explicit scoped_molgrid_engine(std::default_random_engine* e): engine(e) {
+      if (engine) std::swap(*engine, libmolgrid::random_engine);
+    }
+    ~scoped_molgrid_engine() {
+      if (engine) std::swap(*engine, libmolgrid::random_engine);
+    }
+};
 
 template<typename Dtype>
 double MolGridDataLayer<Dtype>::mol_info::ligandRadius() const {
@@ -106,7 +129,7 @@ Dtype MolGridDataLayer<Dtype>::output_transform::convert_to_label(Dtype value, d
 
 template <typename Dtype>
 MolGridDataLayer<Dtype>::~MolGridDataLayer<Dtype>() {
-  //this->StopInternalThread();
+  this->StopInternalThread();
 }
 
 
@@ -482,6 +505,26 @@ void MolGridDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   if(!inmem)
   {
+    boost::mutex::scoped_lock lock(provider_mutex);
+    //shard training examples between data parallel solvers; frames of a
+    //group have to stay together, so grouped data is not sharded.  Every
+    //solver's providers shuffle and sample from an identically seeded
+    //generator, so they see the same stream and the shards do not overlap
+    if (this->phase_ == TRAIN && Caffe::solver_count() > 1) {
+      if (group_size > 1) {
+        LOG(WARNING) << "Grouped examples are not sharded, every solver reads all examples";
+      } else {
+        shard_stride = Caffe::solver_count();
+        const string& name = this->layer_param_.name();
+        if (Caffe::solver_rank() == 0) {
+          shard_seeds[name] = caffe_rng_rand();
+        }
+        CHECK(shard_seeds.count(name)) << "No shuffle seed for layer " << name;
+        shard_engine.seed(shard_seeds[name]);
+      }
+    }
+    scoped_molgrid_engine engine(shard_stride > 1 ? &shard_engine : NULL);
+
     const string& source = param.source();
     const string& source2 = param.source2();
     CHECK_GT(source.length(), 0) << "No data source file provided";
@@ -508,18 +551,37 @@ void MolGridDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     // Check if we would need to randomly skip a few data points
     if (param.rand_skip())
     {
-      unsigned int skip = caffe_rng_rand() %  param.rand_skip();
+      //sharded solvers must skip alike
+      unsigned int skip = (shard_stride > 1 ? unsigned(shard_engine()) :
+          caffe_rng_rand()) %  param.rand_skip();
 
       LOG(INFO) << "Skipping first " << skip << " data points from each source.";
 
       data.skip(skip);
       if(data2.size()) data2.skip(skip);
     }
+
+    if (shard_stride > 1) {
+      data.skip(Caffe::solver_rank());
+      if(data2.size()) data2.skip(Caffe::solver_rank());
+    }
+
+    //later passes see the same examples in the same order, gridded the same
+    if (param.cache_test_grids() && this->phase_ == TEST) {
+      if (param.shuffle() || param.balanced() || param.stratify_receptor() ||
+          param.stratify_affinity_step() > 0 || param.rand_skip() ||
+          param.num_copies() > 1 || data2.size() || group_size > 1 ||
+          randrotate || randtranslate > 0 || jitter > 0 || ligpeturb) {
+        LOG(WARNING) << "Not caching test grids; this needs one unshuffled, "
+            "unbalanced, unstratified source without groups and no random "
+            "transformations";
+      } else {
+        test_cache.reset(new grid_cache(data.size(), param.cache_file()));
+      }
+    }
   }
-  else //in memory always batch size of 1
-  {
-    batch_size = 1;
-  }
+  //in memory every example in the batch is a copy of the one structure that
+  //was set, each under its own random transformation
 
 
   CHECK_GT(batch_size, 0) << "Positive batch size required";
@@ -578,13 +640,32 @@ void MolGridDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     idx++;
   }
   CHECK_EQ(idx,top.size()) << "Inconsistent top size!";
+
+  if (!inmem && param.prefetch() > 0 && !test_cache) {
+    //allocate before starting the thread so it never allocates device memory
+    //while the main thread is running
+    prefetch.resize(param.prefetch());
+    for (unsigned i = 0, n = prefetch.size(); i < n; i++) {
+      prefetch[i].reset(new prefetch_batch);
+      prefetch[i]->data_.Reshape(top_shape);
+      prefetch[i]->data_.mutable_cpu_data();
+#ifndef CPU_ONLY
+      if (Caffe::mode() == Caffe::GPU) prefetch[i]->data_.mutable_gpu_data();
+#endif
+      prefetch[i]->info.resize(batch_size);
+      prefetch_free.push(prefetch[i].get());
+    }
+    prefetch_transforms.resize(batch_size);
+    this->StartInternalThread();
+  }
 }
 
 
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::set_grid_ex(Dtype *data, const Example& ex,
     typename MolGridDataLayer<Dtype>::mol_info& minfo,
-    int pose, output_transform& peturb, bool gpu, bool keeptransform)
+    int pose, output_transform& peturb, bool gpu, bool keeptransform,
+    rng_t* rng)
 {
   //set grid values for example
   //cache atom info
@@ -610,7 +691,7 @@ void MolGridDataLayer<Dtype>::set_grid_ex(Dtype *data, const Example& ex,
   }
 
   try {
-    set_grid_minfo(data, minfo, peturb, gpu, keeptransform);
+    set_grid_minfo(data, minfo, peturb, gpu, keeptransform, rng);
   } catch(...) {
     LOG(WARNING) << "Error processing";
     for(unsigned i = 0, n = ex.sets.size(); i < n; i++) {
@@ -629,9 +710,8 @@ inline double unit_sample(rng_t *rng)
 }
 
 //apply random noise (in place) to coordinates
-static void apply_jitter(CoordinateSet& c, float jitter) {
+static void apply_jitter(CoordinateSet& c, float jitter, rng_t* rng) {
   if(jitter <= 0) return;
-  rng_t* rng = caffe_rng();
   bool ongpu = c.coords.ongpu();
   c.coords.tocpu();
   for (unsigned i = 0, n = c.size(); i < n; i++) {
@@ -643,6 +723,28 @@ static void apply_jitter(CoordinateSet& c, float jitter) {
   if(ongpu) c.coords.togpu();
 }
 
+//random transformation around center drawn from rng, sampled the way the
+//random Transform constructor of libmolgrid samples its global generator
+static Transform random_transform(const gfloat3& center, float translate,
+    bool rotate, rng_t* rng) {
+  Quaternion Q(1, 0, 0, 0);
+  if (rotate) {
+    //uniformly distributed unit quaternion (Shoemake)
+    double u1 = unit_sample(rng);
+    double u2 = unit_sample(rng) * 2.0 * M_PI;
+    double u3 = unit_sample(rng) * 2.0 * M_PI;
+    double s1 = sqrt(1.0 - u1), s2 = sqrt(u1);
+    Q = Quaternion(s1 * sin(u2), s1 * cos(u2), s2 * sin(u3), s2 * cos(u3));
+  }
+  float3 trans = {0, 0, 0};
+  if (translate > 0) {
+    trans.x = translate * (unit_sample(rng) * 2.0 - 1.0);
+    trans.y = translate * (unit_sample(rng) * 2.0 - 1.0);
+    trans.z = translate * (unit_sample(rng) * 2.0 - 1.0);
+  }
+  return Transform(Q, center, trans);
+}
+
 //take a mol info, which includes receptor and ligand atoms
 //and generate the appropriate grids into data
 //applies jitter, peturbation, transformations as needed
@@ -650,7 +752,7 @@ static void apply_jitter(CoordinateSet& c, float jitter) {
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
     typename MolGridDataLayer<Dtype>::mol_info& minfo,
-    output_transform& peturb, bool gpu, bool keeptransform)
+    output_transform& peturb, bool gpu, bool keeptransform, rng_t* rng)
 {
   const MolGridDataParameter& param = this->layer_param_.molgrid_data_param();
   bool fixcenter = param.fix_center_to_origin();
@@ -675,8 +777,12 @@ void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
     rtranslate = min(randtranslate, maxtrans);
   }
 
-  if(!keeptransform) //for groups, only the first frame should set the transform
-    minfo.transform = Transform(rot_center, rtranslate, randrotate);
+  if(!keeptransform) { //for groups, only the first frame should set the transform
+    if(rng)
+      minfo.transform = random_transform(rot_center, rtranslate, randrotate, rng);
+    else
+      minfo.transform = Transform(rot_center, rtranslate, randrotate);
+  }
 
   CoordinateSet& rec_atoms = minfo.transformed_rec_atoms;
   CoordinateSet& lig_atoms = minfo.transformed_lig_atoms;
@@ -687,7 +793,8 @@ void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
   } 
 
   if (ligpeturb) { //apply ligand specific peturbation
-    Transform P(lig_atoms.center(), ligpeturb_translate, ligpeturb_rotate);
+    Transform P = rng ? random_transform(lig_atoms.center(), ligpeturb_translate, ligpeturb_rotate, rng) :
+        Transform(lig_atoms.center(), ligpeturb_translate, ligpeturb_rotate);
     minfo.ligand_perturbation = P;
     P.forward(lig_atoms, lig_atoms); //peturb
 
@@ -706,8 +813,8 @@ void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
   //CoordinateSet atoms = ex.merge_coordinates(); //properly offsets types
   //apply jitter - this is on cpu and so inefficient, if it every turns out to be useful,
   //incorporate it into transform
-  apply_jitter(rec_atoms, jitter);
-  apply_jitter(lig_atoms, jitter);
+  apply_jitter(rec_atoms, jitter, rng ? rng : caffe_rng());
+  apply_jitter(lig_atoms, jitter, rng ? rng : caffe_rng());
 
   //set the grid center
   if(fixcenter) {
@@ -782,6 +889,15 @@ void MolGridDataLayer<Dtype>::dumpGridDX(const std::string& prefix, Dtype* d, do
 }
 
 
+//untype atoms so they are left out of the grid
+static void exclude_atoms(CoordinateSet& atoms, const vector<unsigned>& excluded) {
+  CHECK(atoms.has_indexed_types()) << "Excluding atoms requires indexed types";
+  for (unsigned i = 0, n = excluded.size(); i < n; i++) {
+    CHECK_LT(excluded[i], atoms.size()) << "Excluded atom out of range";
+    atoms.type_index[excluded[i]] = -1;
+  }
+}
+
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top, bool gpu)
 {
@@ -821,10 +937,46 @@ void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const
     if(batch_info[0].orig_rec_atoms.size() == 0) LOG(WARNING) << "Receptor not set in MolGridDataLayer";
     CHECK_GT(batch_info[0].orig_lig_atoms.size(),0) << "Ligand not set in MolGridDataLayer";
     //memory is now available
-    set_grid_minfo(top_data, batch_info[0], peturb, gpu, false);
-    perturbations.push_back(peturb);
+    for (unsigned i = 0, n = batch_info.size(); i < n; i++) {
+      mol_info& minfo = batch_info[i];
+      if (i > 0) {
+        minfo.setReceptor(batch_info[0].orig_rec_atoms);
+        minfo.setLigand(batch_info[0].orig_lig_atoms);
+      } else if (excluded_rec.size() > 0 || excluded_lig.size() > 0) {
+        //undo the exclusions of the last forward
+        minfo.transformed_rec_atoms.copyInto(minfo.orig_rec_atoms);
+        minfo.transformed_lig_atoms.copyInto(minfo.orig_lig_atoms);
+      }
+      //the grid maker skips atoms without a type
+      if (i < excluded_rec.size())
+        exclude_atoms(minfo.transformed_rec_atoms, excluded_rec[i]);
+      if (i < excluded_lig.size())
+        exclude_atoms(minfo.transformed_lig_atoms, excluded_lig[i]);
+      set_grid_minfo(top_data+i*example_size, minfo, peturb, gpu, false);
+      perturbations.push_back(peturb);
+    }
 
     CHECK_GT(labels.size(),0) << "Did not set labels in memory based molgrid";
+    labels.resize(batch_info.size(), labels[0]);
+    affinities.resize(batch_info.size(), affinities[0]);
+    rmsds.resize(batch_info.size(), rmsds[0]);
+  }
+  else if (prefetch.size() > 0)
+  {
+    //everything was prepared by the prefetch thread
+    prefetch_batch* batch = static_cast<prefetch_batch*>(
+        prefetch_full.pop("Waiting for molecular grids"));
+    if (gpu)
+      caffe_copy(batch->data_.count(), batch->data_.gpu_data(), top_data);
+    else
+      caffe_copy(batch->data_.count(), batch->data_.cpu_data(), top_data);
+    batch_info.swap(batch->info);
+    labels.swap(batch->labels);
+    affinities.swap(batch->affinities);
+    rmsds.swap(batch->rmsds);
+    seqcont.swap(batch->seqcont);
+    perturbations.swap(batch->perturbations);
+    prefetch_free.push(batch);
   }
   else
   {
@@ -838,11 +990,23 @@ void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const
     for (int idx = 0, n = chunk_size*batch_size; idx < n; ++idx)
     {
       int batch_idx = idx % batch_size;
+      Dtype *ex_data = top_data+batch_idx*example_size*div;
+      if (test_cache && cached_example(ex_data, div, hasaffinity, hasrmsd, gpu))
+        continue;
+
       Example ex;
       if (batch_idx < dataswitch) {
-        data.next(ex);
+        next_example(data, ex);
       } else {
-        data2.next(ex);
+        next_example(data2, ex);
+      }
+
+      //solvers in other threads share libmolgrid's generator
+      rng_t exrng;
+      rng_t* rng = NULL;
+      if (Caffe::solver_count() > 1) {
+        exrng.seed(caffe_rng_rand());
+        rng = &exrng;
       }
 
       int step = idx / batch_size;
@@ -850,17 +1014,18 @@ void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const
 
       if(!duplicate) {
         updateLabels(ex.labels, hasaffinity, hasrmsd, ex.seqcont);
-        set_grid_ex(top_data+offset, ex, batch_info[batch_idx], numposes > 1 ? -1 : 0, peturb, gpu, ex.seqcont);
+        set_grid_ex(top_data+offset, ex, batch_info[batch_idx], numposes > 1 ? -1 : 0, peturb, gpu, ex.seqcont, rng);
         perturbations.push_back(peturb);
       }
       else {
         for(unsigned p = 0; p < numposes; p++) {
           updateLabels(ex.labels, hasaffinity, hasrmsd, ex.seqcont);
           int p_offset = batch_idx*(example_size*numposes)+example_size*p;
-          set_grid_ex(top_data+p_offset, ex, batch_info[batch_idx], p, peturb, gpu, ex.seqcont);
+          set_grid_ex(top_data+p_offset, ex, batch_info[batch_idx], p, peturb, gpu, ex.seqcont, rng);
           perturbations.push_back(peturb);
         }
       }
+      if (test_cache) cache_example(ex_data, div, ex, gpu);
     }
 
   }
@@ -876,6 +1041,300 @@ void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const
   }
 }
 
+//caffe has a cannonical ordering of labels
+template <typename Dtype>
+static void append_labels(const std::vector<float>& l, bool hasaffinity,
+    bool hasrmsd, bool seq_continued, vector<Dtype>& labels,
+    vector<Dtype>& affinities, vector<Dtype>& rmsds, vector<Dtype>& seqcont) {
+  float pose = 0, affinity = 0, rmsd = 0;
+  unsigned n = l.size();
+
+  if (n > 0) {
+    pose = l[0];
+    if (n > 1) {
+      if (hasaffinity) {
+        affinity = l[1];
+        if (hasrmsd && n > 2)
+          rmsd = l[2];
+      } else if (hasrmsd) {
+        rmsd = l[1];
+      }
+    }
+  }
+  labels.push_back(pose);
+  affinities.push_back(affinity);
+  rmsds.push_back(rmsd);
+  seqcont.push_back(seq_continued); //zero for first member of group
+}
+
+//grids are mostly zeros; a record is a sequence of runs of a count of
+//zeros, a count of values and the values
+template <typename Dtype>
+static void compress_grid(const Dtype* grid, unsigned n, vector<char>& out) {
+  out.clear();
+  unsigned i = 0;
+  while (i < n) {
+    uint32_t zeros = 0, values = 0;
+    while (i + zeros < n && grid[i + zeros] == 0) zeros++;
+    i += zeros;
+    while (i + values < n && grid[i + values] != 0) values++;
+    size_t at = out.size();
+    out.resize(at + 2*sizeof(uint32_t) + values*sizeof(Dtype));
+    memcpy(&out[at], &zeros, sizeof(uint32_t));
+    memcpy(&out[at+sizeof(uint32_t)], &values, sizeof(uint32_t));
+    memcpy(&out[at+2*sizeof(uint32_t)], grid + i, values*sizeof(Dtype));
+    i += values;
+  }
+}
+
+template <typename Dtype>
+static void decompress_grid(const char* in, unsigned n, Dtype* grid) {
+  unsigned i = 0;
+  while (i < n) {
+    uint32_t zeros, values;
+    memcpy(&zeros, in, sizeof(uint32_t));
+    memcpy(&values, in+sizeof(uint32_t), sizeof(uint32_t));
+    in += 2*sizeof(uint32_t);
+    std::fill(grid + i, grid + i + zeros, Dtype(0));
+    i += zeros;
+    memcpy(grid + i, in, values*sizeof(Dtype));
+    in += values*sizeof(Dtype);
+    i += values;
+  }
+}
+
+//compressed grids and labels of each example of the test data; records are
+//kept in memory or appended to a scratch file, which is memory mapped once
+//every example is in it
+template <typename Dtype>
+struct MolGridDataLayer<Dtype>::grid_cache {
+    vector<int64_t> offsets; //of each example's record, -1 until cached
+    vector<size_t> sizes;
+    vector<vector<float> > labels;
+    size_t cached = 0;
+
+    vector<char> memory;
+    string filename;
+    std::fstream file; //while the cache is incomplete
+    size_t filesize = 0;
+    boost::iostreams::mapped_file_source mapped;
+    vector<char> record;
+
+    grid_cache(unsigned n, const string& fname): offsets(n, -1), sizes(n),
+        labels(n), filename(fname) {
+      CHECK_GT(n, 0) << "No test examples to cache";
+      if (filename.size()) {
+        file.open(filename.c_str(), ios::in | ios::out | ios::trunc | ios::binary);
+        CHECK(file) << "Could not open test grid cache " << filename;
+      }
+    }
+
+    ~grid_cache() {
+      if (mapped.is_open()) mapped.close();
+      if (file.is_open()) file.close();
+      if (filename.size()) remove(filename.c_str());
+    }
+
+    bool complete() const { return cached == offsets.size(); }
+    bool has(unsigned pos) const { return offsets[pos] >= 0; }
+
+    void put(unsigned pos, const Dtype* grid, unsigned n, const vector<float>& l) {
+      compress_grid(grid, n, record);
+      sizes[pos] = record.size();
+      labels[pos] = l;
+      if (filename.size()) {
+        file.seekp(0, ios::end);
+        file.write(&record[0], record.size());
+        CHECK(file) << "Could not write test grid cache " << filename;
+        offsets[pos] = filesize;
+        filesize += record.size();
+      } else {
+        offsets[pos] = memory.size();
+        memory.insert(memory.end(), record.begin(), record.end());
+      }
+      cached++;
+      if (complete() && filename.size()) {
+        file.close();
+        mapped.open(filename);
+        CHECK(mapped.is_open()) << "Could not map test grid cache " << filename;
+      }
+    }
+
+    void get(unsigned pos, Dtype* grid, unsigned n) {
+      const char* in = NULL;
+      if (!filename.size()) {
+        in = &memory[offsets[pos]];
+      } else if (mapped.is_open()) {
+        in = mapped.data() + offsets[pos];
+      } else {
+        record.resize(sizes[pos]);
+        file.seekg(offsets[pos]);
+        file.read(&record[0], sizes[pos]);
+        CHECK(file) << "Could not read test grid cache " << filename;
+        in = &record[0];
+      }
+      decompress_grid(in, n, grid);
+    }
+};
+
+//fill the grids of the next example from the test cache if it is there
+template <typename Dtype>
+bool MolGridDataLayer<Dtype>::cached_example(Dtype *grid, unsigned nposes,
+    bool hasaffinity, bool hasrmsd, bool gpu) {
+  grid_cache& cache = *test_cache;
+  if (!cache.has(cache_pos)) return false;
+  if (!cache.complete()) data.skip(1); //keep the provider at the same position
+
+  unsigned n = example_size*nposes;
+  if (gpu) {
+    cache_grid.resize(n);
+    cache.get(cache_pos, &cache_grid[0], n);
+    caffe_copy(n, &cache_grid[0], grid);
+  } else {
+    cache.get(cache_pos, grid, n);
+  }
+  for (unsigned p = 0; p < nposes; p++) {
+    updateLabels(cache.labels[cache_pos], hasaffinity, hasrmsd, false);
+    perturbations.push_back(output_transform());
+  }
+  cache_pos = (cache_pos + 1) % cache.offsets.size();
+  return true;
+}
+
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::cache_example(const Dtype *grid, unsigned nposes,
+    const Example& ex, bool gpu) {
+  unsigned n = example_size*nposes;
+  if (gpu) {
+    cache_grid.resize(n);
+    caffe_copy(n, grid, &cache_grid[0]);
+    grid = &cache_grid[0];
+  }
+  test_cache->put(cache_pos, grid, n, ex.labels);
+  cache_pos = (cache_pos + 1) % test_cache->offsets.size();
+}
+
+//next example from provider for this solver
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::next_example(ExampleProvider& provider,
+    Example& ex) {
+  if (Caffe::solver_count() > 1) {
+    boost::mutex::scoped_lock lock(provider_mutex);
+    scoped_molgrid_engine engine(shard_stride > 1 ? &shard_engine : NULL);
+    provider.next(ex);
+    if (shard_stride > 1) provider.skip(shard_stride-1);
+  } else {
+    provider.next(ex);
+  }
+}
+
+//fill batch with the next examples from the data sources; runs in the
+//prefetch thread, so only reads the layer's settings
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::load_batch(prefetch_batch& batch)
+{
+  bool hasaffinity = this->layer_param_.molgrid_data_param().has_affinity();
+  bool hasrmsd = this->layer_param_.molgrid_data_param().has_rmsd();
+  bool duplicate = this->layer_param_.molgrid_data_param().duplicate_poses();
+
+  unsigned batch_size;
+  if (group_size>1) {
+    batch_size = top_shape[1];
+  }
+  else
+    batch_size = top_shape[0];
+
+  unsigned nposes = duplicate ? numposes : 1;
+  batch_size /= nposes;
+
+  //percent of batch from first data source
+  unsigned dataswitch = batch_size;
+  if (data2.size())
+    dataswitch = batch_size*data_ratio/(data_ratio+1);
+
+  //read examples in order, giving each a seed for its random transformations
+  unsigned n = chunk_size*batch_size;
+  vector<Example> examples(n);
+  vector<unsigned> seeds(n);
+  batch.labels.clear();
+  batch.affinities.clear();
+  batch.rmsds.clear();
+  batch.seqcont.clear();
+  for (unsigned idx = 0; idx < n; ++idx) {
+    Example& ex = examples[idx];
+    if (idx % batch_size < dataswitch) {
+      next_example(data, ex);
+    } else {
+      next_example(data2, ex);
+    }
+    seeds[idx] = caffe_rng_rand();
+    for (unsigned p = 0; p < nposes; p++)
+      append_labels(ex.labels, hasaffinity, hasrmsd, ex.seqcont, batch.labels,
+          batch.affinities, batch.rmsds, batch.seqcont);
+  }
+  batch.perturbations.resize(n*nposes);
+
+  //later frames of a group reuse the transformation of earlier ones, so only
+  //batch positions are gridded in parallel
+  Dtype *top_data = batch.data_.mutable_cpu_data();
+  caffe_parallel_for(batch_size, [&](int begin, int end) {
+    for (int batch_idx = begin; batch_idx < end; ++batch_idx) {
+      mol_info& minfo = batch.info[batch_idx];
+      minfo.transform = prefetch_transforms[batch_idx]; //group may continue from the last batch
+      for (int step = 0; step < chunk_size; ++step) {
+        unsigned idx = step*batch_size + batch_idx;
+        const Example& ex = examples[idx];
+        rng_t rng(seeds[idx]);
+        if(!duplicate) {
+          int offset = idx * example_size;
+          set_grid_ex(top_data+offset, ex, minfo, numposes > 1 ? -1 : 0,
+              batch.perturbations[idx], false, ex.seqcont, &rng);
+        }
+        else {
+          for(unsigned p = 0; p < numposes; p++) {
+            int p_offset = batch_idx*(example_size*numposes)+example_size*p;
+            set_grid_ex(top_data+p_offset, ex, minfo, p,
+                batch.perturbations[idx*numposes+p], false, ex.seqcont, &rng);
+          }
+        }
+      }
+      prefetch_transforms[batch_idx] = minfo.transform;
+    }
+  });
+}
+
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::InternalThreadEntry()
+{
+#ifndef CPU_ONLY
+  cudaStream_t stream;
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  }
+#endif
+
+  try {
+    while (!this->must_stop()) {
+      prefetch_batch* batch = static_cast<prefetch_batch*>(prefetch_free.pop());
+      load_batch(*batch);
+#ifndef CPU_ONLY
+      if (Caffe::mode() == Caffe::GPU) {
+        batch->data_.data().get()->async_gpu_push(stream);
+        CUDA_CHECK(cudaStreamSynchronize(stream));
+      }
+#endif
+      prefetch_full.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaStreamDestroy(stream));
+  }
+#endif
+}
+
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom)
@@ -987,26 +1446,8 @@ void MolGridDataLayer<Dtype>::clearLabels() {
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::updateLabels(const std::vector<float>& l, bool hasaffinity,
     bool hasrmsd, bool seq_continued) {
-  float pose = 0, affinity = 0, rmsd = 0;
-  unsigned n = l.size();
-
-  //caffe has a cannonical ordering of labels
-  if (n > 0) {
-    pose = l[0];
-    if (n > 1) {
-      if (hasaffinity) {
-        affinity = l[1];
-        if (hasrmsd && n > 2)
-          rmsd = l[2];
-      } else if (hasrmsd) {
-        rmsd = l[1];
-      }
-    }
-  }
-  labels.push_back(pose);
-  affinities.push_back(affinity);
-  rmsds.push_back(rmsd);
-  seqcont.push_back(seq_continued); //zero for first member of group
+  append_labels(l, hasaffinity, hasrmsd, seq_continued, labels, affinities,
+      rmsds, seqcont);
 }
 
 template <typename Dtype>
@@ -60,6 +60,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   map<string, int> blob_name_to_idx;
   set<string> available_blobs;
   memory_used_ = 0;
+  inference_memory_planned_ = false;
   // For each layer, set up its input and output
   bottom_vecs_.resize(param.layer_size());
   top_vecs_.resize(param.layer_size());
@@ -570,6 +571,8 @@ const vector<Blob<Dtype>*>& Net<Dtype>::Forward(
 
 template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
+  CHECK(!inference_memory_planned_) << "Net " << name_
+      << " shares activation memory and can only be run forward";
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
   for (int i = start; i >= end; --i) {
@@ -745,6 +748,110 @@ void Net<Dtype>::ClearBlobs() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::PlanInferenceMemory() {
+  CHECK(!inference_memory_planned_) << "Memory of net " << name_
+      << " has already been planned";
+  // Blobs backed by the same memory (in-place layers, or tops that alias
+  // their bottom) form one group with the union of their lifetimes.
+  map<SyncedMemory*, int> group_of_memory;
+  vector<int> group_of_blob(blobs_.size());
+  vector<int> first_use, last_use;
+  vector<size_t> group_bytes;
+  vector<bool> keep;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    SyncedMemory* memory = blobs_[blob_id]->data().get();
+    if (!group_of_memory.count(memory)) {
+      group_of_memory[memory] = group_bytes.size();
+      group_bytes.push_back(memory->size());
+      first_use.push_back(layers_.size());
+      last_use.push_back(-1);
+      keep.push_back(false);
+    }
+    group_of_blob[blob_id] = group_of_memory[memory];
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      const int group = group_of_blob[top_id_vecs_[layer_id][top_id]];
+      first_use[group] = std::min(first_use[group], layer_id);
+      last_use[group] = std::max(last_use[group], layer_id);
+      // data layers are filled from outside the net
+      if (bottom_id_vecs_[layer_id].empty()) { keep[group] = true; }
+    }
+    for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+         ++bottom_id) {
+      const int group = group_of_blob[bottom_id_vecs_[layer_id][bottom_id]];
+      first_use[group] = std::min(first_use[group], layer_id);
+      last_use[group] = std::max(last_use[group], layer_id);
+    }
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    keep[group_of_blob[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    keep[group_of_blob[net_output_blob_indices_[i]]] = true;
+  }
+
+  // Assign groups to buffers in order of first use, preferring the smallest
+  // free buffer that is large enough and otherwise growing the largest free
+  // one.  A buffer is free once its last group has been read.
+  vector<pair<int, int> > order;
+  for (int group = 0; group < group_bytes.size(); ++group) {
+    if (!keep[group] && group_bytes[group] > 0) {
+      order.push_back(std::make_pair(first_use[group], group));
+    }
+  }
+  std::sort(order.begin(), order.end());
+  vector<size_t> buffer_bytes;
+  vector<int> buffer_free_after;
+  vector<int> buffer_of_group(group_bytes.size(), -1);
+  size_t unplanned_bytes = 0;
+  for (int i = 0; i < order.size(); ++i) {
+    const int group = order[i].second;
+    const size_t bytes = group_bytes[group];
+    unplanned_bytes += bytes;
+    int best = -1;
+    for (int b = 0; b < buffer_bytes.size(); ++b) {
+      if (buffer_free_after[b] >= first_use[group]) { continue; }
+      if (best < 0) {
+        best = b;
+      } else if (buffer_bytes[best] >= bytes) {
+        if (buffer_bytes[b] >= bytes && buffer_bytes[b] < buffer_bytes[best]) {
+          best = b;
+        }
+      } else if (buffer_bytes[b] > buffer_bytes[best]) {
+        best = b;
+      }
+    }
+    if (best < 0) {
+      best = buffer_bytes.size();
+      buffer_bytes.push_back(0);
+      buffer_free_after.push_back(-1);
+    }
+    buffer_bytes[best] = std::max(buffer_bytes[best], bytes);
+    buffer_free_after[best] = last_use[group];
+    buffer_of_group[group] = best;
+  }
+
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_bytes.size());
+  size_t planned_bytes = 0;
+  for (int b = 0; b < buffers.size(); ++b) {
+    buffers[b].reset(new SyncedMemory(buffer_bytes[b]));
+    planned_bytes += buffer_bytes[b];
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int buffer = buffer_of_group[group_of_blob[blob_id]];
+    if (buffer < 0) { continue; }
+    blobs_[blob_id]->ShareDataMemory(buffers[buffer]);
+    blobs_[blob_id]->diff()->clear();
+  }
+  inference_memory_planned_ = true;
+  LOG_IF(INFO, Caffe::root_solver()) << "Net " << name_ << " shares "
+      << unplanned_bytes << " bytes of activations in " << order.size()
+      << " blobs as " << planned_bytes << " bytes in " << buffers.size()
+      << " buffers";
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layer_size();
@@ -994,6 +1101,8 @@ const shared_ptr<Layer<Dtype> > Net<Dtype>::layer_by_name(
 
 template<typename Dtype>
 void Net<Dtype>::Backward_relevance(std::string layer_to_ignore, bool zero_values){
+    CHECK(!inference_memory_planned_) << "Net " << name_
+        << " shares activation memory and can only be run forward";
 
     int end = 0 ;
     int start = layers_.size()-1;
@@ -1032,6 +1141,8 @@ void Net<Dtype>::Backward_ignore_layer(std::string layer_to_ignore)
     int end = 0 ;
     int start = layers_.size() - 1;
 
+    CHECK(!inference_memory_planned_) << "Net " << name_
+        << " shares activation memory and can only be run forward";
     CHECK_GE(end, 0);
     CHECK_LT(start, layers_.size());
 
@@ -1,6 +1,6 @@
 #ifdef USE_NCCL
-
 #include <cuda_runtime.h>
+#endif
 #include <glog/logging.h>
 #include <stdio.h>
 #include <sstream>
@@ -72,6 +72,227 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
     diff_() {
 }
 
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver)
+  : Params<Dtype>(root_solver) {
+  data_ = new Dtype[size_];
+
+  // Copy blob values
+  const vector<Blob<Dtype>*>& net =
+    root_solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, copy);
+
+  diff_ = new Dtype[size_];
+  caffe_set(size_, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  delete [] data_;
+  delete [] diff_;
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::Configure(Solver<Dtype>* solver) const {
+  const vector<Blob<Dtype>*>& net =
+    solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, replace_cpu);
+  apply_buffers(net, diff_, size_, replace_cpu_diff);
+}
+
+// Gradients reduced at once by one solver; large enough to amortize the
+// synchronization, small enough for reduction to overlap the backward pass.
+static const size_t kBucketSize = 1 << 18;
+
+template<typename Dtype>
+CPUSync<Dtype>::Shared::Shared(int solvers, int buckets)
+  : barrier(solvers), syncs(solvers), arrived(buckets), reduced() {
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > solver)
+  : CPUParams<Dtype>(solver), solver_(solver), shared_(),
+    layer_wise_(solver->param().layer_wise_reduce()
+                && solver->param().iter_size() == 1),
+    expected_() {
+  this->Configure(solver.get());
+  const Net<Dtype>& net = *solver->net();
+  if (!layer_wise_) {
+    // Gradients accumulate over iter_size passes, reduce all at the end
+    bucket_begin_.push_back(0);
+    bucket_end_.push_back(size_);
+    return;
+  }
+  CHECK_EQ(net.params().size(), net.learnable_params().size())
+    << "Layer-wise reduce is not supported for nets with shared weights.";
+  // Parameters of each layer are contiguous and in layer order
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net.layers();
+  vector<size_t> offsets(layers.size() + 1, 0);
+  for (int i = 0; i < layers.size(); ++i) {
+    offsets[i + 1] = offsets[i];
+    for (int j = 0; j < layers[i]->blobs().size(); ++j) {
+      offsets[i + 1] += layers[i]->blobs()[j]->count();
+    }
+  }
+  // Group layers into buckets from the last, as backward computes them
+  layer_bucket_.assign(layers.size(), -1);
+  size_t end = offsets.back();
+  for (int i = layers.size() - 1; i >= 0; --i) {
+    if (end - offsets[i] >= kBucketSize || (i == 0 && end > 0)) {
+      layer_bucket_[i] = bucket_begin_.size();
+      bucket_begin_.push_back(offsets[i]);
+      bucket_end_.push_back(end);
+      end = offsets[i];
+    }
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Attach(Shared* shared) {
+  CHECK_EQ(shared->arrived.size(), bucket_begin_.size());
+  shared_ = shared;
+  shared_->syncs[Caffe::solver_rank()] = this;
+  solver_->add_callback(this);
+  if (layer_wise_) {
+    solver_->net()->add_after_backward(this);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Broadcast() {
+  // Wait for all solvers to attach
+  shared_->barrier.wait();
+  if (Caffe::solver_rank() != 0) {
+    caffe_copy(size_, shared_->syncs[0]->data_, data_);
+  }
+  shared_->barrier.wait();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::run(int layer) {
+  if (layer_bucket_[layer] >= 0) {
+    Arrive(layer_bucket_[layer]);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  if (!layer_wise_) {
+    Arrive(0);
+  }
+  // Make sure reduction is done before applying gradients.  Buckets of the
+  // next iteration can not complete before this solver computes its part.
+  expected_ += bucket_begin_.size();
+  boost::mutex::scoped_lock lock(shared_->mutex);
+  while (shared_->reduced < expected_) {
+    shared_->reduced_cond.wait(lock);
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Arrive(int bucket) {
+  bool last;
+  {
+    boost::mutex::scoped_lock lock(shared_->mutex);
+    last = ++shared_->arrived[bucket] == Caffe::solver_count();
+    if (last) {
+      shared_->arrived[bucket] = 0;
+    }
+  }
+  if (last) {
+    // The other solvers are done with this bucket until they apply updates,
+    // which waits for the reduction
+    Reduce(bucket);
+    {
+      boost::mutex::scoped_lock lock(shared_->mutex);
+      ++shared_->reduced;
+    }
+    shared_->reduced_cond.notify_all();
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Reduce(int bucket) {
+  const size_t begin = bucket_begin_[bucket];
+  const int size = bucket_end_[bucket] - begin;
+  const vector<CPUSync<Dtype>*>& syncs = shared_->syncs;
+  Dtype* sum = diff_ + begin;
+  for (int i = 0; i < syncs.size(); ++i) {
+    if (syncs[i] != this) {
+      caffe_axpy(size, Dtype(1), syncs[i]->diff_ + begin, sum);
+    }
+  }
+  caffe_scal(size, (Dtype) 1.0 / Caffe::solver_count(), sum);
+  for (int i = 0; i < syncs.size(); ++i) {
+    if (syncs[i] != this) {
+      caffe_copy(size, sum, syncs[i]->diff_ + begin);
+    }
+  }
+}
+
+template<typename Dtype>
+class CPUWorker : public InternalThread {
+ public:
+  explicit CPUWorker(shared_ptr<Solver<Dtype> > rank0,
+                     typename CPUSync<Dtype>::Shared* shared,
+                     const char* restore)
+    : rank0_(rank0), shared_(shared), restore_(restore) {
+  }
+  virtual ~CPUWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+    // Create solver, with its own net and data layers
+    SolverParameter param(rank0_->param());
+    param.set_type(rank0_->type());
+    shared_ptr<Solver<Dtype> > s(SolverRegistry<Dtype>::CreateSolver(param));
+    CHECK_EQ(s->type(), rank0_->type());
+    if (restore_) {
+      s->Restore(restore_);
+    }
+    CPUSync<Dtype> sync(s);
+    sync.Attach(shared_);
+    // Broadcast rank 0 state
+    sync.Broadcast();
+    // Solve
+    s->Step(param.max_iter() - s->iter());
+    shared_->barrier.wait();
+  }
+
+  shared_ptr<Solver<Dtype> > rank0_;
+  typename CPUSync<Dtype>::Shared* shared_;
+  const char* restore_;
+};
+
+template<typename Dtype>
+void CPUSync<Dtype>::Run(const char* restore) {
+  CHECK(Caffe::mode() == Caffe::CPU);
+  const int count = Caffe::solver_count();
+  Shared shared(count, buckets());
+  Caffe::set_solver_rank(0);
+  Attach(&shared);
+  // Create workers
+  vector<shared_ptr<CPUWorker<Dtype> > > workers(count);
+  for (int i = 1; i < count; ++i) {
+    Caffe::set_solver_rank(i);
+    CPUWorker<Dtype>* w = new CPUWorker<Dtype>(solver_, &shared, restore);
+    w->StartInternalThread();
+    workers[i].reset(w);
+  }
+  Caffe::set_solver_rank(0);
+  // Run first solver on current thread
+  Broadcast();
+  solver_->Solve();
+  shared.barrier.wait();
+  // Wait for shutdown
+  for (int i = 1; i < count; ++i) {
+    workers[i]->StopInternalThread();
+  }
+  shared_ = NULL;
+}
+
+#ifdef USE_NCCL
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   : Params<Dtype>(root_solver) {
@@ -361,11 +582,15 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   }
 }
 
-INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(Worker);
 INSTANTIATE_CLASS(NCCL);
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
+
+INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(CPUParams);
+INSTANTIATE_CLASS(CPUWorker);
+INSTANTIATE_CLASS(CPUSync);
+
+}  // namespace caffe
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/bind.hpp"
 #include "caffe/solver.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/hdf5.hpp"
@@ -58,6 +59,9 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
   }
   iter_ = 0;
   current_step_ = 0;
+  if (param_.async_snapshot() && Caffe::root_solver()) {
+    snapshot_writer_.reset(new AsyncWriter(param_.max_pending_snapshots()));
+  }
 }
 
 // Load weights from the caffemodel(s) specified in "weights" solver parameter
@@ -313,6 +317,7 @@ void Solver<Dtype>::Solve(const char* resume_file) {
     Snapshot();
   }
   if (requested_early_exit_) {
+    WaitForSnapshots();
     LOG(INFO) << "Optimization stopped early.";
     return;
   }
@@ -334,6 +339,7 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  WaitForSnapshots();
   LOG(INFO) << "Optimization Done.";
 }
 
@@ -421,10 +427,35 @@ void Solver<Dtype>::Test(const int test_net_id) {
   }
 }
 
+// Runs in a snapshot writer thread; the state names the model, so the model
+// is complete on disk first.
+static void WriteSnapshot(shared_ptr<NetParameter> net_param,
+    const string& model_filename, shared_ptr<SolverState> state,
+    const string& state_filename) {
+  WriteProtoToBinaryFileAtomic(*net_param, model_filename);
+  WriteProtoToBinaryFileAtomic(*state, state_filename);
+  LOG(INFO) << "Wrote snapshot " << model_filename;
+}
+
 template <typename Dtype>
 string Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
   string model_filename;
+  if (snapshot_writer_ && param_.snapshot_format()
+      == caffe::SolverParameter_SnapshotFormat_BINARYPROTO) {
+    // Copy parameters and history now, serialize them while training goes on
+    model_filename = SnapshotFilename(".caffemodel");
+    shared_ptr<SolverState> state(new SolverState());
+    if (SolverStateToProto(model_filename, state.get())) {
+      shared_ptr<NetParameter> net_param(new NetParameter());
+      net_->ToProto(net_param.get(), param_.snapshot_diff());
+      LOG(INFO) << "Snapshotting to binary proto file " << model_filename
+                << " in the background";
+      snapshot_writer_->Run(boost::bind(&WriteSnapshot, net_param,
+          model_filename, state, SnapshotFilename(".solverstate")));
+      return model_filename;
+    }
+  }
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
     model_filename = SnapshotToBinaryProto();
@@ -440,6 +471,13 @@ string Solver<Dtype>::Snapshot() {
   return model_filename;
 }
 
+template <typename Dtype>
+void Solver<Dtype>::WaitForSnapshots() {
+  if (snapshot_writer_) {
+    snapshot_writer_->Wait();
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::CheckSnapshotWritePermissions() {
   if (Caffe::root_solver() && param_.snapshot()) {
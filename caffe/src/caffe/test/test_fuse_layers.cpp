@@ -0,0 +1,141 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class FuseLayersTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // conv -> batchnorm -> scale -> relu folds into the convolution,
+  // batchnorm -> scale after it becomes a single scale
+  virtual void InitNet() {
+    const string proto =
+        "name: 'FuseTestNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { shape { dim: 2 dim: 3 dim: 5 dim: 4 dim: 6 } } "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'bn' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv' "
+        "  top: 'bn' "
+        "} "
+        "layer { "
+        "  name: 'scale' "
+        "  type: 'Scale' "
+        "  bottom: 'bn' "
+        "  top: 'bn' "
+        "  scale_param { "
+        "    bias_term: true "
+        "    filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu' "
+        "  type: 'ReLU' "
+        "  bottom: 'bn' "
+        "  top: 'bn' "
+        "  relu_param { negative_slope: 0.1 } "
+        "} "
+        "layer { "
+        "  name: 'bn2' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'bn' "
+        "  top: 'bn2' "
+        "} "
+        "layer { "
+        "  name: 'scale2' "
+        "  type: 'Scale' "
+        "  bottom: 'bn2' "
+        "  top: 'bn2' "
+        "  scale_param { "
+        "    bias_term: true "
+        "    filler { type: 'gaussian' } "
+        "    bias_filler { type: 'gaussian' } "
+        "  } "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new Net<Dtype>(param));
+
+    // plausible running statistics
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> gaussian(filler_param);
+    filler_param.set_min(0.5);
+    filler_param.set_max(2);
+    UniformFiller<Dtype> uniform(filler_param);
+    const char* bns[] = {"bn", "bn2"};
+    for (int i = 0; i < 2; ++i) {
+      const vector<shared_ptr<Blob<Dtype> > >& stats =
+          net_->layer_by_name(bns[i])->blobs();
+      gaussian.Fill(stats[0].get());
+      uniform.Fill(stats[1].get());
+      stats[2]->mutable_cpu_data()[0] = 2;
+    }
+    gaussian.Fill(net_->blob_by_name("data").get());
+  }
+
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(FuseLayersTest, TestDtypesAndDevices);
+
+TYPED_TEST(FuseLayersTest, TestFusedNetMatches) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitNet();
+  this->net_->Forward();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->blob_by_name("bn2"), false, true);
+
+  NetParameter trained, fused;
+  this->net_->ToProto(&trained);
+  FuseInferenceLayers(trained, &fused);
+  fused.mutable_state()->set_phase(TEST);
+  ASSERT_EQ(3, fused.layer_size());
+  EXPECT_EQ("Convolution", fused.layer(1).type());
+  EXPECT_TRUE(fused.layer(1).convolution_param().fused_relu());
+  EXPECT_EQ("Scale", fused.layer(2).type());
+
+  Net<Dtype> fused_net(fused);
+  fused_net.blob_by_name("data")->CopyFrom(
+      *this->net_->blob_by_name("data"));
+  fused_net.Forward();
+  const Blob<Dtype>& actual = *fused_net.blob_by_name("bn2");
+  ASSERT_EQ(expected.count(), actual.count());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], actual.cpu_data()[i], 1e-4);
+  }
+}
+
+}  // namespace caffe
@@ -26,7 +26,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), async_snapshot_(false) {
         input_file_ = new string(
         ABS_TEST_DATA_DIR "/solver_data_list.txt");
       }
@@ -39,11 +39,13 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 #ifdef USE_NCCL
   shared_ptr<NCCL<Dtype> > nccl_;
 #endif
+  shared_ptr<CPUSync<Dtype> > cpu_sync_;
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool async_snapshot_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -88,6 +90,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "iter_size: " << iter_size << " "
        "device_id: " << device_id << " "
        "layer_wise_reduce: " << (!share_) << " "
+       "async_snapshot: " << async_snapshot_ << " "
        "net_param { "
        "  name: 'TestNetwork' "
        "  layer { "
@@ -194,6 +197,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-thread CPU test on " << devices << " solvers";
+      Caffe::set_solver_count(devices);
+      this->cpu_sync_.reset(new CPUSync<Dtype>(this->solver_));
+      this->cpu_sync_->Run(from_snapshot);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -466,6 +475,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
     }
 #endif
+    if (Caffe::mode() == Caffe::CPU) {
+      available_devices = 3;  // solvers in threads
+    }
     // Takes a while to test all sizes for each test so sparse
     vector<int> sizes;
     sizes.push_back(1);
@@ -706,6 +718,18 @@ TYPED_TEST(SGDSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->async_snapshot_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
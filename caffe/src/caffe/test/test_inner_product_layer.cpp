@@ -239,6 +239,40 @@ TYPED_TEST(InnerProductLayerTest, TestForwardNoBatch) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantized) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  for (int transpose = 0; transpose < 2; ++transpose) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    InnerProductLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> expected;
+    expected.CopyFrom(*this->blob_top_, false, true);
+
+    // bottom is uniform in [0, 1]
+    layer_param.mutable_quantization_param()->set_input_range(1);
+    InnerProductLayer<Dtype> quantized_layer(layer_param);
+    quantized_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      quantized_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // the int8 path only runs on the CPU
+    const Dtype tolerance = Caffe::mode() == Caffe::CPU ? 0.1 : 1e-4;
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          tolerance);
+    }
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_);
@@ -0,0 +1,146 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/flex_lstm_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class LSTMDataGetterLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // 7^3 grids with 5^3 subcubes at a stride of 2: 8 timesteps
+  LSTMDataGetterLayerTest() : dim_(7), subgrid_dim_(5), stride_(2),
+      num_timesteps_(8), blob_bottom_(new Blob<Dtype>()),
+      blob_top_(new Blob<Dtype>()) {
+    vector<int> shape;
+    shape.push_back(2);
+    shape.push_back(3);
+    shape.push_back(dim_);
+    shape.push_back(dim_);
+    shape.push_back(dim_);
+    blob_bottom_->Reshape(shape);
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~LSTMDataGetterLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+
+  // one layer per timestep, all writing the same top
+  void SetUpLayers() {
+    for (int t = 0; t < num_timesteps_; ++t) {
+      LayerParameter param;
+      LSTMDataGetterParameter* getter_param =
+          param.mutable_lstm_datagetter_param();
+      getter_param->set_timestep(t);
+      getter_param->set_stride(stride_);
+      getter_param->set_resolution(0.5);
+      getter_param->set_subgrid_dim(0.5 * (subgrid_dim_ - 1));
+      layers_.push_back(shared_ptr<Layer<Dtype> >(
+          new LSTMDataGetterLayer<Dtype>(param)));
+      layers_.back()->SetUp(blob_bottom_vec_, blob_top_vec_);
+    }
+  }
+
+  // offset into a full grid of a subcube value at timestep t
+  int FullIndex(int t, int g, int x, int y, int z) const {
+    const int slices = (dim_ - subgrid_dim_) / stride_ + 1;
+    x += (t / (slices * slices)) % slices * stride_;
+    y += (t / slices) % slices * stride_;
+    z += t % slices * stride_;
+    return ((g * dim_ + x) * dim_ + y) * dim_ + z;
+  }
+
+  // the top holds the subcube of timestep t
+  void CheckSubcube(int t) const {
+    const Dtype* top = blob_top_->cpu_data();
+    const Dtype* bottom = blob_bottom_->cpu_data();
+    const int ngrids = blob_bottom_->shape(0) * blob_bottom_->shape(1);
+    for (int g = 0, idx = 0; g < ngrids; ++g)
+      for (int x = 0; x < subgrid_dim_; ++x)
+        for (int y = 0; y < subgrid_dim_; ++y)
+          for (int z = 0; z < subgrid_dim_; ++z, ++idx)
+            EXPECT_EQ(top[idx], bottom[FullIndex(t, g, x, y, z)]);
+  }
+
+  int dim_;
+  int subgrid_dim_;
+  int stride_;
+  int num_timesteps_;
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<shared_ptr<Layer<Dtype> > > layers_;
+};
+
+TYPED_TEST_CASE(LSTMDataGetterLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(LSTMDataGetterLayerTest, TestSetUp) {
+  this->SetUpLayers();
+  EXPECT_EQ(this->blob_top_->num_axes(), 6);
+  EXPECT_EQ(this->blob_top_->shape(0), 1);
+  EXPECT_EQ(this->blob_top_->shape(1), 2);
+  EXPECT_EQ(this->blob_top_->shape(2), 3);
+  EXPECT_EQ(this->blob_top_->shape(3), this->subgrid_dim_);
+  EXPECT_EQ(this->blob_top_->shape(4), this->subgrid_dim_);
+  EXPECT_EQ(this->blob_top_->shape(5), this->subgrid_dim_);
+}
+
+TYPED_TEST(LSTMDataGetterLayerTest, TestForward) {
+  this->SetUpLayers();
+  for (int t = 0; t < this->num_timesteps_; ++t) {
+    this->layers_[t]->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckSubcube(t);
+  }
+}
+
+TYPED_TEST(LSTMDataGetterLayerTest, TestBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->SetUpLayers();
+  const int ngrids = this->blob_bottom_->shape(0) * this->blob_bottom_->shape(1);
+  vector<Dtype> expected(this->blob_bottom_->count(), 0);
+  vector<bool> propagate_down(1, true);
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  Blob<Dtype> top_diff;
+  for (int t = this->num_timesteps_ - 1; t >= 0; --t) {
+    if (t == this->num_timesteps_ - 1) {
+      this->layers_[t]->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    }
+    top_diff.ReshapeLike(*this->blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    const Dtype* diff = top_diff.cpu_data();
+    for (int g = 0, idx = 0; g < ngrids; ++g)
+      for (int x = 0; x < this->subgrid_dim_; ++x)
+        for (int y = 0; y < this->subgrid_dim_; ++y)
+          for (int z = 0; z < this->subgrid_dim_; ++z, ++idx)
+            expected[this->FullIndex(t, g, x, y, z)] += diff[idx];
+    this->layers_[t]->Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    // backward leaves the top ready for the layers of the previous timestep
+    if (t > 0) {
+      this->CheckSubcube(t - 1);
+    }
+  }
+  const Dtype* bottom_diff = this->blob_bottom_->cpu_diff();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(bottom_diff[i], expected[i], 1e-4);
+  }
+}
+
+}  // namespace caffe
@@ -1457,6 +1457,51 @@ TYPED_TEST(NetTest, TestFromTo) {
   }
 }
 
+TYPED_TEST(NetTest, TestPlanInferenceMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string ip =
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } ";
+  const string proto =
+      "name: 'ChainNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 3 dim: 8 } } "
+      "} "
+      "layer { name: 'ip1' bottom: 'data' top: 'a' " + ip + "} "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'a' top: 'a' } "
+      "layer { name: 'ip2' bottom: 'a' top: 'b' " + ip + "} "
+      "layer { name: 'ip3' bottom: 'b' top: 'c' " + ip + "} "
+      "layer { name: 'ip4' bottom: 'c' top: 'out' " + ip + "} ";
+  this->InitNetFromProtoString(proto);
+  Net<Dtype>& net = *this->net_;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(net.blob_by_name("data").get());
+  net.Forward();
+  Blob<Dtype> expected;
+  expected.CopyFrom(*net.blob_by_name("out"), false, true);
+
+  net.PlanInferenceMemory();
+  // 'a' is dead once ip2 has run, so 'c' can reuse it; 'b' overlaps both
+  EXPECT_EQ(net.blob_by_name("a")->data(), net.blob_by_name("c")->data());
+  EXPECT_NE(net.blob_by_name("a")->data(), net.blob_by_name("b")->data());
+  EXPECT_NE(net.blob_by_name("a")->data(), net.blob_by_name("data")->data());
+  EXPECT_NE(net.blob_by_name("c")->data(), net.blob_by_name("out")->data());
+
+  net.Forward();
+  const Blob<Dtype>& out = *net.blob_by_name("out");
+  for (int i = 0; i < out.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], out.cpu_data()[i]);
+  }
+}
+
 class FilterNetTest : public ::testing::Test {
  protected:
   void RunFilterNetTest(
@@ -0,0 +1,86 @@
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel_for.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ParallelForTest : public ::testing::Test {};
+
+TEST_F(ParallelForTest, TestCoversRange) {
+  EXPECT_GE(caffe_parallel_threads(), 1);
+  for (int n = 0; n < 100; n += 7) {
+    vector<int> hits(n, 0);
+    caffe_parallel_for(n, [&](int begin, int end) {
+      EXPECT_LE(0, begin);
+      EXPECT_LT(begin, end);
+      EXPECT_LE(end, n);
+      for (int i = begin; i < end; ++i) ++hits[i];
+    });
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(1, hits[i]);
+    }
+  }
+}
+
+// A loop started from inside another runs serially on the calling thread
+TEST_F(ParallelForTest, TestNested) {
+  const int outer = 8, inner = 16;
+  vector<int> hits(outer * inner, 0);
+  caffe_parallel_for(outer, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      caffe_parallel_for(inner, [&](int b, int e) {
+        for (int j = b; j < e; ++j) ++hits[i * inner + j];
+      });
+    }
+  });
+  for (int i = 0; i < outer * inner; ++i) {
+    EXPECT_EQ(1, hits[i]);
+  }
+}
+
+TEST_F(ParallelForTest, TestException) {
+  for (int k = 0; k < 10; ++k) {
+    EXPECT_THROW(caffe_parallel_for(10, [&](int begin, int end) {
+      if (begin <= k && k < end) throw std::runtime_error("chunk failed");
+    }), std::runtime_error);
+  }
+  // the pool is still usable
+  int hits = 0;
+  caffe_parallel_for(1, [&](int begin, int end) { hits += end - begin; });
+  EXPECT_EQ(1, hits);
+}
+
+// A cap limits the chunks per loop, and the count can grow back after it
+TEST_F(ParallelForTest, TestSetThreads) {
+  const int threads = caffe_parallel_threads();
+  for (int cap = 1; cap <= 4; ++cap) {
+    caffe_set_parallel_threads(cap);
+    EXPECT_LE(caffe_parallel_threads(), cap);
+    const int n = 64;
+    vector<int> hits(n, 0);
+    std::set<std::pair<int, int> > chunks;
+    boost::mutex mutex;
+    caffe_parallel_for(n, [&](int begin, int end) {
+      boost::mutex::scoped_lock lock(mutex);
+      chunks.insert(std::make_pair(begin, end));
+      for (int i = begin; i < end; ++i) ++hits[i];
+    });
+    EXPECT_LE(static_cast<int>(chunks.size()), cap);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(1, hits[i]);
+    }
+  }
+  caffe_set_parallel_threads(threads);
+  EXPECT_EQ(threads, caffe_parallel_threads());
+}
+
+}  // namespace caffe
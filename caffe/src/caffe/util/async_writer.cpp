@@ -0,0 +1,50 @@
+#include <boost/bind.hpp>
+
+#include "caffe/util/async_writer.hpp"
+
+namespace caffe {
+
+AsyncWriter::AsyncWriter(int max_pending)
+  : max_pending_(max_pending), pending_(0) {
+  CHECK_GT(max_pending_, 0);
+}
+
+AsyncWriter::~AsyncWriter() {
+  Wait();
+}
+
+void AsyncWriter::Run(const boost::function<void()>& job) {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (pending_ >= max_pending_) {
+      LOG(INFO) << "Waiting for " << pending_ << " pending writes";
+    }
+    while (pending_ >= max_pending_) {
+      done_.wait(lock);
+    }
+    ++pending_;
+  }
+  try {
+    boost::thread(boost::bind(&AsyncWriter::Entry, this, job)).detach();
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Thread exception: " << e.what();
+  }
+}
+
+void AsyncWriter::Wait() {
+  boost::mutex::scoped_lock lock(mutex_);
+  while (pending_ > 0) {
+    done_.wait(lock);
+  }
+}
+
+void AsyncWriter::Entry(boost::function<void()> job) {
+  job();
+  // Nothing of this object is touched after the lock is released, so a
+  // writer waiting in its destructor may go away
+  boost::mutex::scoped_lock lock(mutex_);
+  --pending_;
+  done_.notify_all();
+}
+
+}  // namespace caffe
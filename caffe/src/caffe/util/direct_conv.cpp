@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/direct_conv.hpp"
+#include "caffe/util/parallel_for.hpp"
+
+namespace caffe {
+
+// Range [lo, hi) of output positions o for which o * stride - pad + k is a
+// valid input position in [0, in_dim).
+inline void valid_range(const int k, const int pad, const int stride,
+    const int in_dim, const int out_dim, int* lo, int* hi) {
+  const int first = pad - k;
+  *lo = first > 0 ? (first + stride - 1) / stride : 0;
+  const int last = in_dim - 1 + pad - k;
+  *hi = last < 0 ? 0 : std::min(out_dim, last / stride + 1);
+  if (*hi < *lo) *hi = *lo;
+}
+
+template <typename Dtype>
+int direct_conv3d_active_rows(const Dtype* data_in, const int channels,
+    const int* in_shape, unsigned char* active_rows) {
+  const int rows = channels * in_shape[0] * in_shape[1], iw = in_shape[2];
+  int count = 0;
+  for (int r = 0; r < rows; ++r) {
+    const Dtype* row = data_in + r * iw;
+    int x = 0;
+    while (x < iw && row[x] == Dtype(0)) ++x;
+    active_rows[r] = x < iw;
+    count += x < iw;
+  }
+  return count;
+}
+
+// Number of output channels the forward kernels compute together.
+const int kOutputBlock = 4;
+
+// Adds every input channel's contribution to the depth z planes of output
+// channels o .. o + NB - 1 (out[j] for channel o + j).  Each input row that
+// is read is applied to all NB outputs while it is in cache, and NB is a
+// constant so the loop over them is unrolled.  Inputs and weights of type
+// T are accumulated as Acc (float, or int8 into int32).
+template <int NB, typename T, typename Acc>
+void direct_conv3d_block(const T* data_in, const int channels,
+    const int* in_shape, const T* weights, const int* out_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const unsigned char* active_rows, const int o, const int z,
+    Acc* const* out) {
+  const int id = in_shape[0], ih = in_shape[1], iw = in_shape[2];
+  const int oh = out_shape[1], ow = out_shape[2];
+  const int kd = kernel_shape[0], kh = kernel_shape[1], kw = kernel_shape[2];
+  const int in_plane = ih * iw, in_vol = id * in_plane;
+  const int kernel_vol = kd * kh * kw;
+  for (int c = 0; c < channels; ++c) {
+    const T* in = data_in + c * in_vol;
+    for (int a = 0; a < kd; ++a) {
+      const int iz = z * stride[0] - pad[0] + a;
+      if (iz < 0 || iz >= id) continue;
+      const unsigned char* active =
+          active_rows ? active_rows + (c * id + iz) * ih : NULL;
+      for (int b = 0; b < kh; ++b) {
+        int ylo, yhi;
+        valid_range(b, pad[1], stride[1], ih, oh, &ylo, &yhi);
+        for (int k = 0; k < kw; ++k) {
+          Acc wv[NB];
+          for (int j = 0; j < NB; ++j) {
+            wv[j] = weights[((o + j) * channels + c) * kernel_vol
+                + (a * kh + b) * kw + k];
+          }
+          int xlo, xhi;
+          valid_range(k, pad[2], stride[2], iw, ow, &xlo, &xhi);
+          for (int y = ylo; y < yhi; ++y) {
+            const int iy = y * stride[1] - pad[1] + b;
+            if (active && !active[iy]) continue;
+            const T* in_row = in + iz * in_plane + iy * iw;
+            for (int j = 0; j < NB; ++j) {
+              Acc* out_row = out[j] + y * ow;
+              const Acc w = wv[j];
+              if (stride[2] == 1) {
+                const T* src = in_row + k - pad[2];
+                for (int x = xlo; x < xhi; ++x)
+                  out_row[x] += w * Acc(src[x]);
+              } else {
+                for (int x = xlo; x < xhi; ++x)
+                  out_row[x] += w * Acc(in_row[x * stride[2] - pad[2] + k]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// direct_conv3d_block over nb <= kOutputBlock output channels
+template <typename T, typename Acc>
+void direct_conv3d_blocks(const T* data_in, const int channels,
+    const int* in_shape, const T* weights, const int* out_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const unsigned char* active_rows, const int o, const int nb,
+    const int z, Acc* const* out) {
+  if (nb == kOutputBlock) {
+    direct_conv3d_block<kOutputBlock>(data_in, channels, in_shape, weights,
+        out_shape, kernel_shape, pad, stride, active_rows, o, z, out);
+  } else {
+    for (int j = 0; j < nb; ++j) {
+      direct_conv3d_block<1>(data_in, channels, in_shape, weights,
+          out_shape, kernel_shape, pad, stride, active_rows, o + j, z,
+          out + j);
+    }
+  }
+}
+
+template <typename Dtype>
+inline void rectify(const int n, const Dtype negative_slope, Dtype* x) {
+  for (int i = 0; i < n; ++i) {
+    x[i] = std::max(x[i], Dtype(0)) + negative_slope * std::min(x[i], Dtype(0));
+  }
+}
+
+template <typename Dtype>
+void direct_conv3d_cpu(const Dtype* data_in, const int channels,
+    const int* in_shape, const Dtype* weights, const int num_output,
+    const int* out_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, const Dtype* bias,
+    const bool relu, const Dtype negative_slope, Dtype* data_out) {
+  const int od = out_shape[0], oh = out_shape[1], ow = out_shape[2];
+  const int out_plane = oh * ow, out_vol = od * out_plane;
+  const int blocks = (num_output + kOutputBlock - 1) / kOutputBlock;
+  caffe_parallel_for(blocks * od, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const int o = i / od * kOutputBlock, z = i % od;
+      const int nb = std::min(kOutputBlock, num_output - o);
+      Dtype* out[kOutputBlock];
+      for (int j = 0; j < nb; ++j) {
+        out[j] = data_out + (o + j) * out_vol + z * out_plane;
+        std::fill(out[j], out[j] + out_plane, bias ? bias[o + j] : Dtype(0));
+      }
+      direct_conv3d_blocks(data_in, channels, in_shape, weights, out_shape,
+          kernel_shape, pad, stride, active_rows, o, nb, z, out);
+      if (relu) {
+        for (int j = 0; j < nb; ++j) {
+          rectify(out_plane, negative_slope, out[j]);
+        }
+      }
+    }
+  });
+}
+
+template <typename Dtype>
+void direct_conv3d_s8_cpu(const int8_t* data_in, const Dtype input_scale,
+    const int channels, const int* in_shape, const int8_t* weights,
+    const Dtype* weight_scales, const int num_output, const int* out_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const unsigned char* active_rows, const Dtype* bias, const bool relu,
+    const Dtype negative_slope, Dtype* data_out) {
+  const int od = out_shape[0], oh = out_shape[1], ow = out_shape[2];
+  const int out_plane = oh * ow, out_vol = od * out_plane;
+  const int blocks = (num_output + kOutputBlock - 1) / kOutputBlock;
+  caffe_parallel_for(blocks * od, [&](int begin, int end) {
+    std::vector<int32_t> sums(kOutputBlock * out_plane);
+    for (int i = begin; i < end; ++i) {
+      const int o = i / od * kOutputBlock, z = i % od;
+      const int nb = std::min(kOutputBlock, num_output - o);
+      int32_t* acc[kOutputBlock];
+      for (int j = 0; j < nb; ++j) {
+        acc[j] = &sums[j * out_plane];
+        std::fill(acc[j], acc[j] + out_plane, 0);
+      }
+      direct_conv3d_blocks(data_in, channels, in_shape, weights, out_shape,
+          kernel_shape, pad, stride, active_rows, o, nb, z, acc);
+      for (int j = 0; j < nb; ++j) {
+        const Dtype scale = weight_scales[o + j] * input_scale;
+        const Dtype shift = bias ? bias[o + j] : Dtype(0);
+        Dtype* out = data_out + (o + j) * out_vol + z * out_plane;
+        for (int p = 0; p < out_plane; ++p) {
+          out[p] = acc[j][p] * scale + shift;
+        }
+        if (relu) rectify(out_plane, negative_slope, out);
+      }
+    }
+  });
+}
+
+template <typename Dtype>
+void direct_conv3d_backward_cpu(const Dtype* diff_out, const int num_output,
+    const int* out_shape, const Dtype* weights, const int channels,
+    const int* in_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, Dtype* diff_in) {
+  const int id = in_shape[0], ih = in_shape[1], iw = in_shape[2];
+  const int od = out_shape[0], oh = out_shape[1], ow = out_shape[2];
+  const int kd = kernel_shape[0], kh = kernel_shape[1], kw = kernel_shape[2];
+  const int in_plane = ih * iw, in_vol = id * in_plane;
+  const int out_plane = oh * ow, out_vol = od * out_plane;
+  const int kernel_vol = kd * kh * kw;
+  // each thread owns an input plane and gathers from the output planes
+  // that read it
+  caffe_parallel_for(channels * id, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const int c = i / id, iz = i % id;
+      Dtype* in = diff_in + c * in_vol + iz * in_plane;
+      std::fill(in, in + in_plane, Dtype(0));
+      const unsigned char* active =
+          active_rows ? active_rows + (c * id + iz) * ih : NULL;
+      for (int a = 0; a < kd; ++a) {
+        const int zs = iz + pad[0] - a;
+        if (zs < 0 || zs % stride[0] != 0) continue;
+        const int z = zs / stride[0];
+        if (z >= od) continue;
+        for (int o = 0; o < num_output; ++o) {
+          const Dtype* out = diff_out + o * out_vol + z * out_plane;
+          const Dtype* w = weights + (o * channels + c) * kernel_vol;
+          for (int b = 0; b < kh; ++b) {
+            int ylo, yhi;
+            valid_range(b, pad[1], stride[1], ih, oh, &ylo, &yhi);
+            for (int y = ylo; y < yhi; ++y) {
+              const int iy = y * stride[1] - pad[1] + b;
+              if (active && !active[iy]) continue;
+              Dtype* in_row = in + iy * iw;
+              const Dtype* out_row = out + y * ow;
+              for (int k = 0; k < kw; ++k) {
+                const Dtype wv = w[(a * kh + b) * kw + k];
+                int xlo, xhi;
+                valid_range(k, pad[2], stride[2], iw, ow, &xlo, &xhi);
+                if (stride[2] == 1) {
+                  Dtype* dst = in_row + k - pad[2];
+                  for (int x = xlo; x < xhi; ++x) dst[x] += wv * out_row[x];
+                } else {
+                  for (int x = xlo; x < xhi; ++x)
+                    in_row[x * stride[2] - pad[2] + k] += wv * out_row[x];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+template <typename Dtype>
+void direct_conv3d_weight_cpu(const Dtype* data_in, const int channels,
+    const int* in_shape, const Dtype* diff_out, const int num_output,
+    const int* out_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, Dtype* weight_diff) {
+  const int id = in_shape[0], ih = in_shape[1], iw = in_shape[2];
+  const int od = out_shape[0], oh = out_shape[1], ow = out_shape[2];
+  const int kd = kernel_shape[0], kh = kernel_shape[1], kw = kernel_shape[2];
+  const int in_plane = ih * iw, in_vol = id * in_plane;
+  const int out_plane = oh * ow, out_vol = od * out_plane;
+  const int kernel_vol = kd * kh * kw;
+  // each thread owns the kernel of one (output, input) channel pair
+  caffe_parallel_for(num_output * channels, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const int o = i / channels, c = i % channels;
+      const Dtype* in = data_in + c * in_vol;
+      Dtype* w = weight_diff + (o * channels + c) * kernel_vol;
+      for (int z = 0; z < od; ++z) {
+        const Dtype* out = diff_out + o * out_vol + z * out_plane;
+        for (int a = 0; a < kd; ++a) {
+          const int iz = z * stride[0] - pad[0] + a;
+          if (iz < 0 || iz >= id) continue;
+          const unsigned char* active =
+              active_rows ? active_rows + (c * id + iz) * ih : NULL;
+          for (int b = 0; b < kh; ++b) {
+            int ylo, yhi;
+            valid_range(b, pad[1], stride[1], ih, oh, &ylo, &yhi);
+            for (int y = ylo; y < yhi; ++y) {
+              const int iy = y * stride[1] - pad[1] + b;
+              if (active && !active[iy]) continue;
+              const Dtype* in_row = in + iz * in_plane + iy * iw;
+              const Dtype* out_row = out + y * ow;
+              for (int k = 0; k < kw; ++k) {
+                int xlo, xhi;
+                valid_range(k, pad[2], stride[2], iw, ow, &xlo, &xhi);
+                Dtype sum = 0;
+                if (stride[2] == 1) {
+                  const Dtype* src = in_row + k - pad[2];
+                  for (int x = xlo; x < xhi; ++x) sum += src[x] * out_row[x];
+                } else {
+                  for (int x = xlo; x < xhi; ++x)
+                    sum += in_row[x * stride[2] - pad[2] + k] * out_row[x];
+                }
+                w[(a * kh + b) * kw + k] += sum;
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+// Explicit instantiation
+template int direct_conv3d_active_rows<float>(const float* data_in,
+    const int channels, const int* in_shape, unsigned char* active_rows);
+template int direct_conv3d_active_rows<double>(const double* data_in,
+    const int channels, const int* in_shape, unsigned char* active_rows);
+template void direct_conv3d_cpu<float>(const float* data_in,
+    const int channels, const int* in_shape, const float* weights,
+    const int num_output, const int* out_shape, const int* kernel_shape,
+    const int* pad, const int* stride, const unsigned char* active_rows,
+    const float* bias, const bool relu, const float negative_slope,
+    float* data_out);
+template void direct_conv3d_cpu<double>(const double* data_in,
+    const int channels, const int* in_shape, const double* weights,
+    const int num_output, const int* out_shape, const int* kernel_shape,
+    const int* pad, const int* stride, const unsigned char* active_rows,
+    const double* bias, const bool relu, const double negative_slope,
+    double* data_out);
+template void direct_conv3d_s8_cpu<float>(const int8_t* data_in,
+    const float input_scale, const int channels, const int* in_shape,
+    const int8_t* weights, const float* weight_scales, const int num_output,
+    const int* out_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, const float* bias,
+    const bool relu, const float negative_slope, float* data_out);
+template void direct_conv3d_s8_cpu<double>(const int8_t* data_in,
+    const double input_scale, const int channels, const int* in_shape,
+    const int8_t* weights, const double* weight_scales, const int num_output,
+    const int* out_shape, const int* kernel_shape, const int* pad,
+    const int* stride, const unsigned char* active_rows, const double* bias,
+    const bool relu, const double negative_slope, double* data_out);
+template void direct_conv3d_backward_cpu<float>(const float* diff_out,
+    const int num_output, const int* out_shape, const float* weights,
+    const int channels, const int* in_shape, const int* kernel_shape,
+    const int* pad, const int* stride, const unsigned char* active_rows,
+    float* diff_in);
+template void direct_conv3d_backward_cpu<double>(const double* diff_out,
+    const int num_output, const int* out_shape, const double* weights,
+    const int channels, const int* in_shape, const int* kernel_shape,
+    const int* pad, const int* stride, const unsigned char* active_rows,
+    double* diff_in);
+template void direct_conv3d_weight_cpu<float>(const float* data_in,
+    const int channels, const int* in_shape, const float* diff_out,
+    const int num_output, const int* out_shape, const int* kernel_shape,
+    const int* pad, const int* stride, const unsigned char* active_rows,
+    float* weight_diff);
+template void direct_conv3d_weight_cpu<double>(const double* data_in,
+    const int channels, const int* in_shape, const double* diff_out,
+    const int num_output, const int* out_shape, const int* kernel_shape,
+    const int* pad, const int* stride, const unsigned char* active_rows,
+    double* weight_diff);
+
+}  // namespace caffe
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+namespace caffe {
+
+// Layers after producer that read the version of blob name it wrote,
+// stopping at the next layer that writes name (in place).
+static vector<int> Consumers(const vector<LayerParameter>& layers,
+    const vector<bool>& removed, const int producer, const string& name) {
+  vector<int> consumers;
+  for (int i = producer + 1; i < layers.size(); ++i) {
+    if (removed[i]) continue;
+    bool writes = false;
+    for (int j = 0; j < layers[i].bottom_size(); ++j) {
+      if (layers[i].bottom(j) == name) {
+        consumers.push_back(i);
+        break;
+      }
+    }
+    for (int j = 0; j < layers[i].top_size(); ++j) {
+      if (layers[i].top(j) == name) writes = true;
+    }
+    if (writes) break;
+  }
+  return consumers;
+}
+
+static bool SingleInOut(const LayerParameter& layer) {
+  return layer.bottom_size() == 1 && layer.top_size() == 1;
+}
+
+static bool GlobalBatchNorm(const LayerParameter& layer) {
+  if (layer.type() != "BatchNorm" || !SingleInOut(layer)
+      || layer.blobs_size() != 3) return false;
+  const BatchNormParameter& bn = layer.batch_norm_param();
+  return bn.has_use_global_stats() ? bn.use_global_stats()
+      : layer.phase() == TEST;
+}
+
+static bool ChannelScale(const LayerParameter& layer) {
+  return layer.type() == "Scale" && SingleInOut(layer)
+      && layer.scale_param().axis() == 1
+      && layer.scale_param().num_axes() == 1
+      && layer.blobs_size() == 1 + layer.scale_param().bias_term();
+}
+
+// y = scale * x + shift per channel for a GlobalBatchNorm or ChannelScale
+static void ChannelAffine(const LayerParameter& layer, vector<double>* scale,
+    vector<double>* shift) {
+  Blob<double> blob;
+  if (layer.type() == "BatchNorm") {
+    Blob<double> mean, variance, factor;
+    mean.FromProto(layer.blobs(0));
+    variance.FromProto(layer.blobs(1));
+    factor.FromProto(layer.blobs(2));
+    const double f = factor.cpu_data()[0] == 0 ? 0 : 1 / factor.cpu_data()[0];
+    const double eps = layer.batch_norm_param().eps();
+    scale->resize(mean.count());
+    shift->resize(mean.count());
+    for (int c = 0; c < mean.count(); ++c) {
+      const double inv_std = 1 / std::sqrt(variance.cpu_data()[c] * f + eps);
+      (*scale)[c] = inv_std;
+      (*shift)[c] = -mean.cpu_data()[c] * f * inv_std;
+    }
+  } else {
+    blob.FromProto(layer.blobs(0));
+    scale->assign(blob.cpu_data(), blob.cpu_data() + blob.count());
+    shift->assign(blob.count(), 0);
+    if (layer.scale_param().bias_term()) {
+      blob.FromProto(layer.blobs(1));
+      shift->assign(blob.cpu_data(), blob.cpu_data() + blob.count());
+    }
+  }
+}
+
+// replaces any float data the proto had
+static void SetBlob(const Blob<double>& blob, BlobProto* proto) {
+  proto->Clear();
+  blob.ToProto(proto);
+}
+
+static void SetBlob(const vector<double>& values, BlobProto* proto) {
+  Blob<double> blob(vector<int>(1, values.size()));
+  std::copy(values.begin(), values.end(), blob.mutable_cpu_data());
+  SetBlob(blob, proto);
+}
+
+// make layer a per channel Scale computing scale * x + shift
+static void SetChannelAffine(const vector<double>& scale,
+    const vector<double>& shift, LayerParameter* layer) {
+  layer->set_type("Scale");
+  layer->clear_batch_norm_param();
+  layer->clear_param();
+  ScaleParameter* scale_param = layer->mutable_scale_param();
+  scale_param->set_axis(1);
+  scale_param->set_num_axes(1);
+  scale_param->set_bias_term(true);
+  layer->clear_blobs();
+  SetBlob(scale, layer->add_blobs());
+  SetBlob(shift, layer->add_blobs());
+}
+
+static bool FoldableConvolution(const LayerParameter& layer) {
+  if (layer.type() != "Convolution" || !SingleInOut(layer)
+      || layer.blobs_size() != 1 + layer.convolution_param().bias_term())
+    return false;
+  // shared weights would change in every layer using them
+  for (int i = 0; i < layer.param_size(); ++i) {
+    if (layer.param(i).name().size()) return false;
+  }
+  return true;
+}
+
+// conv(x) becomes scale * conv(x) + shift
+static void FoldIntoConvolution(const vector<double>& scale,
+    const vector<double>& shift, LayerParameter* conv) {
+  Blob<double> weights;
+  weights.FromProto(conv->blobs(0));
+  const int num_output = weights.shape(0);
+  CHECK_EQ(num_output, scale.size()) << "Channel mismatch folding into "
+      << conv->name();
+  const int weights_per_output = weights.count(1);
+  double* w = weights.mutable_cpu_data();
+  for (int o = 0; o < num_output; ++o) {
+    for (int i = 0; i < weights_per_output; ++i) {
+      w[o * weights_per_output + i] *= scale[o];
+    }
+  }
+  SetBlob(weights, conv->mutable_blobs(0));
+
+  vector<double> bias(shift);
+  if (conv->convolution_param().bias_term()) {
+    Blob<double> old_bias;
+    old_bias.FromProto(conv->blobs(1));
+    for (int o = 0; o < num_output; ++o) {
+      bias[o] += scale[o] * old_bias.cpu_data()[o];
+    }
+  } else {
+    conv->mutable_convolution_param()->set_bias_term(true);
+    conv->add_blobs();
+  }
+  SetBlob(bias, conv->mutable_blobs(1));
+}
+
+void FuseInferenceLayers(const NetParameter& param,
+    NetParameter* param_fused) {
+  vector<LayerParameter> layers(param.layer().begin(), param.layer().end());
+  vector<bool> removed(layers.size(), false);
+  vector<double> scale, shift;
+
+  // fold affine layers and then an activation into the convolution
+  // producing their input
+  for (int i = 0; i < layers.size(); ++i) {
+    LayerParameter& conv = layers[i];
+    if (!FoldableConvolution(conv)) continue;
+    while (true) {
+      vector<int> consumers = Consumers(layers, removed, i, conv.top(0));
+      if (consumers.size() != 1) break;
+      const LayerParameter& next = layers[consumers[0]];
+      if (GlobalBatchNorm(next) || ChannelScale(next)) {
+        if (conv.convolution_param().fused_relu()) break;
+        ChannelAffine(next, &scale, &shift);
+        FoldIntoConvolution(scale, shift, &conv);
+      } else if (next.type() == "ReLU" && SingleInOut(next)
+          && !conv.convolution_param().fused_relu()) {
+        ConvolutionParameter* conv_param = conv.mutable_convolution_param();
+        conv_param->set_fused_relu(true);
+        conv_param->set_fused_relu_negative_slope(
+            next.relu_param().negative_slope());
+      } else {
+        break;
+      }
+      LOG(INFO) << "Fusing " << next.name() << " into " << conv.name();
+      conv.set_top(0, next.top(0));
+      removed[consumers[0]] = true;
+    }
+  }
+
+  // the rest of the batch norms are a single scale and shift
+  for (int i = 0; i < layers.size(); ++i) {
+    if (removed[i] || !GlobalBatchNorm(layers[i])) continue;
+    ChannelAffine(layers[i], &scale, &shift);
+    SetChannelAffine(scale, shift, &layers[i]);
+  }
+
+  // merge chains of scale layers
+  vector<double> next_scale, next_shift;
+  for (int i = 0; i < layers.size(); ++i) {
+    if (removed[i] || !ChannelScale(layers[i])) continue;
+    while (true) {
+      vector<int> consumers = Consumers(layers, removed, i, layers[i].top(0));
+      if (consumers.size() != 1 || !ChannelScale(layers[consumers[0]])) break;
+      const LayerParameter& next = layers[consumers[0]];
+      ChannelAffine(layers[i], &scale, &shift);
+      ChannelAffine(next, &next_scale, &next_shift);
+      if (scale.size() != next_scale.size()) break;
+      for (int c = 0; c < scale.size(); ++c) {
+        shift[c] = next_scale[c] * shift[c] + next_shift[c];
+        scale[c] *= next_scale[c];
+      }
+      LOG(INFO) << "Fusing " << next.name() << " into " << layers[i].name();
+      SetChannelAffine(scale, shift, &layers[i]);
+      layers[i].set_top(0, next.top(0));
+      removed[consumers[0]] = true;
+    }
+  }
+
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  for (int i = 0; i < layers.size(); ++i) {
+    if (!removed[i]) param_fused->add_layer()->CopyFrom(layers[i]);
+  }
+}
+
+}  // namespace caffe
@@ -9,6 +9,8 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #endif  // USE_OPENCV
 #include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -69,6 +71,20 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+void WriteProtoToBinaryFileAtomic(const Message& proto, const char* filename) {
+  string temp_filename = string(filename) + ".tmp";
+  int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_NE(fd, -1) << "Couldn't open " << temp_filename;
+  FileOutputStream* output = new FileOutputStream(fd);
+  CHECK(proto.SerializeToZeroCopyStream(output));
+  CHECK(output->Flush()) << "Couldn't write " << temp_filename;
+  delete output;
+  CHECK_EQ(fsync(fd), 0) << "Couldn't sync " << temp_filename;
+  close(fd);
+  CHECK_EQ(rename(temp_filename.c_str(), filename), 0)
+      << "Couldn't rename " << temp_filename << " to " << filename;
+}
+
 #ifdef USE_OPENCV
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color) {
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <exception>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel_for.hpp"
+
+namespace caffe {
+
+#ifdef _OPENMP
+// cap set by caffe_set_parallel_threads, 0 for the OpenMP default
+static int max_omp_threads = 0;
+#else
+namespace {
+
+// Persistent workers for caffe_parallel_for.  Each loop bumps generation_
+// to wake the workers; worker i runs chunk i + 1 while the caller runs
+// chunk 0.  Workers are started as the thread count grows and left idle
+// when it shrinks.
+class ParallelForPool {
+ public:
+  ParallelForPool()
+    : num_threads_(0), num_workers_(0), body_(NULL), n_(0), generation_(0),
+      pending_(0) {
+    SetThreads(std::max(1u, boost::thread::hardware_concurrency()));
+  }
+
+  int num_threads() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return num_threads_;
+  }
+
+  // Waits for the running loop, if any, to finish.
+  void SetThreads(const int threads) {
+    boost::mutex::scoped_lock busy(run_mutex_);
+    try {
+      for (; num_workers_ < threads - 1; ++num_workers_) {
+        boost::thread(boost::bind(&ParallelForPool::Entry, this,
+            num_workers_ + 1)).detach();
+      }
+    } catch (std::exception& e) {
+      LOG(FATAL) << "Thread exception: " << e.what();
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    num_threads_ = threads;
+  }
+
+  void Run(const int n, const boost::function<void(int, int)>& body) {
+    boost::mutex::scoped_try_lock busy(run_mutex_);
+    if (n < 2 || !busy.owns_lock() || num_threads_ == 1) {
+      if (n > 0) body(0, n);
+      return;
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      body_ = &body;
+      n_ = n;
+      pending_ = num_workers_;
+      ++generation_;
+    }
+    start_.notify_all();
+    std::exception_ptr error;
+    try {
+      RunChunk(body, n, 0);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    while (pending_ > 0) {
+      done_.wait(lock);
+    }
+    body_ = NULL;
+    if (!error) error = error_;
+    error_ = std::exception_ptr();
+    lock.unlock();
+    if (error) std::rethrow_exception(error);
+  }
+
+ private:
+  void RunChunk(const boost::function<void(int, int)>& body, const int n,
+      const int i) const {
+    const int begin = static_cast<int>(static_cast<long>(n) * i
+        / num_threads_);
+    const int end = static_cast<int>(static_cast<long>(n) * (i + 1)
+        / num_threads_);
+    if (begin < end) body(begin, end);
+  }
+
+  void Entry(const int i) {
+    int seen = 0;
+    while (true) {
+      const boost::function<void(int, int)>* body;
+      int n;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (generation_ == seen) {
+          start_.wait(lock);
+        }
+        seen = generation_;
+        body = body_;
+        n = n_;
+      }
+      std::exception_ptr error;
+      try {
+        // num_threads_ cannot change while a loop runs
+        if (i < num_threads_) RunChunk(*body, n, i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      if (error && !error_) error_ = error;
+      if (--pending_ == 0) done_.notify_all();
+    }
+  }
+
+  // chunks per loop, and workers started; changed only under both
+  // run_mutex_ and mutex_, so fixed while a loop runs
+  int num_threads_;
+  int num_workers_;
+  // held for the duration of a loop
+  boost::mutex run_mutex_;
+  boost::mutex mutex_;
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+  const boost::function<void(int, int)>* body_;
+  int n_;
+  int generation_;
+  int pending_;
+  // first exception thrown by a worker's chunk, rethrown by Run
+  std::exception_ptr error_;
+
+DISABLE_COPY_AND_ASSIGN(ParallelForPool);
+};
+
+// Never destroyed: the workers are detached and may still be waiting on
+// the pool during static destruction.
+ParallelForPool& pool() {
+  static ParallelForPool* instance = new ParallelForPool();
+  return *instance;
+}
+
+}  // namespace
+#endif
+
+void caffe_parallel_for(const int n,
+    const boost::function<void(int, int)>& body) {
+#ifdef _OPENMP
+  if (n < 2 || omp_in_parallel()) {
+    if (n > 0) body(0, n);
+    return;
+  }
+  std::exception_ptr error;
+#pragma omp parallel num_threads(caffe_parallel_threads())
+  {
+    const int threads = omp_get_num_threads(), i = omp_get_thread_num();
+    const int begin = static_cast<int>(static_cast<long>(n) * i / threads);
+    const int end = static_cast<int>(static_cast<long>(n) * (i + 1)
+        / threads);
+    try {
+      if (begin < end) body(begin, end);
+    } catch (...) {
+#pragma omp critical(caffe_parallel_for_error)
+      if (!error) error = std::current_exception();
+    }
+  }
+  if (error) std::rethrow_exception(error);
+#else
+  pool().Run(n, body);
+#endif
+}
+
+int caffe_parallel_threads() {
+#ifdef _OPENMP
+  // the OpenMP default is per thread, so the cap is kept here to apply to
+  // loops started from any thread
+  const int threads = omp_get_max_threads();
+  return max_omp_threads > 0 ? std::min(threads, max_omp_threads) : threads;
+#else
+  return pool().num_threads();
+#endif
+}
+
+void caffe_set_parallel_threads(const int threads) {
+  CHECK_GT(threads, 0);
+#ifdef _OPENMP
+  max_omp_threads = threads;
+#else
+  pool().SetThreads(threads);
+#endif
+}
+
+}  // namespace caffe
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cmath>
+
+#include "caffe/util/parallel_for.hpp"
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* q) {
+  const Dtype inv_scale = Dtype(1) / scale;
+  for (int i = 0; i < n; ++i) {
+    const Dtype v = std::max(Dtype(-127),
+        std::min(Dtype(127), x[i] * inv_scale));
+    q[i] = static_cast<int8_t>(std::floor(v + Dtype(0.5)));
+  }
+}
+
+template void caffe_cpu_quantize<float>(const int n, const float* x,
+    const float scale, int8_t* q);
+template void caffe_cpu_quantize<double>(const int n, const double* x,
+    const double scale, int8_t* q);
+
+void caffe_cpu_gemm_s8(const CBLAS_TRANSPOSE TransB, const int M,
+    const int N, const int K, const int8_t* A, const int8_t* B, int32_t* C) {
+  if (TransB == CblasNoTrans) {
+    // rows of C are accumulated as unit stride sweeps over rows of B;
+    // zero entries of A (common after rectification) are skipped
+    caffe_parallel_for(M, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        int32_t* c = C + i * N;
+        std::fill(c, c + N, 0);
+        const int8_t* a = A + i * K;
+        for (int k = 0; k < K; ++k) {
+          const int32_t a_ik = a[k];
+          if (a_ik == 0) continue;
+          const int8_t* b = B + k * N;
+          for (int j = 0; j < N; ++j) {
+            c[j] += a_ik * b[j];
+          }
+        }
+      }
+    });
+  } else {
+    // every entry is a dot product of two rows
+    caffe_parallel_for(M * N, [&](int begin, int end) {
+      for (int ij = begin; ij < end; ++ij) {
+        const int8_t* a = A + ij / N * K;
+        const int8_t* b = B + ij % N * K;
+        int32_t sum = 0;
+        for (int k = 0; k < K; ++k) {
+          sum += int32_t(a[k]) * int32_t(b[k]);
+        }
+        C[ij] = sum;
+      }
+    });
+  }
+}
+
+template <typename Dtype>
+void QuantizedWeights<Dtype>::Update(const Blob<Dtype>& weights,
+    const int num_output, const bool transposed) {
+  if (source_ == weights.data().get() && !data_.empty()) return;
+  source_ = weights.data().get();
+  const int count = weights.count();
+  const int dim = count / num_output;
+  const Dtype* w = weights.cpu_data();
+  data_.resize(count);
+  scales_.resize(num_output);
+  std::vector<Dtype> row(dim);
+  for (int o = 0; o < num_output; ++o) {
+    Dtype range = 0;
+    for (int k = 0; k < dim; ++k) {
+      row[k] = transposed ? w[k * num_output + o] : w[o * dim + k];
+      range = std::max(range, std::fabs(row[k]));
+    }
+    scales_[o] = quantization_scale(range);
+    caffe_cpu_quantize(dim, &row[0], scales_[o], &data_[o * dim]);
+  }
+}
+
+INSTANTIATE_CLASS(QuantizedWeights);
+
+}  // namespace caffe
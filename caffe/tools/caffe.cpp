@@ -6,20 +6,30 @@ namespace bp = boost::python;
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <fstream>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/layers/molgrid_data_layer.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/signal_handler.h"
 
 using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
 using caffe::Layer;
+using caffe::LayerParameter;
+using caffe::NetParameter;
 using caffe::Solver;
+using caffe::SyncedMemory;
 using caffe::shared_ptr;
 using caffe::string;
 using caffe::Timer;
@@ -30,6 +40,10 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(solver_threads, 1,
+    "Optional; train in CPU mode with this many data parallel solvers in "
+    "threads of one process. The effective training batch size is "
+    "multiplied by the number of solvers.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -48,6 +62,20 @@ DEFINE_string(weights, "",
     "separated by ','. Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_string(quantization, "",
+    "The file 'calibrate' writes int8 quantization parameters to.");
+DEFINE_string(receptor, "",
+    "The receptor (.gninatypes) that 'benchmark' scores ligands against.");
+DEFINE_string(ligands, "",
+    "The ligands for 'benchmark': .gninatypes or .molcache2 files "
+    "separated by ','.");
+DEFINE_string(batch_sizes, "1,16,64",
+    "Optional; batch sizes for 'benchmark', separated by ','.");
+DEFINE_string(threads, "1",
+    "Optional; CPU thread counts for 'benchmark', separated by ','. Each "
+    "thread runs its own copy of the net.");
+DEFINE_string(json, "",
+    "Optional; file 'benchmark' writes its results to, stdout if empty.");
 DEFINE_string(sigint_effect, "stop",
              "Optional; action to take when a SIGINT signal is received: "
               "snapshot, stop or none.");
@@ -196,9 +224,13 @@ int train() {
 
   vector<int> gpus;
   get_gpus(&gpus);
+  CHECK(FLAGS_solver_threads == 1 || gpus.size() == 0)
+      << "Solver threads are only used in CPU mode.";
+  CHECK_GE(FLAGS_solver_threads, 1);
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(FLAGS_solver_threads);
   } else {
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
@@ -247,6 +279,10 @@ int train() {
 #else
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif
+  } else if (FLAGS_solver_threads > 1) {
+    LOG(INFO) << "Using " << FLAGS_solver_threads << " CPU solvers";
+    caffe::CPUSync<float> sync(solver);
+    sync.Run(FLAGS_snapshot.size() > 0 ? FLAGS_snapshot.c_str() : NULL);
   } else {
     solver->Solve();
   }
@@ -426,6 +462,450 @@ int time() {
 }
 RegisterBrewFunction(time);
 
+// A molecule as MolGridDataLayer takes it from memory.
+struct BenchmarkMolecule {
+  vector<float3> coords;
+  vector<smt> types;
+};
+
+// Read one .gninatypes molecule (x, y, z, type records) or every molecule
+// of a .molcache2 file.
+static void read_molecules(const string& fname,
+    vector<BenchmarkMolecule>* mols) {
+  std::ifstream in(fname.c_str(), std::ios::binary);
+  CHECK(in) << "Could not open " << fname;
+  struct { float x, y, z; int type; } atom;
+  if (boost::algorithm::ends_with(fname, ".gninatypes")) {
+    BenchmarkMolecule mol;
+    while (in.read(reinterpret_cast<char*>(&atom), sizeof(atom))) {
+      float3 c = {atom.x, atom.y, atom.z};
+      mol.coords.push_back(c);
+      mol.types.push_back(smt(atom.type));
+    }
+    mols->push_back(mol);
+  } else {
+    CHECK(boost::algorithm::ends_with(fname, ".molcache2"))
+        << "Unknown molecule file type " << fname;
+    int32_t version = 0;
+    uint64_t index = 0;
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&index), sizeof(index));
+    CHECK_EQ(version, -1) << "Not a molcache2 file: " << fname;
+    while (uint64_t(in.tellg()) < index) {
+      int32_t natoms = 0;
+      in.read(reinterpret_cast<char*>(&natoms), sizeof(natoms));
+      CHECK(in) << "Truncated molcache2 file " << fname;
+      BenchmarkMolecule mol;
+      for (int i = 0; i < natoms; ++i) {
+        in.read(reinterpret_cast<char*>(&atom), sizeof(atom));
+        float3 c = {atom.x, atom.y, atom.z};
+        mol.coords.push_back(c);
+        mol.types.push_back(smt(atom.type));
+      }
+      mols->push_back(mol);
+    }
+  }
+}
+
+// Per thread times of one benchmark configuration, in microseconds.
+struct BenchmarkTimes {
+  double wall;  // the timed batches, warm up excluded
+  double gridding;
+  vector<double> forward_per_layer;
+  vector<double> backward_per_layer;
+  BenchmarkTimes() : wall(0), gridding(0) {}
+};
+
+// Score ligands round robin, starting at offset, for FLAGS_iterations
+// batches after an untimed warm up batch. Every thread of a configuration
+// waits at warmed_up after its warm up, so the timed batches run together.
+static void run_benchmark(Net<float>* net,
+    const BenchmarkMolecule& receptor,
+    const vector<BenchmarkMolecule>& ligands, int offset,
+    boost::barrier* warmed_up, BenchmarkTimes* times) {
+  const vector<shared_ptr<Layer<float> > >& layers = net->layers();
+  const vector<vector<Blob<float>*> >& bottom_vecs = net->bottom_vecs();
+  const vector<vector<Blob<float>*> >& top_vecs = net->top_vecs();
+  const vector<vector<bool> >& bottom_need_backward =
+      net->bottom_need_backward();
+  caffe::MolGridDataLayer<float>* mgrid =
+      dynamic_cast<caffe::MolGridDataLayer<float>*>(layers[0].get());
+  times->forward_per_layer.assign(layers.size(), 0.0);
+  times->backward_per_layer.assign(layers.size(), 0.0);
+  Timer timer, wall_timer;
+  for (int j = -1; j < FLAGS_iterations; ++j) {
+    if (j == 0) {
+      warmed_up->wait();
+      wall_timer.Start();
+    }
+    const BenchmarkMolecule& ligand =
+        ligands[(offset + std::max(j, 0)) % ligands.size()];
+    timer.Start();
+    mgrid->setLigand(ligand.coords, ligand.types);
+    mgrid->setReceptor(receptor.coords, receptor.types);
+    mgrid->setLabels(1);
+    layers[0]->Forward(bottom_vecs[0], top_vecs[0]);
+    const double gridding = timer.MicroSeconds();
+    vector<double> forward(layers.size(), 0.0);
+    vector<double> backward(layers.size(), 0.0);
+    for (int i = 1; i < layers.size(); ++i) {
+      timer.Start();
+      layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
+      forward[i] = timer.MicroSeconds();
+    }
+    for (int i = layers.size() - 1; i >= 0; --i) {
+      timer.Start();
+      layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
+                          bottom_vecs[i]);
+      backward[i] = timer.MicroSeconds();
+    }
+    if (j < 0) continue;  // warm up
+    times->gridding += gridding;
+    for (int i = 0; i < layers.size(); ++i) {
+      times->forward_per_layer[i] += forward[i];
+      times->backward_per_layer[i] += backward[i];
+    }
+  }
+  times->wall = wall_timer.MicroSeconds();
+}
+
+static vector<int> get_ints_from_flag(const string& flag) {
+  vector<string> strings;
+  boost::split(strings, flag, boost::is_any_of(","));
+  vector<int> values;
+  for (int i = 0; i < strings.size(); ++i) {
+    values.push_back(boost::lexical_cast<int>(strings[i]));
+    CHECK_GT(values.back(), 0);
+  }
+  return values;
+}
+
+// Bytes of blob data and diff memory a net has allocated, activations and
+// parameters, counting memory shared by several blobs once.
+static size_t allocated_bytes(const Net<float>& net) {
+  vector<Blob<float>*> blobs;
+  for (int i = 0; i < net.blobs().size(); ++i) {
+    blobs.push_back(net.blobs()[i].get());
+  }
+  for (int i = 0; i < net.params().size(); ++i) {
+    blobs.push_back(net.params()[i].get());
+  }
+  std::set<SyncedMemory*> seen;
+  size_t bytes = 0;
+  for (int i = 0; i < blobs.size(); ++i) {
+    if (blobs[i]->count() == 0) continue;
+    SyncedMemory* memory[2] = { blobs[i]->data().get(),
+        blobs[i]->diff().get() };
+    for (int j = 0; j < 2; ++j) {
+      if (memory[j]->head() != SyncedMemory::UNINITIALIZED
+          && seen.insert(memory[j]).second) {
+        bytes += memory[j]->size();
+      }
+    }
+  }
+  return bytes;
+}
+
+// A kB field of /proc/self/status, or -1 if it cannot be read.
+static long status_kb(const string& field) {
+  std::ifstream status("/proc/self/status");
+  string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, field.size() + 1, field + ":") == 0) {
+      return atol(line.c_str() + field.size() + 1);
+    }
+  }
+  return -1;
+}
+
+// Reset the peak resident set size (VmHWM) to the current one, so it
+// covers only what runs afterwards.
+static bool reset_peak_rss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  clear_refs.close();
+  return bool(clear_refs);
+}
+
+// Benchmark: time a gnina model scoring in-memory receptor/ligand pairs
+// at several batch sizes and thread counts, separating the gridding done
+// by the MolGridData layer from the per-layer forward and backward time,
+// and write the results as JSON.
+int benchmark() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to benchmark.";
+  CHECK_GT(FLAGS_receptor.size(), 0) << "Need a receptor to benchmark.";
+  CHECK_GT(FLAGS_ligands.size(), 0) << "Need ligands to benchmark.";
+  CHECK_GT(FLAGS_iterations, 0) << "Need batches to time after the warm up.";
+  caffe::Phase phase = get_phase_from_flags(caffe::TEST);
+  vector<string> stages = get_stages_from_flags();
+  vector<int> batch_sizes = get_ints_from_flag(FLAGS_batch_sizes);
+  vector<int> thread_counts = get_ints_from_flag(FLAGS_threads);
+
+  vector<int> gpus;
+  get_gpus(&gpus);
+  if (gpus.size() != 0) {
+    LOG(INFO) << "Use GPU with device ID " << gpus[0];
+    Caffe::SetDevice(gpus[0]);
+    Caffe::set_mode(Caffe::GPU);
+    // the device is shared, so more threads only measure contention
+    thread_counts.assign(1, 1);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  vector<BenchmarkMolecule> receptors, ligands;
+  read_molecules(FLAGS_receptor, &receptors);
+  CHECK_EQ(receptors.size(), 1) << "Need exactly one receptor.";
+  vector<string> ligand_files;
+  boost::split(ligand_files, FLAGS_ligands, boost::is_any_of(","));
+  for (int i = 0; i < ligand_files.size(); ++i) {
+    read_molecules(ligand_files[i], &ligands);
+  }
+  CHECK_GT(ligands.size(), 0) << "No ligands in " << FLAGS_ligands;
+
+  NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  param.mutable_state()->set_phase(phase);
+  param.mutable_state()->set_level(FLAGS_level);
+  for (int i = 0; i < stages.size(); ++i) {
+    param.mutable_state()->add_stage(stages[i]);
+  }
+  param.set_force_backward(true);
+  CHECK(param.layer_size() > 0 && param.layer(0).type() == "MolGridData")
+      << "First layer of the model must be MolGridData.";
+  param.mutable_layer(0)->mutable_molgrid_data_param()->set_inmemory(true);
+
+  std::ofstream json_file;
+  if (FLAGS_json.size()) {
+    json_file.open(FLAGS_json.c_str());
+    CHECK(json_file) << "Could not open " << FLAGS_json;
+  }
+  std::ostream& json = FLAGS_json.size() ? json_file : std::cout;
+  json << "{\n  \"model\": \"" << FLAGS_model << "\",\n"
+      << "  \"mode\": \"" << (gpus.size() ? "GPU" : "CPU") << "\",\n"
+      << "  \"receptor_atoms\": " << receptors[0].coords.size() << ",\n"
+      << "  \"ligands\": " << ligands.size() << ",\n"
+      << "  \"iterations\": " << FLAGS_iterations << ",\n"
+      << "  \"batch_contents\": \"batch_size copies of one in-memory "
+      << "receptor/ligand pose\",\n"
+      << "  \"runs\": [";
+
+  for (int b = 0; b < batch_sizes.size(); ++b) {
+    param.mutable_layer(0)->mutable_molgrid_data_param()->set_batch_size(
+        batch_sizes[b]);
+    for (int t = 0; t < thread_counts.size(); ++t) {
+      const int nthreads = thread_counts[t];
+      LOG(INFO) << "Benchmarking batch size " << batch_sizes[b] << " with "
+          << nthreads << " threads.";
+      // memory is measured from here, so each configuration reports only
+      // the growth caused by its own nets and runs
+      const bool peak_reset = reset_peak_rss();
+      LOG_IF(WARNING, !peak_reset)
+          << "Could not reset the peak RSS, peak_rss_delta_kb is omitted.";
+      const long start_rss = status_kb("VmRSS");
+      vector<shared_ptr<Net<float> > > nets;
+      for (int i = 0; i < nthreads; ++i) {
+        nets.push_back(shared_ptr<Net<float> >(new Net<float>(param)));
+        if (i == 0 && FLAGS_weights.size()) {
+          nets[0]->CopyTrainedLayersFrom(FLAGS_weights);
+        } else if (i > 0) {
+          nets[i]->ShareTrainedLayersWith(nets[0].get());
+        }
+      }
+
+      vector<BenchmarkTimes> times(nthreads);
+      boost::barrier warmed_up(nthreads);
+      if (nthreads == 1) {
+        run_benchmark(nets[0].get(), receptors[0], ligands, 0, &warmed_up,
+            &times[0]);
+      } else {
+        boost::thread_group threads;
+        for (int i = 0; i < nthreads; ++i) {
+          threads.create_thread(boost::bind(&run_benchmark, nets[i].get(),
+              boost::cref(receptors[0]), boost::cref(ligands),
+              i * FLAGS_iterations, &warmed_up, &times[i]));
+        }
+        threads.join_all();
+      }
+      // the timed batches start together, so the slowest thread bounds them
+      double total_ms = 0;
+      for (int i = 0; i < nthreads; ++i) {
+        total_ms = std::max(total_ms, times[i].wall / 1000);
+      }
+
+      const long peak_rss = status_kb("VmHWM");
+
+      // per batch averages over all threads
+      const double batches = double(FLAGS_iterations) * nthreads;
+      const vector<shared_ptr<Layer<float> > >& layers = nets[0]->layers();
+      double gridding = 0, forward = 0, backward = 0;
+      vector<double> layer_forward(layers.size(), 0);
+      vector<double> layer_backward(layers.size(), 0);
+      for (int i = 0; i < nthreads; ++i) {
+        gridding += times[i].gridding;
+        for (int l = 0; l < layers.size(); ++l) {
+          layer_forward[l] += times[i].forward_per_layer[l];
+          layer_backward[l] += times[i].backward_per_layer[l];
+        }
+      }
+      for (int l = 0; l < layers.size(); ++l) {
+        forward += layer_forward[l];
+        backward += layer_backward[l];
+      }
+      json << (b || t ? "," : "") << "\n    {\"batch_size\": "
+          << batch_sizes[b] << ", \"threads\": " << nthreads
+          << ", \"poses_per_second\": "
+          << batches * batch_sizes[b] / (total_ms / 1000)
+          << ", \"gridding_ms\": " << gridding / 1000 / batches
+          << ", \"forward_ms\": " << forward / 1000 / batches
+          << ", \"backward_ms\": " << backward / 1000 / batches
+          << ", \"net_bytes\": " << allocated_bytes(*nets[0]);
+      if (peak_reset && start_rss >= 0 && peak_rss >= 0) {
+        json << ", \"peak_rss_delta_kb\": " << peak_rss - start_rss;
+      }
+#ifndef CPU_ONLY
+      if (gpus.size()) {
+        size_t free_bytes = 0, total_bytes = 0;
+        CUDA_CHECK(cudaMemGetInfo(&free_bytes, &total_bytes));
+        json << ", \"gpu_used_bytes\": " << total_bytes - free_bytes;
+      }
+#endif
+      json << ",\n     \"layers\": [";
+      for (int l = 1; l < layers.size(); ++l) {
+        json << (l > 1 ? "," : "") << "\n      {\"name\": \""
+            << layers[l]->layer_param().name() << "\", \"type\": \""
+            << layers[l]->type() << "\", \"forward_ms\": "
+            << layer_forward[l] / 1000 / batches << ", \"backward_ms\": "
+            << layer_backward[l] / 1000 / batches << "}";
+      }
+      json << "]}";
+    }
+  }
+  json << "\n  ]\n}\n";
+  return 0;
+}
+RegisterBrewFunction(benchmark);
+
+// Calibrate: choose the int8 input ranges of the Convolution and
+// InnerProduct layers from the activations of a sample of the model's data,
+// then report how far the quantized outputs are from fp32 on the batches
+// that follow.
+int calibrate() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to calibrate.";
+  CHECK_GT(FLAGS_quantization.size(), 0)
+      << "Need a file to write quantization parameters to.";
+  vector<string> stages = get_stages_from_flags();
+  // quantized layers only run on the CPU
+  LOG(INFO) << "Use CPU.";
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> caffe_net(FLAGS_model, caffe::TEST, FLAGS_level, &stages);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  const vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
+
+  vector<int> quantizable;
+  for (int i = 0; i < layers.size(); ++i) {
+    const string type = layers[i]->type();
+    if (type == "Convolution" || type == "InnerProduct") {
+      quantizable.push_back(i);
+    }
+  }
+  CHECK_GT(quantizable.size(), 0) << "Model has no layers to quantize.";
+
+  LOG(INFO) << "Calibrating for " << FLAGS_iterations << " iterations.";
+  vector<float> input_range(layers.size(), 0);
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    caffe_net.Forward();
+    for (int j = 0; j < quantizable.size(); ++j) {
+      const int l = quantizable[j];
+      const Blob<float>& input = *bottom_vecs[l][0];
+      const float* data = input.cpu_data();
+      for (int k = 0; k < input.count(); ++k) {
+        input_range[l] = std::max(input_range[l], std::fabs(data[k]));
+      }
+    }
+  }
+
+  NetParameter quantization;
+  for (int j = 0; j < quantizable.size(); ++j) {
+    const int l = quantizable[j];
+    LayerParameter* layer_param = quantization.add_layer();
+    layer_param->set_name(caffe_net.layer_names()[l]);
+    layer_param->set_type(layers[l]->type());
+    layer_param->mutable_quantization_param()->set_input_range(
+        input_range[l]);
+    LOG(INFO) << caffe_net.layer_names()[l] << " input range "
+        << input_range[l];
+  }
+  caffe::WriteProtoToTextFile(quantization, FLAGS_quantization);
+  LOG(INFO) << "Wrote quantization parameters to " << FLAGS_quantization;
+
+  // The quantized copy is fed the fp32 net's data layer outputs.
+  NetParameter quantized_param;
+  caffe_net.ToProto(&quantized_param);
+  quantized_param.mutable_state()->set_phase(caffe::TEST);
+  for (int j = 0; j < quantizable.size(); ++j) {
+    quantized_param.mutable_layer(quantizable[j])->mutable_quantization_param()
+        ->set_input_range(input_range[quantizable[j]]);
+  }
+  Net<float> quantized_net(quantized_param);
+  CHECK_EQ(quantized_net.layers().size(), layers.size());
+
+  LOG(INFO) << "Comparing against fp32 for " << FLAGS_iterations
+      << " iterations.";
+  const vector<Blob<float>*>& outputs = caffe_net.output_blobs();
+  const vector<Blob<float>*>& quantized_outputs =
+      quantized_net.output_blobs();
+  // per output: sum |d|, max |d|, and sums for the correlation
+  const int kStats = 7;
+  vector<vector<double> > stats(outputs.size(), vector<double>(kStats, 0));
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    caffe_net.Forward();
+    for (int l = 0; l < layers.size(); ++l) {
+      if (bottom_vecs[l].empty()) {
+        for (int t = 0; t < caffe_net.top_vecs()[l].size(); ++t) {
+          quantized_net.top_vecs()[l][t]->CopyFrom(
+              *caffe_net.top_vecs()[l][t], false, true);
+        }
+      } else {
+        quantized_net.ForwardFromTo(l, l);
+      }
+    }
+    for (int j = 0; j < outputs.size(); ++j) {
+      const float* x = outputs[j]->cpu_data();
+      const float* y = quantized_outputs[j]->cpu_data();
+      vector<double>& s = stats[j];
+      for (int k = 0; k < outputs[j]->count(); ++k) {
+        const double d = std::fabs(double(x[k]) - y[k]);
+        s[0] += d;
+        s[1] = std::max(s[1], d);
+        s[2] += x[k];
+        s[3] += y[k];
+        s[4] += double(x[k]) * x[k];
+        s[5] += double(y[k]) * y[k];
+        s[6] += double(x[k]) * y[k];
+      }
+    }
+  }
+  for (int j = 0; j < outputs.size(); ++j) {
+    const vector<double>& s = stats[j];
+    const double n = double(outputs[j]->count()) * FLAGS_iterations;
+    const double cov = s[6] / n - s[2] / n * s[3] / n;
+    const double var_x = s[4] / n - s[2] / n * s[2] / n;
+    const double var_y = s[5] / n - s[3] / n * s[3] / n;
+    const double denom = std::sqrt(var_x * var_y);
+    const std::string& output_name = caffe_net.blob_names()[
+        caffe_net.output_blob_indices()[j]];
+    LOG(INFO) << output_name << ": mean |int8 - fp32| = " << s[0] / n
+        << ", max = " << s[1] << ", correlation = "
+        << (denom > 0 ? cov / denom : 1.0);
+  }
+  return 0;
+}
+RegisterBrewFunction(calibrate);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -438,7 +918,9 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  benchmark       time a gnina model on receptor/ligand inputs\n"
+      "  calibrate       write int8 quantization parameters for a model");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
   if (argc == 2) {
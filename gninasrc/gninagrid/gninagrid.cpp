@@ -27,6 +27,7 @@
 #include "molgetter.h"
 
 #include "gridoptions.h"
+#include "caffe/util/parallel_for.hpp"
 
 
 using namespace std;
@@ -55,7 +56,11 @@ static bool parse_options(int argc, char *argv[], gridoptions& o) {
   ("map", bool_switch(&o.outmap),
       "output AD4 map files (for debugging, out is base name)")
   ("dx", bool_switch(&o.outdx),
-      "output DX map files (for debugging, out is base name)");
+      "output DX map files (for debugging, out is base name)")
+  ("batch", bool_switch(&o.batch),
+      "grid all ligands in parallel into a single out.gridbatch file")
+  ("compress", bool_switch(&o.compress),
+      "omit empty channels from --batch output");
 
   options_description options("Options");
   options.add_options()
@@ -71,7 +76,9 @@ static bool parse_options(int argc, char *argv[], gridoptions& o) {
   ("recmap", value<string>(&o.recmap), "Atom type mapping for receptor atoms")
   ("ligmap", value<string>(&o.ligmap), "Atom type mapping for ligand atoms")
   ("separate", bool_switch(&o.separate), "Output separate rec and lig files.")
-  ("gpu", bool_switch(&o.gpu), "Use GPU to compute grids");
+  ("gpu", bool_switch(&o.gpu), "Use GPU to compute grids")
+  ("cpu", value<unsigned>(&o.threads),
+      "Number of threads for --batch (default all cores)");
 
   options_description info("Information (optional)");
   info.add_options()("help", bool_switch(&o.help), "display usage summary")
@@ -119,8 +126,18 @@ int main(int argc, char *argv[]) {
     if (!parse_options(argc, argv, opt)) exit(0);
 
     srand(opt.seed);
+    if (opt.threads > 0) caffe::caffe_set_parallel_threads(opt.threads);
     MolGridder mgrid(opt); //initialize gridder
 
+    if (opt.batch) {
+      if (opt.outmap || opt.outdx || opt.separate) {
+        cerr << "--batch cannot be combined with --map, --dx or --separate\n";
+        exit(-1);
+      }
+      mgrid.outputBatch(opt.outname + ".gridbatch", opt.compress, opt.timeit);
+      return 0;
+    }
+
     //if separate, output receptor
     if(opt.separate) {
       if(!mgrid.has_set_center()) {
@@ -9,6 +9,8 @@
 #include <libmolgrid/cartesian_grid.h>
 #include <boost/timer/timer.hpp>
 #include <boost/lexical_cast.hpp>
+#include "caffe/util/parallel_for.hpp"
+#include <cstdint>
 
 
 using namespace std;
@@ -110,29 +112,34 @@ void MolGridder::setGrid(bool use_gpu) {
     current_transform.set_rotation_center(center);
   }
 
+  gridExample(ex, current_transform, grid, use_gpu);
+}
+
+void MolGridder::gridExample(const Example& e, const Transform& t,
+    MGrid4f& g, bool use_gpu) const {
   if(usergrids.size() > 0) { //not particularly optimized
     //copy into first so many channels
     unsigned n = usergrids.size();
 
     for(unsigned i = 0; i < n; i++) {
-      grid[i].copyFrom(usergrids[i].cpu());
+      g[i].copyFrom(usergrids[i].cpu());
     }
 
-    size_t offset = grid[0].size()*n;
+    size_t offset = g[0].size()*n;
     unsigned channels = rectyper->num_types()+ligtyper->num_types();
     if(use_gpu) {
-      Grid4fCUDA g(grid.gpu().data()+offset, channels, N, N, N);
-      gmaker.forward(ex, current_transform, g);
+      Grid4fCUDA sub(g.gpu().data()+offset, channels, N, N, N);
+      gmaker.forward(e, t, sub);
     } else {
-      Grid4f g(grid.cpu().data()+offset, channels, N, N, N);
-      gmaker.forward(ex, current_transform, g);
+      Grid4f sub(g.cpu().data()+offset, channels, N, N, N);
+      gmaker.forward(e, t, sub);
     }
   }
   else { //no user grids
     if(use_gpu) {
-      gmaker.forward(ex, current_transform, grid.gpu());
+      gmaker.forward(e, t, g.gpu());
     } else {
-      gmaker.forward(ex, current_transform, grid.cpu());
+      gmaker.forward(e, t, g.cpu());
     }
   }
 }
@@ -346,3 +353,146 @@ void MolGridder::outputBIN(const std::string& base, bool outputrec, bool outputl
     }
   }
 }
+
+/* Batch output is a single file that can be memory mapped:
+ *  header: "GNINAGRD", uint32 version (1), uint32 flags (1 if compressed),
+ *    uint64 number of molecules, uint64 offset of the index,
+ *    uint32 points per side, float resolution, uint32 channels, uint32 0,
+ *    then each channel name as uint32 length and characters, zero padded to
+ *    a multiple of 8 bytes
+ *  a chunk per molecule: float center x, y, z, uint32 stored channels;
+ *    if compressed, a byte per channel that is 1 if it is stored, zero padded
+ *    to a multiple of 4; then points^3 floats for each stored channel
+ *  index (8 byte aligned): uint64 offset of each molecule's chunk
+ */
+static const uint32_t batch_version = 1;
+
+static void write_padding(ostream& out, unsigned align) {
+  while (out.tellp() % align) out.put(0);
+}
+
+template <typename T>
+static void write_value(ostream& out, T v) {
+  out.write((const char*)&v, sizeof(v));
+}
+
+void MolGridder::outputBatch(const std::string& fname, bool compress,
+    bool timeit) {
+  ofstream out(fname.c_str(), ios::binary);
+  if (!out) {
+    throw file_error(fname, false);
+  }
+
+  vector<string> names;
+  for (unsigned i = 0, n = usergrids.size(); i < n; i++)
+    names.push_back("usergrid_" + boost::lexical_cast<string>(i));
+  for (const string& name : rectyper->get_type_names())
+    names.push_back("rec_" + name);
+  for (const string& name : ligtyper->get_type_names())
+    names.push_back("lig_" + name);
+  unsigned nchannels = names.size();
+
+  out.write("GNINAGRD", 8);
+  write_value<uint32_t>(out, batch_version);
+  write_value<uint32_t>(out, compress ? 1 : 0);
+  write_value<uint64_t>(out, 0); //count and index filled in at the end
+  write_value<uint64_t>(out, 0);
+  write_value<uint32_t>(out, N);
+  write_value<float>(out, resolution);
+  write_value<uint32_t>(out, nchannels);
+  write_value<uint32_t>(out, 0);
+  for (const string& name : names) {
+    write_value<uint32_t>(out, name.size());
+    out.write(name.c_str(), name.size());
+  }
+  write_padding(out, 8);
+
+  //molecules are read in order and gridded a block at a time, the block
+  //split between caffe's persistent threads, each molecule into its own grid
+  unsigned nthreads = gpu ? 1 : caffe::caffe_parallel_threads(); //one device, grid in order
+  struct slot {
+      Example e;
+      Transform t;
+      gfloat3 center;
+      MGrid4f g;
+  };
+  vector<slot> slots(4 * nthreads);
+  for (slot& s : slots)
+    s.g = MGrid4f(nchannels, N, N, N);
+
+  vector<uint64_t> index;
+  vector<unsigned char> present(nchannels);
+  boost::timer::cpu_timer t;
+  model m;
+  bool more = true;
+  while (more) {
+    unsigned n = 0;
+    while (n < slots.size() && (more = mols.readMoleculeIntoModel(m))) {
+      setLigand(m);
+      slot& s = slots[n++];
+      s.e = ex;
+      s.center = center_set ? center : ex.sets[1].center();
+      //random transformations are drawn here, in molecule order
+      if (random_translate > 0 || random_rotate) {
+        s.t = Transform(s.center, random_translate, random_rotate);
+      } else {
+        s.t = Transform();
+        s.t.set_rotation_center(s.center);
+      }
+    }
+
+    if (gpu) {
+      for (unsigned i = 0; i < n; i++)
+        gridExample(slots[i].e, slots[i].t, slots[i].g, gpu);
+    } else {
+      caffe::caffe_parallel_for(n, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+          gridExample(slots[i].e, slots[i].t, slots[i].g, false);
+      });
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      slot& s = slots[i];
+      index.push_back(out.tellp());
+      const float *data = s.g.cpu().data();
+      size_t chansize = N * N * N;
+      unsigned stored = 0;
+      for (unsigned c = 0; c < nchannels; c++) {
+        present[c] = 1;
+        if (compress) {
+          Grid3f chan(const_cast<float*>(data + c * chansize), N, N, N);
+          present[c] = !gridIsEmpty(chan);
+        }
+        stored += present[c];
+      }
+      write_value<float>(out, s.center.x);
+      write_value<float>(out, s.center.y);
+      write_value<float>(out, s.center.z);
+      write_value<uint32_t>(out, stored);
+      if (compress) {
+        out.write((const char*)&present[0], nchannels);
+        write_padding(out, 4);
+      }
+      for (unsigned c = 0; c < nchannels; c++) {
+        if (present[c])
+          out.write((const char*)(data + c * chansize), chansize * sizeof(float));
+      }
+    }
+  }
+
+  write_padding(out, 8);
+  uint64_t indexstart = out.tellp();
+  for (uint64_t offset : index)
+    write_value<uint64_t>(out, offset);
+  out.seekp(16);
+  write_value<uint64_t>(out, index.size());
+  write_value<uint64_t>(out, indexstart);
+  out.close();
+  if (!out) {
+    throw file_error(fname, false);
+  }
+
+  if (timeit) {
+    cout << "Grid Time: " << t.elapsed().wall << " for " << index.size() << " molecules\n";
+  }
+}
@@ -47,6 +47,10 @@ class MolGridder {
     void setLigand(const model& m);
     //set grid from example
     void setGrid(bool use_gpu);
+    //grid e with transform t into g, after any user grids
+    void gridExample(const libmolgrid::Example& e,
+        const libmolgrid::Transform& t, libmolgrid::MGrid4f& g,
+        bool use_gpu) const;
 
     //sets grid on cpu and compares to current
     void cpuSetGridCheck();
@@ -78,6 +82,11 @@ class MolGridder {
     //read a molecule (return false if unsuccessful)
     //set the ligand grid appropriately
     bool readMolecule(bool timeit);
+
+    //grid all remaining molecules on caffe_parallel_for's threads into a
+    //single file (format described in molgridder.cpp); with compress, all
+    //zero channels are not stored
+    void outputBatch(const std::string& fname, bool compress, bool timeit);
 };
 
 
@@ -5,12 +5,24 @@
  *      Author: dkoes
  *
  *  Converts a (single) molecule into a binary file of x,y,z,smina atom type (NOT cnn types)
+ *
+ *  Given any number of inputs and an output ending in .molcache2, converts
+ *  them all into a single molcache2 file (as read by recmolcache/ligmolcache)
+ *  instead, in parallel worker processes.  Molecules are named
+ *  input_N.gninatypes, or input.gninatypes for only the first molecule with
+ *  --single, where input is the file name without extension.
  */
 
 #include <iostream>
 #include <string>
 #include <algorithm>
 #include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
@@ -33,6 +45,181 @@ struct atom_info {
 	atom_info(float X, float Y, float Z, int T): x(X), y(Y), z(Z), type(T) {}
 };
 
+static void write_atoms(OBMol& mol, ostream& out)
+{
+	FOR_ATOMS_OF_MOL(a, mol)
+	{
+		smt t = obatom_to_smina_type(*a);
+		atom_info ainfo(a->x(), a->y(), a->z(), t);
+		out.write((char*)&ainfo, sizeof(ainfo));
+	}
+}
+
+//input file name without (possibly gzipped) extension
+static filesystem::path strip_extension(const string& fname, bool& issdf)
+{
+	filesystem::path p(fname);
+	if(algorithm::ends_with(fname,".gz"))
+		p.replace_extension("");
+	issdf = p.extension() == ".sdf";
+	p.replace_extension("");
+	return p;
+}
+
+//a worker's part file holds, for each of its inputs in order, the molecules
+//of that input as name length, name, atom count and atoms, ended by a zero
+//name length
+static void convert_to_part(const string& fname, bool single, ostream& out)
+{
+	OBConversion conv;
+	obmol_opener opener;
+	opener.openForInput(conv, fname);
+	bool issdf = false;
+	string base = strip_extension(fname, issdf).string();
+
+	OBMol mol;
+	int cnt = 0;
+	std::istream* in = conv.GetInStream();
+	while (*in && !(single && cnt > 0))
+	{
+		while ((!single || cnt == 0) && conv.Read(&mol))
+		{
+			mol.AddHydrogens();
+			string name = single ? base + ".gninatypes" : base + "_" + lexical_cast<string>(cnt) + ".gninatypes";
+			cnt++;
+			if (name.length() > 255) {
+				cerr << "Skipping " << name << ", name is too long for a molcache\n";
+				continue;
+			}
+			unsigned char len = name.length();
+			int32_t natoms = mol.NumAtoms();
+			out.put(len);
+			out.write(name.c_str(), len);
+			out.write((char*)&natoms, sizeof(natoms));
+			write_atoms(mol, out);
+		}
+		if (issdf && *in && !(single && cnt > 0))
+		{ //tolerate molecular errors
+			string line;
+			while (getline(*in, line))
+			{
+				if (line == "$$$$")
+					break;
+			}
+			if (*in) cerr << "Encountered invalid molecule " << cnt << " in " << fname << "; trying to recover\n";
+		}
+	}
+	if (cnt == 0) cerr << "No molecules read from " << fname << "\n";
+	out.put(0);
+}
+
+//convert inputs in nworkers forked processes, as OpenBabel's perception is
+//not thread safe, then merge their part files in input order
+static int write_molcache(const vector<string>& inputs, const string& outname,
+		unsigned nworkers, bool single)
+{
+	nworkers = std::max(1u, std::min<unsigned>(nworkers, inputs.size()));
+	vector<string> partnames(nworkers);
+	vector<pid_t> pids(nworkers);
+	for (unsigned w = 0; w < nworkers; w++)
+	{
+		partnames[w] = outname + ".part" + lexical_cast<string>(w);
+		pids[w] = fork();
+		if (pids[w] < 0) {
+			cerr << "Could not start worker process\n";
+			exit(1);
+		}
+		if (pids[w] == 0) {
+			ofstream part(partnames[w].c_str(), ios::binary);
+			if (!part) {
+				cerr << "Error opening output file " << partnames[w] << "\n";
+				_exit(1);
+			}
+			for (unsigned i = w; i < inputs.size(); i += nworkers)
+				convert_to_part(inputs[i], single, part);
+			part.close();
+			_exit(part ? 0 : 1);
+		}
+	}
+	bool failed = false;
+	for (unsigned w = 0; w < nworkers; w++)
+	{
+		int status = 0;
+		waitpid(pids[w], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = true;
+	}
+	if (failed) {
+		cerr << "Error converting molecules\n";
+		for (unsigned w = 0; w < nworkers; w++) remove(partnames[w].c_str());
+		exit(1);
+	}
+
+	//header is a version of -1 and the offset of the index
+	ofstream out(outname.c_str(), ios::binary);
+	if (!out) {
+		cerr << "Error opening output file " << outname << "\n";
+		exit(1);
+	}
+	int32_t version = -1;
+	uint64_t start = 0;
+	out.write((char*)&version, sizeof(version));
+	out.write((char*)&start, sizeof(start));
+
+	vector<std::unique_ptr<ifstream> > parts(nworkers);
+	for (unsigned w = 0; w < nworkers; w++)
+		parts[w].reset(new ifstream(partnames[w].c_str(), ios::binary));
+
+	vector<pair<string, uint64_t> > index;
+	boost::unordered_map<string, int> seen;
+	vector<atom_info> atoms;
+	for (unsigned i = 0; i < inputs.size(); i++)
+	{
+		ifstream& part = *parts[i % nworkers];
+		int len;
+		while ((len = part.get()) > 0)
+		{
+			string name(len, ' ');
+			int32_t natoms = 0;
+			part.read(&name[0], len);
+			part.read((char*)&natoms, sizeof(natoms));
+			atoms.resize(natoms);
+			part.read((char*)atoms.data(), natoms*sizeof(atom_info));
+			if (!part) break;
+			if (seen.count(name)) {
+				cerr << "Skipping duplicate molecule name " << name << "\n";
+				continue;
+			}
+			seen[name] = 1;
+			index.push_back(make_pair(name, (uint64_t)out.tellp()));
+			out.write((char*)&natoms, sizeof(natoms));
+			out.write((char*)atoms.data(), natoms*sizeof(atom_info));
+		}
+		if (len != 0) {
+			cerr << "Error reading converted molecules of " << inputs[i] << "\n";
+			exit(1);
+		}
+	}
+
+	//index of names and offsets at the end
+	start = out.tellp();
+	for (unsigned i = 0, n = index.size(); i < n; i++)
+	{
+		unsigned char len = index[i].first.length();
+		out.put(len);
+		out.write(index[i].first.c_str(), len);
+		out.write((char*)&index[i].second, sizeof(uint64_t));
+	}
+	out.seekp(sizeof(version));
+	out.write((char*)&start, sizeof(start));
+	out.close();
+	for (unsigned w = 0; w < nworkers; w++) remove(partnames[w].c_str());
+	if (!out) {
+		cerr << "Error writing " << outname << "\n";
+		exit(1);
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	OpenBabel::obErrorLog.StopLogging();
@@ -42,6 +229,29 @@ int main(int argc, char *argv[])
 		exit(-1);
 	}
 
+	if(algorithm::ends_with(argv[argc-1], ".molcache2"))
+	{
+		//gninatyper [-j workers] [--single] inputs... output.molcache2
+		unsigned nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+		bool single = false;
+		vector<string> inputs;
+		for (int i = 1; i < argc-1; i++)
+		{
+			string arg(argv[i]);
+			if (arg == "-j" && i+1 < argc-1)
+				nworkers = lexical_cast<unsigned>(argv[++i]);
+			else if (arg == "--single")
+				single = true;
+			else
+				inputs.push_back(arg);
+		}
+		if (inputs.size() == 0) {
+			cerr << "Need input files for " << argv[argc-1] << "\n";
+			exit(-1);
+		}
+		return write_molcache(inputs, argv[argc-1], nworkers, single);
+	}
+
 	OBConversion conv;
 	obmol_opener opener;
 	opener.openForInput(conv, argv[1]);
@@ -64,12 +274,7 @@ int main(int argc, char *argv[])
 			}
 			mol.AddHydrogens();
 
-			FOR_ATOMS_OF_MOL(a, mol)
-			{
-				smt t = obatom_to_smina_type(*a);
-				atom_info ainfo(a->x(), a->y(), a->z(), t);
-				out.write((char*)&ainfo, sizeof(ainfo));
-			}
+			write_atoms(mol, out);
 		}
 		else
 		{
@@ -94,12 +299,7 @@ int main(int argc, char *argv[])
 						cerr << "Error opening output file " << outname << "\n";
 						exit(1);
 					}
-					FOR_ATOMS_OF_MOL(a, mol)
-					{
-						smt t = obatom_to_smina_type(*a);
-						atom_info ainfo(a->x(), a->y(), a->z(), t);
-						out.write((char*)&ainfo, sizeof(ainfo));
-					}
+					write_atoms(mol, out);
 					out.close();
 					cnt++;
 				}
@@ -142,12 +342,7 @@ int main(int argc, char *argv[])
         molcnts[name]++;
         ofstream out(outname.c_str());
 
-        FOR_ATOMS_OF_MOL(a, mol)
-        {
-          smt t = obatom_to_smina_type(*a);
-          atom_info ainfo(a->x(), a->y(), a->z(), t);
-          out.write((char*)&ainfo, sizeof(ainfo));
-        }
+        write_atoms(mol, out);
         out.close();
         cnt++;
       }
@@ -8,6 +8,7 @@
 #include "cnn_visualization.hpp"
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/thread.hpp>
 #include "caffe/layers/molgrid_data_layer.hpp"
 #include "cnn_scorer.h"
 #include "molgetter.h"
@@ -156,9 +157,10 @@ void cnn_visualization::setup() {
 
   std::stringstream lig_stream(lig_string);
   unmodified_ligand = parse_ligand_stream_pdbqt("", lig_stream);
-  model temp_rec = unmodified_receptor;
+  unmodified_complex = unmodified_receptor;
+  unmodified_complex.append(unmodified_ligand);
+  model temp_rec = unmodified_complex;
 
-  temp_rec.append(unmodified_ligand);
   float aff, loss;
   if (visopts.target == "pose") {
     original_score = base_scorer.score(temp_rec, true, aff, loss);
@@ -201,40 +203,6 @@ void cnn_visualization::print() {
   std::cout << "verbose: " << visopts.verbose << "\n\n";
 }
 
-std::string cnn_visualization::modify_pdbqt(
-    const std::unordered_set<std::string> &atoms_to_remove, bool isRec) {
-  std::string mol_string;
-  OBMol mol;
-
-  if (isRec) {
-    mol_string = rec_string;
-    mol = rec_mol;
-  } else {
-    mol_string = lig_string;
-    mol = lig_mol;
-  }
-
-  std::stringstream ss;
-  std::stringstream mol_stream(mol_string);
-
-  ss << "ROOT\n";
-
-  bool list_ended = false;
-  std::string line;
-  while (std::getline(mol_stream, line)) {
-    if (boost::algorithm::starts_with(line, "ATOM")) {
-      if (atoms_to_remove.find(get_xyz(line)) == atoms_to_remove.end()) {
-        ss << line << '\n';
-      }
-    }
-  }
-
-  ss << "ENDROOT\n";
-  ss << "TORSDOF 0\n";
-
-  return ss.str();
-}
-
 //add hydrogens with openbabel, generate PDBQT
 //files for removal
 void cnn_visualization::process_molecules() {
@@ -285,71 +253,101 @@ void cnn_visualization::process_molecules() {
   cenCoords[2] = cen.GetZ();
 }
 
-//scores provided receptor string against unmodified ligand
-float cnn_visualization::score_modified_receptor(
-    const std::string &modified_rec_string) {
-  std::stringstream rec_stream(modified_rec_string);
-  std::stringstream lig_stream(lig_string);
-
-  model m = parse_receptor_pdbqt("", rec_stream);
-
-  CNNScorer cnn_scorer(cnnopts);
-
-  model l = parse_ligand_stream_pdbqt("", lig_stream);
-  m.append(l);
-
-  float aff, loss;
-  float score_val = cnn_scorer.score(m, true, aff, loss);
-
-  //use affinity instead of cnn score if required
-  if (visopts.target == "affinity") {
-    score_val = aff;
-  }
-
-  if (visopts.verbose) {
-    std::cout << "SCORE: " << score_val << '\n';
-  }
-
-  return score_val;
+//one scorer per thread, each scoring a batch of masked variants per
+//forward pass; every scorer holds its own network and mask_batch sized
+//grids, so only as many are made as nmasks keeps busy.  Index the atoms
+//of the unmodified complex as they are passed to the scorer so masks can
+//be given by coordinates; returns how many scorers to use for nmasks
+unsigned cnn_visualization::setup_masking(unsigned nmasks) {
+  cnn_options maskopts = cnnopts;
+  maskopts.mask_batch = std::max(visopts.mask_batch, 1U);
+  maskopts.forward_only = true;
+  unsigned nthreads = visopts.cpu;
+  if (nthreads == 0) nthreads = boost::thread::hardware_concurrency();
+  if (visopts.gpu > -1 || nthreads == 0) nthreads = 1; //one device
+  nthreads = std::min(nthreads,
+      std::max((nmasks + maskopts.mask_batch - 1) / maskopts.mask_batch, 1U));
+  while (mask_scorers.size() < nthreads)
+    mask_scorers.push_back(
+        caffe::shared_ptr<CNNScorer>(new CNNScorer(maskopts)));
+  if (rec_index.size() > 0 || lig_index.size() > 0) return nthreads;
+
+  //flexible, inflexible then fixed receptor atoms, then the ligand
+  const model& m = unmodified_complex;
+  const vecv& coords = m.coordinates();
+  sz ligbegin = m.ligands[0].node.begin;
+  unsigned idx = 0;
+  for (sz i = 0; i < ligbegin; i++)
+    rec_index[xyz_to_string<fl>(coords[i][0], coords[i][1], coords[i][2])] = idx++;
+  for (sz i = m.m_num_movable_atoms, n = coords.size(); i < n; i++)
+    rec_index[xyz_to_string<fl>(coords[i][0], coords[i][1], coords[i][2])] = idx++;
+  for (const atom& a : m.get_fixed_atoms())
+    rec_index[xyz_to_string<fl>(a.coords[0], a.coords[1], a.coords[2])] = idx++;
+  for (sz i = ligbegin; i < m.m_num_movable_atoms; i++)
+    lig_index[xyz_to_string<fl>(coords[i][0], coords[i][1], coords[i][2])] = i - ligbegin;
+  return nthreads;
 }
 
-//scores provided ligand string against unmodified ligand
-float cnn_visualization::score_modified_ligand(const std::string &mol_string) {
+//scores the unmodified complex once for each set of receptor (or ligand)
+//atoms left out, splitting the sets between the masking threads
+std::vector<float> cnn_visualization::score_masks(
+    const std::vector<std::unordered_set<std::string> > &masks, bool isRec) {
+  unsigned nthreads = setup_masking(masks.size());
+  const std::unordered_map<std::string, unsigned>& index =
+      isRec ? rec_index : lig_index;
+
+  //atoms that are not in the model (e.g. merged hydrogens) were never
+  //gridded, so leaving them out changes nothing
+  std::vector<std::vector<unsigned> > excluded(masks.size());
+  for (unsigned i = 0, n = masks.size(); i < n; i++) {
+    for (const std::string& xyz : masks[i]) {
+      auto found = index.find(xyz);
+      if (found != index.end()) excluded[i].push_back(found->second);
+    }
+  }
+
+  std::vector<float> scores(masks.size()), affinities(masks.size());
+  unsigned per = (masks.size() + nthreads - 1) / nthreads;
+  boost::thread_group threads;
+  for (unsigned t = 0; t < nthreads && t * per < masks.size(); t++) {
+    unsigned begin = t * per;
+    unsigned end = std::min<unsigned>(begin + per, masks.size());
+    auto work = [&, t, begin, end]() {
+      std::vector<std::vector<unsigned> > part(excluded.begin() + begin,
+          excluded.begin() + end), none;
+      std::vector<float> s, a;
+      model m = unmodified_complex;
+      mask_scorers[t]->score_masked(m, isRec ? part : none,
+          isRec ? none : part, s, a);
+      std::copy(s.begin(), s.end(), scores.begin() + begin);
+      std::copy(a.begin(), a.end(), affinities.begin() + begin);
+    };
+    if (nthreads == 1)
+      work(); //keep gpu scoring on this thread
+    else
+      threads.create_thread(work);
+  }
+  threads.join_all();
 
-  //check if any ATOM fields present (removed fragment might be whole
-  //molecule)
-  if (mol_string.find("ATOM") == std::string::npos) {
-    return 0;
-  }
-
-  std::stringstream lig_stream(mol_string);
-  std::stringstream rec_stream(rec_string);
-
-  model temp = unmodified_receptor;
-  static CNNScorer cnn_scorer; //share same scorer across all ligands
+  //use affinity instead of cnn score if required
+  if (visopts.target == "affinity") scores.swap(affinities);
 
-  static bool first = true;
-  if (first) {
-    cnn_scorer = CNNScorer(cnnopts);
-    first = false;
+  //a removed fragment might be the whole ligand
+  if (!isRec) {
+    for (unsigned i = 0, n = masks.size(); i < n; i++) {
+      bool all = true;
+      for (auto it = lig_map.begin(); all && it != lig_map.end(); ++it)
+        all = masks[i].count(it->first) > 0;
+      if (all) scores[i] = 0;
+    }
   }
-
-  model l = parse_ligand_stream_pdbqt("", lig_stream);
-  temp.append(l);
-
-  float aff, loss;
-  float score_val = cnn_scorer.score(temp, true, aff, loss);
   if (visopts.verbose) {
-    std::cout << "SCORE: " << score_val << '\n';
+    for (unsigned i = 0, n = scores.size(); i < n; i++)
+      std::cout << "SCORE: " << scores[i] << '\n';
   }
-
-  if (visopts.target == "pose") {
-    return score_val;
-  } else
-    if (visopts.target == "affinity") {
-      return aff;
-    }
+  return scores;
 }
+
 //map: xyz coordinates concatenated:scores
 void cnn_visualization::write_scores(
     std::unordered_map<std::string, float> scores, bool isRec,
@@ -549,26 +547,10 @@ void cnn_visualization::remove_residues() {
     }
   }
 
-  int res_count = residues.size();
-  int counter = 1;
-
+  std::vector<std::unordered_set<std::string> > masks;
   for (const auto& res : residues) {
-    if (!visopts.verbose) {
-      std::cout << "Scoring residues: " << counter << '/' << res_count << '\r'
-          << std::flush;
-      counter++;
-    }
-
-    mol_stream.clear();
-    mol_stream.str(mol_string);
-
     atoms_to_remove = res.second;
 
-    int counter = 0;
-    for (auto atom : atoms_to_remove) {
-      counter++;
-    }
-
     bool remove = true;
 
     if (!visopts.skip_bound_check) {
@@ -582,19 +564,22 @@ void cnn_visualization::remove_residues() {
     }
 
     if (remove) {
-      std::string modified_mol_string = modify_pdbqt(atoms_to_remove, true);
-
-      float score_val = score_modified_receptor(modified_mol_string);
-      float score_diff = original_score - score_val;
-      score_diff = score_diff / atoms_to_remove.size();
-
-      for (auto f : atoms_to_remove) {
-        score_diffs[f] = score_diff;
-      }
+      masks.push_back(atoms_to_remove);
     }
     atoms_to_remove.clear();
   }
 
+  if (!visopts.verbose) {
+    std::cout << "Scoring " << masks.size() << " residue masks" << std::flush;
+  }
+  std::vector<float> scores = score_masks(masks, true);
+  for (unsigned i = 0, n = masks.size(); i < n; i++) {
+    float score_diff = (original_score - scores[i]) / masks[i].size();
+    for (auto f : masks[i]) {
+      score_diffs[f] = score_diff;
+    }
+  }
+
   write_scores(score_diffs, true, "masking");
   std::cout << '\n';
 }
@@ -651,20 +636,12 @@ std::unordered_map<std::string, float> cnn_visualization::remove_each_atom() {
   std::string index_string;
   int atom_index;
   std::unordered_set<std::string> atoms_to_remove;
-  float score_val;
 
-  int counter = 1;
-  int num_atoms = lig_mol.NumAtoms();
+  std::vector<std::string> removed;
+  std::vector<std::unordered_set<std::string> > masks;
 
   while (std::getline(lig_stream, line)) {
     if (boost::algorithm::starts_with(line, "ATOM")) {
-      if (!visopts.verbose) {
-        std::cout << "Scoring individual atoms: " << counter << '/' << num_atoms
-            << '\r' << std::flush;
-        counter++;
-      }
-
-      std::string modified_mol_string;
       index_string = line.substr(6, 5);
       atom_index = std::stoi(index_string);
 
@@ -675,16 +652,22 @@ std::unordered_map<std::string, float> cnn_visualization::remove_each_atom() {
         atoms_to_remove.insert(xyz);
         add_adjacent_hydrogens(atoms_to_remove, false);
 
-        modified_mol_string = modify_pdbqt(atoms_to_remove, false);
-        score_val = score_modified_ligand(modified_mol_string);
-
-        score_diffs[xyz] = original_score - score_val;
+        removed.push_back(xyz);
+        masks.push_back(atoms_to_remove);
       }
 
       atoms_to_remove.clear();
     }
   }
 
+  if (!visopts.verbose) {
+    std::cout << "Scoring " << masks.size() << " atom masks" << std::flush;
+  }
+  std::vector<float> scores = score_masks(masks, false);
+  for (unsigned i = 0, n = removed.size(); i < n; i++) {
+    score_diffs[removed[i]] = original_score - scores[i];
+  }
+
   if (visopts.verbose) {
     //print index:type for debugging
     for (auto i = lig_mol.BeginAtoms(); i != lig_mol.EndAtoms(); ++i) {
@@ -908,7 +891,8 @@ std::unordered_map<std::string, float> cnn_visualization::remove_fragments(
     }
   }
 
-  int counter = 1; //stores current fragment number for progress output
+  std::vector<std::unordered_set<std::string> > masks;
+  std::vector<int> heavy_sizes;
 
   for (auto path = paths.begin(); path != paths.end(); ++path) //iterate through path lengths
       {
@@ -919,12 +903,6 @@ std::unordered_map<std::string, float> cnn_visualization::remove_fragments(
         {
       std::vector<int> bond_list = *bonds;
 
-      if (!visopts.verbose) {
-        std::cout << "Scoring fragments: " << counter << '/' << path_count
-            << '\r' << std::flush;
-        counter++;
-      }
-
       for (int i = 0; i < bond_list.size(); ++i) //iterate through bonds in path
           {
         RDKit::Bond bond = *(rdkit_mol.getBondWithIdx(bond_list[i]));
@@ -946,18 +924,24 @@ std::unordered_map<std::string, float> cnn_visualization::remove_fragments(
       int size_without_hydrogens = atoms_to_remove.size();
       add_adjacent_hydrogens(atoms_to_remove, false);
 
-      std::string modified_ligand = modify_pdbqt(atoms_to_remove, false);
-      float score = score_modified_ligand(modified_ligand);
-
-      for (auto atom : atoms_to_remove) {
-        score_diffs[atom] += (original_score - score) / size_without_hydrogens; //give each atom in removal equal portion of score difference
-        score_counts[atom] += 1;
-      }
+      heavy_sizes.push_back(size_without_hydrogens);
+      masks.push_back(atoms_to_remove);
       atoms_to_remove.clear(); //clear for next group of atoms to be removed
 
     }
   }
 
+  if (!visopts.verbose) {
+    std::cout << "Scoring " << masks.size() << " fragment masks" << std::flush;
+  }
+  std::vector<float> scores = score_masks(masks, false);
+  for (unsigned i = 0, n = masks.size(); i < n; i++) {
+    for (auto atom : masks[i]) {
+      score_diffs[atom] += (original_score - scores[i]) / heavy_sizes[i]; //give each atom in removal equal portion of score difference
+      score_counts[atom] += 1;
+    }
+  }
+
   std::unordered_map<std::string, float> avg_score_diffs;
   for (auto i = rdkit_mol.beginAtoms(); i != rdkit_mol.endAtoms(); ++i) {
     int r_index = (*i)->getIdx();
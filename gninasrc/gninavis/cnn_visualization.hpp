@@ -22,6 +22,8 @@ struct vis_options {
     bool skip_bound_check;
     bool zero_values;
     int gpu;
+    unsigned mask_batch; //masked variants per forward pass
+    unsigned cpu; //scoring threads for masking without a gpu, 0 for all cores
 
     bool outputdx;
     float box_size;
@@ -30,7 +32,7 @@ struct vis_options {
     vis_options()
         : frags_only(false), atoms_only(false), verbose(false),
             output_files(false), skip_bound_check(false), outputdx(false),
-            gpu(0), box_size(23.5), score_scale(10) {
+            gpu(0), mask_batch(32), cpu(0), box_size(23.5), score_scale(10) {
     }
 };
 
@@ -54,6 +56,12 @@ class cnn_visualization {
     vec center;
     model unmodified_receptor;
     model unmodified_ligand;
+    model unmodified_complex;
+    //atom indices as CNNScorer orders them, keyed by xyz string
+    std::unordered_map<std::string, unsigned> rec_index;
+    std::unordered_map<std::string, unsigned> lig_index;
+    //one per masking thread
+    std::vector<caffe::shared_ptr<CNNScorer> > mask_scorers;
     bool frags_only, atoms_only, verbose;
     double score_scale;
 
@@ -66,10 +74,9 @@ class cnn_visualization {
     void populate_coordinate_map(const std::string& molstring,
         std::unordered_map<std::string, int>& map);
     void process_molecules();
-    std::string modify_pdbqt(
-        const std::unordered_set<std::string> &atoms_to_remove, bool isRec);
-    float score_modified_receptor(const std::string &modified_rec_string);
-    float score_modified_ligand(const std::string &modified_lig_string);
+    unsigned setup_masking(unsigned nmasks);
+    std::vector<float> score_masks(
+        const std::vector<std::unordered_set<std::string> > &masks, bool isRec);
 
     float score(const std::string &molString, bool isRec);
     void write_scores(const std::unordered_map<std::string, float> scores,
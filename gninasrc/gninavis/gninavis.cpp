@@ -6,6 +6,7 @@
 #include "../lib/box.h"
 #include <vector>
 #include <boost/program_options.hpp>
+#include "caffe/util/parallel_for.hpp"
 
 int main(int argc, char* argv[]) {
   bool zero_values;
@@ -51,7 +52,11 @@ int main(int argc, char* argv[]) {
       bool_switch(&visopts.verbose)->default_value(false),
       "print full output, including removed atom lists")("gpu",
       value<int>(&visopts.gpu)->default_value(-1),
-      "gpu id for accelerated scoring")("vis_method",
+      "gpu id for accelerated scoring")("mask_batch",
+      value<unsigned>(&visopts.mask_batch)->default_value(32),
+      "masked variants scored per forward pass; each thread holds a grid batch this size")("cpu",
+      value<unsigned>(&visopts.cpu)->default_value(0),
+      "threads for masking without a gpu (default all cores, at most one per mask_batch masks)")("vis_method",
       value<std::string>(&vis_method)->default_value("masking"),
       "visualization method (lrp, masking, gradient, or all)")("target",
       value<std::string>(&visopts.target)->default_value("pose"),
@@ -112,6 +117,7 @@ int main(int argc, char* argv[]) {
 
   google::InitGoogleLogging(argv[0]);
   google::SetStderrLogging(2);
+  if (visopts.cpu > 0) caffe::caffe_set_parallel_threads(visopts.cpu);
 
   cnn_visualization vis = cnn_visualization(visopts, cnnopts, center);
 
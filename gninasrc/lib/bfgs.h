@@ -25,6 +25,7 @@
 
 #include "matrix.h"
 #include "conf_gpu.h"
+#include "telemetry.h"
 #include <numeric>
 #include <cuda_runtime.h>
 
@@ -77,6 +78,7 @@ fl fast_line_search(F& f, sz n, const Conf& x, const Change& g, const fl f0,
   const unsigned max_trials = 10;
   const fl multiplier = 0.5;
   fl alpha = 1;
+  TELEMETRY_COUNT(CountLineSearches);
 
   const fl pg = scalar_product(p, g, n);
 
@@ -112,6 +114,7 @@ fl accurate_line_search(F& f, sz n, const Conf& x, const Change& g, const fl f0,
   fl rhs1, rhs2, slope = 0, test, tmplam;
   const fl ALF = 1.0e-4;
   const fl FIRST = 1.0;
+  TELEMETRY_COUNT(CountLineSearches);
 
   slope = scalar_product(g, p, n);
   if (slope >= 0) {
@@ -391,6 +394,7 @@ fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
     }
   }
   VINA_U_FOR(step, params.maxiters) {
+    TELEMETRY_COUNT(CountBFGSIters);
     minus_mat_vec_product(h, g, p);
     fl f1 = 0;
     fl alpha;
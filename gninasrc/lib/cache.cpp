@@ -37,11 +37,12 @@ typedef boost::archive::text_oarchive oarchive;
 #include "cache.h"
 #include "file.h"
 #include "szv_grid.h"
+#include "random.h"
 
 cache::cache(const std::string& scoring_function_version_, const grid_dims& gd_,
     fl slope_)
     : scoring_function_version(scoring_function_version_), gd(gd_),
-        slope(slope_), grids(num_atom_types()) {
+        slope(slope_), precision(GridFP32), grids(num_atom_types()) {
 }
 
 fl cache::eval(const model& m, fl v) const { // needs m.coords
@@ -79,6 +80,55 @@ fl cache::eval_deriv(model& m, fl v, const grid& user_grid) const { // needs m.c
   return e;
 }
 
+bool cache::within(const model& m, fl margin) const {
+  VINA_FOR(i, m.num_movable_atoms()) {
+    if (m.atoms[i].is_hydrogen()) continue;
+    const vec& a_coords = m.coords[i];
+    VINA_FOR_IN(j, gd)
+      if (gd[j].n > 0)
+        if (a_coords[j] < gd[j].begin - margin
+            || a_coords[j] > gd[j].end + margin) return false;
+  }
+  return true;
+}
+
+sz cache::memory_bytes() const {
+  sz ret = 0;
+  VINA_FOR_IN(i, grids)
+    ret += grids[i].memory_bytes();
+  return ret;
+}
+
+void cache::max_deviation(const cache& other,
+    const std::vector<smt>& atom_types, sz samples, fl v, fl& energy_dev,
+    fl& gradient_dev) const {
+  energy_dev = 0;
+  gradient_dev = 0;
+  //fixed seed so that runs report the same points
+  rng generator(0);
+  const vec corner1(gd[0].begin, gd[1].begin, gd[2].begin);
+  const vec corner2(gd[0].end, gd[1].end, gd[2].end);
+  VINA_FOR_IN(i, atom_types) {
+    smt t = atom_types[i];
+    if (t >= grids.size() || is_hydrogen(t)) continue;
+    const grid& g = grids[t];
+    const grid& og = other.grids[t];
+    if (!g.initialized() || !og.initialized()) continue;
+    atom a;
+    a.sm = t;
+    a.charge = 1; //includes the charge dependent grid
+    VINA_FOR(s, samples) {
+      vec location = random_in_box(corner1, corner2, generator);
+      vec d(0, 0, 0), od(0, 0, 0);
+      fl e = g.evaluate(a, location, slope, v, &d);
+      fl oe = og.evaluate(a, location, other.slope, v, &od);
+      energy_dev = std::max(energy_dev, std::abs(e - oe));
+      VINA_FOR(j, 3)
+        gradient_dev = std::max(gradient_dev, std::abs(d[j] - od[j]));
+    }
+  }
+}
+
 template<class Archive>
 void cache::save(Archive& ar, const unsigned version) const {
   ar & scoring_function_version;
@@ -96,6 +146,9 @@ void cache::load(Archive& ar, const unsigned version) {
   if (!eq(gd_tmp, gd)) throw grid_dims_mismatch();
 
   ar & grids;
+  VINA_FOR_IN(i, grids)
+    if (grids[i].initialized() && grids[i].get_precision() != precision)
+      throw precision_mismatch();
 }
 
 void cache::populate(const model& m, const precalculate& p,
@@ -108,7 +161,8 @@ void cache::populate(const model& m, const precalculate& p,
     smt t = atom_types_needed[i];
     if (!grids[t].initialized()) {
       needed.push_back(t);
-      grids[t].init(gd, haschargeterms);
+      //16 bit grids are filled directly so no fl copy is ever allocated
+      grids[t].init(gd, haschargeterms, precision);
     }
   }
   if (needed.empty()) return;
@@ -125,9 +179,9 @@ void cache::populate(const model& m, const precalculate& p,
   szv_grid_cache igcache(m, cutoff_sqr);
   szv_grid ig(igcache, gd);
 
-  VINA_FOR(x, g.data.dim0()) {
-    VINA_FOR(y, g.data.dim1()) {
-      VINA_FOR(z, g.data.dim2()) {
+  VINA_FOR(x, gd[0].n + 1) {
+    VINA_FOR(y, gd[1].n + 1) {
+      VINA_FOR(z, gd[2].n + 1) {
         std::fill(affinities.begin(), affinities.end(), 0);
         std::fill(chargeaffinities.begin(), chargeaffinities.end(), 0);
         vec probe_coords;
@@ -166,12 +220,12 @@ void cache::populate(const model& m, const precalculate& p,
         VINA_FOR_IN(j, needed) {
           sz t = needed[j];
           assert(t < nat);
-          grids[t].data(x, y, z) = affinities[j]; //+ user_grid.evaluate_user(vec(x, y, z));
-          if (haschargeterms) grids[t].chargedata(x, y, z) =
-              chargeaffinities[j];
+          fl value = affinities[j];
           if (user_grid.initialized())
-            grids[t].data(x, y, z) += user_grid.evaluate_user(vec(x, y, z),
-                slope);
+            value += user_grid.evaluate_user(vec(x, y, z), slope);
+          grids[t].set(x, y, z, value);
+          if (haschargeterms) grids[t].set_charge(x, y, z,
+              chargeaffinities[j]);
         }
       }
     }
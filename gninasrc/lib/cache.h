@@ -37,16 +37,28 @@ struct grid_dims_mismatch : public cache_mismatch {
 };
 struct energy_mismatch : public cache_mismatch {
 };
+struct precision_mismatch : public cache_mismatch {
+};
 
 struct cache : public igrid {
     cache(const std::string& scoring_function_version_, const grid_dims& gd_,
         fl slope_);
     fl eval(const model& m, fl v) const; // needs m.coords // clean up
     fl eval_deriv(model& m, fl v, const grid& user_grid) const; // needs m.coords, sets m.minus_forces // clean up
+    bool within(const model& m, fl margin = 0.0001) const; //movable heavy atoms are inside the grid
 
     virtual void populate(const model& m, const precalculate& p,
         const std::vector<smt>& atom_types_needed, grid& user_grid,
         bool display_progress = true);
+    //grids populated from now on are stored at this precision
+    void set_precision(grid_precision p) {
+      precision = p;
+    }
+    sz memory_bytes() const;
+    //largest energy and gradient differences from other at sample points
+    void max_deviation(const cache& other,
+        const std::vector<smt>& atom_types, sz samples, fl v,
+        fl& energy_dev, fl& gradient_dev) const;
     virtual ~cache() {
     }
     ;
@@ -55,6 +67,7 @@ struct cache : public igrid {
     atomv atoms; // for verification
     grid_dims gd;
     fl slope; // does not get (de-)serialized
+    grid_precision precision;
     std::vector<grid> grids;
     friend class boost::serialization::access;
     friend class cache_gpu;
@@ -11,119 +11,480 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/fuse_layers.hpp"
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <boost/bind.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/weak_ptr.hpp>
+
 #include "cnn_data.h"
+#include "telemetry.h"
 
 using namespace caffe;
 using namespace std;
 
-//initialize from commandline options
-//throw error if missing required info
-CNNScorer::CNNScorer(const cnn_options& opts)
-    : mgrid(NULL), cnnopts(opts), mtx(new boost::recursive_mutex), current_center(NAN,NAN,NAN) {
+//trained parameters of one model, shared read-only by all its scorers
+struct CNNScorer::weight_store {
+    NetParameter param; //structure of the net, without parameter blobs
+    caffe::shared_ptr<Net<Dtype> > net; //owns the parameters, never run
+};
+
+//loaded weights by model; entries expire with the last scorer using them
+static boost::mutex weight_stores_mtx;
+static std::map<std::string, boost::weak_ptr<CNNScorer::weight_store> > weight_stores;
+
+caffe::shared_ptr<CNNScorer::weight_store> CNNScorer::get_weights(
+    const NetParameter& param, const cnn_options& opts) const {
+  string key = param.SerializeAsString() + '\0';
+  if (opts.cnn_weights.size() == 0)
+    key += "builtin:" + opts.cnn_model_name;
+  else
+    key += opts.cnn_weights;
+
+  boost::lock_guard<boost::mutex> guard(weight_stores_mtx);
+  caffe::shared_ptr<weight_store> store = weight_stores[key].lock();
+  if (store) return store;
+
+  store.reset(new weight_store);
+  store->param = param;
+  store->net.reset(new Net<Dtype>(param));
+  Net<Dtype>& wnet = *store->net;
+
+  //load weights
+  if (opts.cnn_weights.size() == 0) {
+    NetParameter wparam;
+
+    const unsigned char *weights = cnn_models[opts.cnn_model_name].weights;
+    unsigned int nbytes = cnn_models[opts.cnn_model_name].num_bytes;
+
+    google::protobuf::io::ArrayInputStream weightdata(weights,nbytes);
+    google::protobuf::io::CodedInputStream strm(&weightdata);
+    strm.SetTotalBytesLimit(INT_MAX, 536870912);
+    bool success = wparam.ParseFromCodedStream(&strm);
+    if (!success) throw usage_error("Error with default weights.");
+
+    wnet.CopyTrainedLayersFrom(wparam);
+  } else {
+    wnet.CopyTrainedLayersFrom(opts.cnn_weights);
+  }
 
-  if (cnnopts.cnn_scoring || cnnopts.cnn_refinement) {
-    NetParameter param;
+  if (opts.forward_only) {
+    //rebuild with normalization and activations folded into convolutions
+    NetParameter trained;
+    wnet.ToProto(&trained);
+    FuseInferenceLayers(trained, &store->param);
+    store->param.mutable_state()->set_phase(TEST);
+    store->net.reset(new Net<Dtype>(store->param));
+  }
+  for (int i = 0, n = store->param.layer_size(); i < n; i++)
+    store->param.mutable_layer(i)->clear_blobs();
+
+  //sync every copy now so concurrent readers never change the memory's state
+  const vector<caffe::shared_ptr<Blob<Dtype> > >& params = store->net->params();
+  for (unsigned i = 0, n = params.size(); i < n; i++) {
+    params[i]->cpu_data();
+    if (Caffe::mode() == Caffe::GPU) params[i]->gpu_data();
+  }
 
-    //load cnn model
-    if (cnnopts.cnn_model.size() == 0) {
-      if(cnn_models.count(cnnopts.cnn_model_name) == 0) {
-        throw usage_error("Invalid model name: "+cnnopts.cnn_model_name);
-      }
+  weight_stores[key] = store;
+  return store;
+}
 
-      const char *model = cnn_models[cnnopts.cnn_model_name].model;
-      google::protobuf::io::ArrayInputStream modeldata(model, strlen(model));
-      bool success = google::protobuf::TextFormat::Parse(&modeldata, &param);
-      if (!success) throw usage_error("Error with built-in cnn model "+cnnopts.cnn_model_name);
-      UpgradeNetAsNeeded("default", &param);
-    } else {
-      ReadNetParamsFromTextFileOrDie(cnnopts.cnn_model, &param);
+//helper threads shared by the ensembles of every scorer in the process, so
+//per-task and per-worker scorers do not each start their own
+struct ensemble_pool {
+    boost::mutex mtx;
+    boost::condition work;
+    std::deque<CNNScorer::ensemble_runner*> pending; //runs with unstarted members
+    unsigned max_threads; //including the threads calling run
+    unsigned num_threads; //helpers started so far
+
+    ensemble_pool()
+        : max_threads(std::max(boost::thread::hardware_concurrency(), 1u)),
+            num_threads(0) {
+    }
+    //never destroyed, so helpers blocked at exit do not wait on a dead pool
+    static ensemble_pool& get() {
+      static ensemble_pool* pool = new ensemble_pool;
+      return *pool;
+    }
+    void helper();
+};
+
+//evaluates the networks of an ensemble concurrently; the calling thread takes
+//members too, so a run completes even when every helper is busy.  Every
+//network but the first starts at the grid made by the first
+struct CNNScorer::ensemble_runner {
+    std::vector<Net<Dtype>*> nets;
+    bool backward;
+    //helpers take on the mode and device of the scorer
+    Caffe::Brew mode;
+    int device;
+    sz started; //guarded by the pool mutex
+    sz finished;
+    boost::condition done;
+
+    ensemble_runner(const std::vector<Net<Dtype>*>& nets, Caffe::Brew mode,
+        int device)
+        : nets(nets), backward(false), mode(mode), device(device), started(0),
+            finished(0) {
+    }
+    void run_member(sz i) const {
+      Net<Dtype>& n = *nets[i];
+      if (backward)
+        n.BackwardFromTo(n.layers().size() - 1, 1);
+      else
+        n.ForwardFrom(1);
+    }
+    //next member to run, called with the pool mutex held
+    sz claim(ensemble_pool& pool) {
+      sz i = started++;
+      if (started == nets.size())
+        pool.pending.erase(
+            std::find(pool.pending.begin(), pool.pending.end(), this));
+      return i;
+    }
+    void run(bool backward_) {
+      ensemble_pool& pool = ensemble_pool::get();
+      boost::mutex::scoped_lock lk(pool.mtx);
+      backward = backward_;
+      started = finished = 0;
+      pool.pending.push_back(this);
+      unsigned wanted = std::min<sz>(nets.size(), pool.max_threads) - 1;
+      while (pool.num_threads < wanted) {
+        boost::thread(boost::bind(&ensemble_pool::helper, &pool)).detach();
+        pool.num_threads++;
+      }
+      pool.work.notify_all();
+      while (started < nets.size()) {
+        sz i = claim(pool);
+        lk.unlock();
+        run_member(i);
+        lk.lock();
+        finished++;
+      }
+      while (finished < nets.size())
+        done.wait(lk);
     }
+};
+
+void ensemble_pool::helper() {
+  boost::mutex::scoped_lock lk(mtx);
+  while (true) {
+    while (pending.empty())
+      work.wait(lk);
+    CNNScorer::ensemble_runner& r = *pending.front();
+    sz i = r.claim(*this);
+    lk.unlock();
+    if (r.mode == Caffe::GPU) Caffe::SetDevice(r.device);
+    Caffe::set_mode(r.mode);
+    r.run_member(i);
+    lk.lock();
+    if (++r.finished == r.nets.size()) r.done.notify_one();
+  }
+}
 
-    param.mutable_state()->set_phase(TEST);
+void CNNScorer::set_max_threads(unsigned n) {
+  ensemble_pool& pool = ensemble_pool::get();
+  boost::mutex::scoped_lock lk(pool.mtx);
+  pool.max_threads = std::max(n, 1u);
+}
 
-    LayerParameter *first = param.mutable_layer(0);
-    mgridparam = first->mutable_molgrid_data_param();
-    if (mgridparam == NULL) {
-      throw usage_error("First layer of model must be MolGridData.");
-    }
-    mgridparam->set_inmemory(true);
-    mgridparam->set_subgrid_dim(opts.subgrid_dim);
+//molgrid settings that determine the grid made for a pose
+static string grid_signature(const MolGridDataParameter& p) {
+  MolGridDataParameter g;
+  g.set_batch_size(p.batch_size());
+  g.set_dimension(p.dimension());
+  g.set_resolution(p.resolution());
+  g.set_binary_occupancy(p.binary_occupancy());
+  g.set_recmap(p.recmap());
+  g.set_ligmap(p.ligmap());
+  g.set_mem_recmap(p.mem_recmap());
+  g.set_mem_ligmap(p.mem_ligmap());
+  g.set_radius_multiple(p.radius_multiple());
+  g.set_fixed_radius(p.fixed_radius());
+  g.set_use_covalent_radius(p.use_covalent_radius());
+  g.set_gaussian_radius_multiple(p.gaussian_radius_multiple());
+  g.set_radius_scaling(p.radius_scaling());
+  g.set_random_rotation(p.random_rotation());
+  g.set_random_translate(p.random_translate());
+  g.set_jitter(p.jitter());
+  g.set_spherical_mask(p.spherical_mask());
+  g.set_ignore_ligand(p.ignore_ligand());
+  g.set_fix_center_to_origin(p.fix_center_to_origin());
+  g.set_use_rec_center(p.use_rec_center());
+  return g.SerializeAsString();
+}
 
-    if (cnnopts.cnn_model.size() == 0) { //using built-in model, load reg maps
-      const char *recmap = cnn_models[cnnopts.cnn_model_name].recmap;
-      const char *ligmap = cnn_models[cnnopts.cnn_model_name].ligmap;
-      mgridparam->set_mem_recmap(recmap);
-      mgridparam->set_mem_ligmap(ligmap);
-    }
+//scoring only needs gradients with respect to the grid (and so the atoms),
+//never the weights; without param gradients their diffs are not allocated
+static void freeze_weights(Net<CNNScorer::Dtype>& net) {
+  const vector<caffe::shared_ptr<Layer<CNNScorer::Dtype> > >& layers = net.layers();
+  for (unsigned i = 0, n = layers.size(); i < n; i++) {
+    for (unsigned j = 0, nb = layers[i]->blobs().size(); j < nb; j++)
+      layers[i]->set_param_propagate_down(j, false);
+  }
+}
 
-    //set batch size to 1
-    unsigned bsize = 1;
-    //unless we have rotations, in which case do them all at once, which turns out isn't actually faster :-(
-    if (cnnopts.cnn_rotations > 0) {
-      //let user specify rotations
-      unsigned nrot = cnnopts.cnn_rotations;
-      mgridparam->set_random_rotation(true);
-      //I think there's a bug in the axial rotations - they aren't all distinct
-      //BUT it turns out this isn't actually faster
-      //bsize = nrot;
-    } else {
-      mgridparam->set_random_rotation(false);
-      mgridparam->set_random_translate(0);
+//check that network matches our expectations and return its grid layer
+static MolGridDataLayer<CNNScorer::Dtype>* check_net(
+    const Net<CNNScorer::Dtype>& net, unsigned bsize) {
+  //the first layer must be MolGridLayer
+  const vector<caffe::shared_ptr<Layer<CNNScorer::Dtype> > >& layers = net.layers();
+  MolGridDataLayer<CNNScorer::Dtype> *mgrid =
+      dynamic_cast<MolGridDataLayer<CNNScorer::Dtype>*>(layers[0].get());
+  if (mgrid == NULL) {
+    throw usage_error("First layer of model must be MolGridDataLayer.");
+  }
+
+  //we also need an output layer
+  if (layers.size() < 1) {
+    throw usage_error("No layers in model!");
+  }
+
+  if (!net.has_blob("output")) {
+    throw usage_error("Model must have output layer named \"output\".");
+  }
+  if (!net.has_blob("loss")) {
+    throw usage_error("Model must have loss calculation layer named \"loss\" (to compute gradient for optimization).");
+  }
+  if (net.blob_by_name("output")->count() != 2 * bsize) {
+    throw usage_error(
+        "Model output layer does not have exactly two outputs.");
+  }
+  return mgrid;
+}
+
+//network of the model selected by opts, set up to score poses from memory
+NetParameter CNNScorer::get_param(const cnn_options& opts) const {
+  NetParameter param;
+
+  //load cnn model
+  if (opts.cnn_model.size() == 0) {
+    if(cnn_models.count(opts.cnn_model_name) == 0) {
+      throw usage_error("Invalid model name: "+opts.cnn_model_name);
     }
 
-    param.set_force_backward(true);
+    const char *model = cnn_models[opts.cnn_model_name].model;
+    google::protobuf::io::ArrayInputStream modeldata(model, strlen(model));
+    bool success = google::protobuf::TextFormat::Parse(&modeldata, &param);
+    if (!success) throw usage_error("Error with built-in cnn model "+opts.cnn_model_name);
+    UpgradeNetAsNeeded("default", &param);
+  } else {
+    ReadNetParamsFromTextFileOrDie(opts.cnn_model, &param);
+  }
 
-    net.reset(new Net<Dtype>(param));
+  param.mutable_state()->set_phase(TEST);
 
-    //load weights
-    if (cnnopts.cnn_weights.size() == 0) {
-      NetParameter wparam;
+  LayerParameter *first = param.mutable_layer(0);
+  MolGridDataParameter *mgridparam = first->mutable_molgrid_data_param();
+  if (mgridparam == NULL) {
+    throw usage_error("First layer of model must be MolGridData.");
+  }
+  mgridparam->set_inmemory(true);
+  mgridparam->set_subgrid_dim(opts.subgrid_dim);
+
+  if (opts.cnn_model.size() == 0) { //using built-in model, load reg maps
+    const char *recmap = cnn_models[opts.cnn_model_name].recmap;
+    const char *ligmap = cnn_models[opts.cnn_model_name].ligmap;
+    mgridparam->set_mem_recmap(recmap);
+    mgridparam->set_mem_ligmap(ligmap);
+  }
 
-      const unsigned char *weights = cnn_models[cnnopts.cnn_model_name].weights;
-      unsigned int nbytes = cnn_models[cnnopts.cnn_model_name].num_bytes;
+  //set batch size to 1
+  unsigned bsize = max(opts.mask_batch, 1U);
+  //unless we have rotations, in which case each is a differently rotated
+  //copy of the pose in a single batch
+  if (opts.cnn_rotations > 0) {
+    if (opts.mask_batch > 1)
+      throw usage_error("Batched masking is incompatible with cnn_rotation.");
+    bsize = opts.cnn_rotations;
+    mgridparam->set_random_rotation(true);
+  } else {
+    mgridparam->set_random_rotation(false);
+    mgridparam->set_random_translate(0);
+  }
+  mgridparam->set_batch_size(bsize);
 
-      google::protobuf::io::ArrayInputStream weightdata(weights,nbytes);
-      google::protobuf::io::CodedInputStream strm(&weightdata);
-      strm.SetTotalBytesLimit(INT_MAX, 536870912);
-      bool success = wparam.ParseFromCodedStream(&strm);
-      if (!success) throw usage_error("Error with default weights.");
+  if (opts.forward_only) {
+    if (opts.outputxyz || opts.outputdx || opts.gradient_check)
+      throw usage_error("CNN gradient output requires backward passes.");
+    //without forced backward no layer needs backward and diff blobs are never allocated
+    param.set_force_backward(false);
+  } else {
+    param.set_force_backward(true);
+  }
 
-      net->CopyTrainedLayersFrom(wparam);
-    } else {
-      net->CopyTrainedLayersFrom(cnnopts.cnn_weights);
+  //molecular grids are mostly empty, so the first convolution can skip
+  //empty rows; its input gradient is then only valid where atoms are,
+  //which is all that is needed unless the grid gradient is written out
+  if (!opts.outputdx) {
+    for (int i = 0, n = param.layer_size(); i < n; i++) {
+      if (param.layer(i).type() == "Convolution") {
+        param.mutable_layer(i)->mutable_convolution_param()->set_sparse_input(true);
+        break;
+      }
     }
+  }
+  return param;
+}
 
-    //check that network matches our expectations
-    //the first layer must be MolGridLayer
-    const vector<caffe::shared_ptr<Layer<Dtype> > >& layers = net->layers();
-    mgrid = dynamic_cast<MolGridDataLayer<Dtype>*>(layers[0].get());
-    if (mgrid == NULL) {
-      throw usage_error("First layer of model must be MolGridDataLayer.");
+//add a network that is run on the grid made by the first one
+void CNNScorer::add_ensemble_member(const cnn_options& opts) {
+  caffe::shared_ptr<weight_store> w = get_weights(get_param(opts), opts);
+  caffe::shared_ptr<Net<Dtype> > member(new Net<Dtype>(w->param));
+  member->ShareTrainedLayersWith(w->net.get());
+  freeze_weights(*member);
+
+  const MolGridDataLayer<Dtype>* mgrid_member =
+      check_net(*member, mgrid->layer_param().molgrid_data_param().batch_size());
+  if (grid_signature(mgrid_member->layer_param().molgrid_data_param()) !=
+      grid_signature(mgrid->layer_param().molgrid_data_param()))
+    throw usage_error("CNN ensemble models must use the same grid dimension, resolution and atom typing.");
+
+  if (opts.forward_only) member->PlanInferenceMemory();
+
+  //read the first network's grid; gradients stay separate
+  const vector<Blob<Dtype>*>& grids = net->top_vecs()[0];
+  const vector<Blob<Dtype>*>& member_grids = member->top_vecs()[0];
+  CHECK_EQ(grids.size(), member_grids.size());
+  for (unsigned i = 0, n = grids.size(); i < n; i++)
+    member_grids[i]->ShareData(*grids[i]);
+
+  member_weights.push_back(w);
+  members.push_back(member);
+}
+
+//initialize from commandline options
+//throw error if missing required info
+CNNScorer::CNNScorer(const cnn_options& opts)
+    : score_var(0), affinity_var(0), mgrid(NULL), cnnopts(opts), mtx(new boost::recursive_mutex), current_center(NAN,NAN,NAN) {
+
+  if (cnnopts.cnn_scoring || cnnopts.cnn_refinement) {
+    NetParameter param = get_param(cnnopts);
+    unsigned bsize = max(max(cnnopts.cnn_rotations, cnnopts.mask_batch), 1U);
+
+    bool ensemble = cnnopts.ensemble_names.size() > 0 || cnnopts.ensemble_models.size() > 0;
+    if (cnnopts.ensemble_models.size() != cnnopts.ensemble_weights.size())
+      throw usage_error("Each CNN ensemble model needs a weights file.");
+    if (ensemble && (cnnopts.outputdx || cnnopts.gradient_check))
+      throw usage_error("CNN grid gradient output and checks are not supported for ensembles.");
+    if (ensemble && cnnopts.cache_receptor_conv)
+      throw usage_error("Receptor convolution caching is not supported for CNN ensembles.");
+
+    if (cnnopts.cnn_quantization.size() > 0) {
+      //quantized layers have no backward pass
+      if (!cnnopts.forward_only)
+        throw usage_error("CNN quantization is only supported when scoring without gradients.");
+      if (ensemble)
+        throw usage_error("CNN quantization is not supported for ensembles.");
+      //quantized layers only have CPU forward passes
+      if (Caffe::mode() == Caffe::GPU)
+        throw usage_error("CNN quantization is not supported on the GPU.");
+      NetParameter qparam;
+      if (!ReadProtoFromTextFile(cnnopts.cnn_quantization, &qparam))
+        throw usage_error("Could not read CNN quantization parameters from "+cnnopts.cnn_quantization);
+      for (int i = 0, n = qparam.layer_size(); i < n; i++) {
+        const LayerParameter& qlayer = qparam.layer(i);
+        int l = 0, nl = param.layer_size();
+        while (l < nl && param.layer(l).name() != qlayer.name())
+          l++;
+        if (l == nl)
+          throw usage_error("Quantized layer "+qlayer.name()+" is not in the CNN model.");
+        param.mutable_layer(l)->mutable_quantization_param()->CopyFrom(qlayer.quantization_param());
+      }
     }
 
-    //we also need an output layer
-    if (layers.size() < 1) {
-      throw usage_error("No layers in model!");
+    //this scorer's activations, bound to the weights of every other scorer
+    //built from the same model
+    weights = get_weights(param, cnnopts);
+    net.reset(new Net<Dtype>(weights->param));
+    net->ShareTrainedLayersWith(weights->net.get());
+    freeze_weights(*net);
+    mgrid = check_net(*net, bsize);
+
+    if (cnnopts.forward_only) {
+      //intermediate activations are dead once the next layers have read them
+      net->PlanInferenceMemory();
     }
 
-    if (!net->has_blob("output")) {
-      throw usage_error("Model must have output layer named \"output\".");
+    if (cnnopts.cache_receptor_conv) {
+      //random rotations change the receptor grid on every evaluation
+      if (cnnopts.cnn_rotations > 0)
+        throw usage_error("Receptor convolution caching is incompatible with cnn_rotation.");
+      rcache.reset(new ReceptorConvCache(*net, mgrid->getNumReceptorChannels()));
     }
-    if (!net->has_blob("loss")) {
-      throw usage_error("Model must have loss calculation layer named \"loss\" (to compute gradient for optimization).");
-    }  
-    if (net->blob_by_name("output")->count() != 2 * bsize) {
-      throw usage_error(
-          "Model output layer does not have exactly two outputs.");
+
+    if (ensemble) {
+      cnn_options member = cnnopts;
+      member.ensemble_names.clear();
+      member.ensemble_models.clear();
+      member.ensemble_weights.clear();
+      member.cnn_quantization.clear();
+      for (unsigned i = 0, n = cnnopts.ensemble_names.size(); i < n; i++) {
+        member.cnn_model_name = cnnopts.ensemble_names[i];
+        member.cnn_model.clear();
+        member.cnn_weights.clear();
+        add_ensemble_member(member);
+      }
+      for (unsigned i = 0, n = cnnopts.ensemble_models.size(); i < n; i++) {
+        member.cnn_model = cnnopts.ensemble_models[i];
+        member.cnn_weights = cnnopts.ensemble_weights[i];
+        add_ensemble_member(member);
+      }
+
+      std::vector<Net<Dtype>*> nets(1, net.get());
+      for (unsigned i = 0, n = members.size(); i < n; i++)
+        nets.push_back(members[i].get());
+      int device = 0;
+      if (Caffe::mode() == Caffe::GPU) cudaGetDevice(&device);
+      runner.reset(new ensemble_runner(nets, Caffe::mode(), device));
     }
   }
 
 }
 
+//grid once with the first network, then run every network on that grid
+void CNNScorer::forward_ensemble() {
+  net->ForwardTo(0);
+  //sync the shared grid before the helper threads read it
+  const vector<Blob<Dtype>*>& grids = net->top_vecs()[0];
+  for (unsigned i = 0, n = grids.size(); i < n; i++) {
+    if (Caffe::mode() == Caffe::GPU)
+      grids[i]->gpu_data();
+    else
+      grids[i]->cpu_data();
+  }
+  runner->run(false);
+}
+
+//the grid gradient of the mean output is the mean of the networks' grid
+//gradients; atom gradients are then computed once from it
+void CNNScorer::backward_ensemble() {
+  runner->run(true);
+  Blob<Dtype>* grid = net->top_vecs()[0][0];
+  const int count = grid->count();
+  const Dtype scale = Dtype(1) / ensemble_size();
+  if (Caffe::mode() == Caffe::GPU) {
+    Dtype* diff = grid->mutable_gpu_diff();
+    for (unsigned i = 0, n = members.size(); i < n; i++)
+      caffe_gpu_axpy(count, Dtype(1), members[i]->top_vecs()[0][0]->gpu_diff(), diff);
+    caffe_gpu_scal(count, scale, diff);
+  } else {
+    Dtype* diff = grid->mutable_cpu_diff();
+    for (unsigned i = 0, n = members.size(); i < n; i++)
+      caffe_axpy(count, Dtype(1), members[i]->top_vecs()[0][0]->cpu_diff(), diff);
+    caffe_scal(count, scale, diff);
+  }
+  net->BackwardFromTo(0, 0);
+}
+
 //returns gradient scores per atom
 //assumes necessary pass (backward or backward_relevance) has already been done
 std::unordered_map<string, float> CNNScorer::get_gradient_norm_per_atom(bool receptor) {
@@ -289,20 +650,66 @@ void CNNScorer::set_center_from_model(model& m) {
 }
 
 
-//populate score and aff with current network output
+//populate score and aff with current network output, averaged over the
+//batch of rotations and over the networks of an ensemble
 void CNNScorer::get_net_output(Dtype& score, Dtype& aff, Dtype& loss) {
-  const caffe::shared_ptr<Blob<Dtype> > outblob = net->blob_by_name("output");
-  const caffe::shared_ptr<Blob<Dtype> > lossblob = net->blob_by_name("loss");
-  const caffe::shared_ptr<Blob<Dtype> > affblob = net->blob_by_name("predaff");
+  get_net_output(*net, score, aff, loss);
+  score_var = affinity_var = 0;
+  if (members.empty()) return;
+
+  vector<Dtype> scores(1, score), affs;
+  if (has_affinity()) affs.push_back(aff);
+  for (unsigned i = 0, n = members.size(); i < n; i++) {
+    Dtype s = 0, a = 0, l = 0;
+    get_net_output(*members[i], s, a, l);
+    scores.push_back(s);
+    if (members[i]->has_blob("predaff")) affs.push_back(a);
+    loss += l;
+  }
+  loss /= scores.size();
+
+  //mean and variance over the networks
+  score = aff = 0;
+  for (unsigned i = 0, n = scores.size(); i < n; i++)
+    score += scores[i];
+  score /= scores.size();
+  for (unsigned i = 0, n = scores.size(); i < n; i++)
+    score_var += (scores[i] - score) * (scores[i] - score);
+  score_var /= scores.size();
+  if (affs.size() > 0) {
+    for (unsigned i = 0, n = affs.size(); i < n; i++)
+      aff += affs[i];
+    aff /= affs.size();
+    for (unsigned i = 0, n = affs.size(); i < n; i++)
+      affinity_var += (affs[i] - aff) * (affs[i] - aff);
+    affinity_var /= affs.size();
+  }
+}
+
+//output of a single network, averaged over the batch of rotations
+void CNNScorer::get_net_output(Net<Dtype>& cnn, Dtype& score, Dtype& aff,
+    Dtype& loss) const {
+  const caffe::shared_ptr<Blob<Dtype> > outblob = cnn.blob_by_name("output");
+  const caffe::shared_ptr<Blob<Dtype> > lossblob = cnn.blob_by_name("loss");
+  const caffe::shared_ptr<Blob<Dtype> > affblob = cnn.blob_by_name("predaff");
 
   const Dtype* out = outblob->cpu_data();
-  score = out[1];
+  const Dtype* affs = affblob ? affblob->cpu_data() : NULL;
+  unsigned n = outblob->shape(0);
+  score = 0.0;
   aff = 0.0;
-  if (affblob) {
-    aff = affblob->cpu_data()[0];
+  for (unsigned i = 0; i < n; i++) {
+    score += out[2 * i + 1];
+    if (affs) aff += affs[i];
+    if (cnnopts.cnn_rotations > 1) {
+      std::cout << "RotateScore: " << out[2 * i + 1] << "\n";
+      if (affs && affs[i]) std::cout << "RotateAff: " << affs[i] << "\n";
+    }
   }
+  score /= n;
+  aff /= n;
 
-  loss = lossblob->cpu_data()[0];
+  loss = lossblob->cpu_data()[0]; //already normalized by batch size
 }
 
 // Extract ligand atoms and coordinates
@@ -425,16 +832,30 @@ void CNNScorer::setReceptor(const model& m){
 }
 
 // Get ligand (and flexible receptor) gradient
+// Gradients of all rotations in the batch are summed; since the loss is
+// normalized by batch size this is their average
 void CNNScorer::getGradient(){
   gradient.reserve(ligand_coords.size() + num_flex_atoms);
 
   // Get ligand gradient
   mgrid->getLigandGradient(0, gradient);
+  std::vector<gfloat3> gradient_rot;
+  for (unsigned b = 1, n = max(cnnopts.cnn_rotations, 1U); b < n; b++) {
+    mgrid->getLigandGradient(b, gradient_rot);
+    for (unsigned i = 0, na = gradient.size(); i < na; i++)
+      gradient[i] += gradient_rot[i];
+  }
 
   // Get receptor gradient
   std::vector<gfloat3> gradient_rec;
   if (num_flex_atoms != 0) { // Optimization of flexible residues
     mgrid->getReceptorGradient(0, gradient_rec);
+    for (unsigned b = 1, n = max(cnnopts.cnn_rotations, 1U); b < n; b++) {
+      gradient_rot.clear();
+      mgrid->getReceptorGradient(b, gradient_rot);
+      for (unsigned i = 0, na = gradient_rec.size(); i < na; i++)
+        gradient_rec[i] += gradient_rot[i];
+    }
   }
 
   // Merge ligand and flexible residues gradient
@@ -453,6 +874,7 @@ float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
     float& loss) {
   boost::lock_guard<boost::recursive_mutex> guard(*mtx);
   if (!initialized()) return -1.0;
+  CHECK(!(compute_gradient && cnnopts.forward_only)) << "CNN gradient requested from forward only network";
 
   caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
 
@@ -491,53 +913,71 @@ float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
     }
   }
 
+  bool receptor_gradient = false;
   if(compute_gradient || cnnopts.outputxyz) {
     mgrid->enableLigandGradients();
     if(cnnopts.moving_receptor() || cnnopts.outputxyz){
       mgrid->enableReceptorGradients();
+      receptor_gradient = true;
     }
     else if(num_flex_atoms != 0){
       mgrid->enableReceptorGradients(); // rmeli: TODO flexres gradients only
+      receptor_gradient = true;
     }
   }
 
+  if (rcache) {
+    rcache->set_receptor(mgrid->getGridCenter(), m.rec_conf.position,
+        m.rec_conf.orientation, receptor_coords, receptor_smtypes);
+  }
+
   m.clear_minus_forces();
-  double score = 0.0;
-  affinity = 0.0;
-  loss = 0.0;
-  Dtype s = 0.0;
+  Dtype score = 0.0;
   Dtype a = 0.0;
   Dtype l = 0.0;
 
-  unsigned cnt = 0;
   mgrid->setLabels(1); //for now pose optimization only
-  for (unsigned r = 0, n = max(cnnopts.cnn_rotations, 1U); r < n; r++) {
-    net->Forward(); //do all rotations at once if requested
-    get_net_output(s, a, l);
-    score += s;
-    affinity += a;
-    loss += l;
-
-    if (cnnopts.cnn_rotations > 1) {
-      std::cout << "RotateScore: " << s << "\n";
-      if (a) std::cout << "RotateAff: " << a << "\n";
-    }
+  {
+    TELEMETRY_PHASE(forward_timer, PhaseCNNForward);
+    if (rcache)
+      rcache->Forward();
+    else if (runner)
+      forward_ensemble();
+    else
+      net->Forward(); //all rotations are in one batch
+  }
+  get_net_output(score, a, l);
+  affinity = a;
+  loss = l;
 
-    if (compute_gradient || cnnopts.outputxyz) {
+  if (compute_gradient || cnnopts.outputxyz) {
 
-      net->Backward();
+    {
+      TELEMETRY_PHASE(backward_timer, PhaseCNNBackward);
+      if (rcache)
+        rcache->Backward(receptor_gradient);
+      else if (runner)
+        backward_ensemble();
+      else
+        net->Backward();
+    }
 
-      // Get gradient from mgrid into CNNScorer::gradient
-      getGradient();
+    // Get gradient from mgrid into CNNScorer::gradient
+    getGradient();
 
-      // Update ligand (and flexible residues) gradient
-      m.add_minus_forces(gradient);
+    // Update ligand (and flexible residues) gradient
+    m.add_minus_forces(gradient);
 
-      // Gradient for rigid receptor transformation: translation and torque
-      if(cnnopts.moving_receptor())
-        mgrid->getReceptorTransformationGradient(0, m.rec_change.position, m.rec_change.orientation);
+    // Gradient for rigid receptor transformation: translation and torque
+    if(cnnopts.moving_receptor()) {
+      mgrid->getReceptorTransformationGradient(0, m.rec_change.position, m.rec_change.orientation);
+      for (unsigned b = 1, n = max(cnnopts.cnn_rotations, 1U); b < n; b++) {
+        vec force, torque;
+        mgrid->getReceptorTransformationGradient(b, force, torque);
+        m.rec_change.position += force;
+        m.rec_change.orientation += torque;
+      }
     }
-    cnt++;
   }
 
   if (cnnopts.outputxyz) {
@@ -564,18 +1004,86 @@ float CNNScorer::score(model& m, bool compute_gradient, float& affinity,
     outputDX(m.get_name());
   }
 
-  //if there were rotations, scale appropriately
-  if (cnt > 1) {
-    m.scale_minus_forces(1.0 / cnt);
-  }
-  affinity /= cnt;
-  loss /= cnt;
-
   if (cnnopts.verbose)
     std::cout << std::fixed << std::setprecision(10) << "cnnscore "
-        << score / cnt << "\n";
+        << score << "\n";
+
+  return score;
+}
+
+//score m once for every set of excluded atoms, as many per forward pass as
+//the batch holds; receptor indices follow flexible, inflexible then fixed
+//receptor atoms and ligand indices the ligand atoms of m
+void CNNScorer::score_masked(model& m,
+    const std::vector<std::vector<unsigned> >& rec_excluded,
+    const std::vector<std::vector<unsigned> >& lig_excluded,
+    std::vector<float>& scores, std::vector<float>& affinities) {
+  boost::lock_guard<boost::recursive_mutex> guard(*mtx);
+  scores.clear();
+  affinities.clear();
+  if (!initialized()) return;
+  if (rcache)
+    throw usage_error("Masked scoring is not supported with receptor convolution caching.");
+  if (cnnopts.cnn_rotations > 0)
+    throw usage_error("Masked scoring is incompatible with cnn_rotation.");
+
+  caffe::Caffe::set_random_seed(cnnopts.seed);
+  if (!isnan(cnnopts.cnn_center[0])) {
+    mgrid->setGridCenter(cnnopts.cnn_center);
+    current_center = mgrid->getGridCenter();
+  } else if(!isnan(current_center[0])){
+    mgrid->setGridCenter(current_center);
+  }
+
+  setLigand(m);
+  setReceptor(m);
+  mgrid->setLigand(ligand_coords, ligand_smtypes, cnnopts.move_minimize_frame);
+  //receptor placed as in score so an empty mask matches the unmasked score
+  if (!cnnopts.move_minimize_frame)
+    mgrid->setReceptor(receptor_coords, receptor_smtypes, m.rec_conf.position, m.rec_conf.orientation);
+  else
+    mgrid->setReceptor(receptor_coords, receptor_smtypes);
+  mgrid->setLabels(1);
+
+  unsigned n = max(rec_excluded.size(), lig_excluded.size());
+  unsigned bsize = mgrid->getBatchSize();
+  std::vector<Net<Dtype>*> nets(1, net.get());
+  for (unsigned i = 0, nm = members.size(); i < nm; i++)
+    nets.push_back(members[i].get());
+
+  std::vector<std::vector<unsigned> > rec, lig;
+  for (unsigned start = 0; start < n; start += bsize) {
+    unsigned end = min(start + bsize, n);
+    rec.assign(rec_excluded.begin() + min(start, (unsigned)rec_excluded.size()),
+        rec_excluded.begin() + min(end, (unsigned)rec_excluded.size()));
+    lig.assign(lig_excluded.begin() + min(start, (unsigned)lig_excluded.size()),
+        lig_excluded.begin() + min(end, (unsigned)lig_excluded.size()));
+    mgrid->setExcludedAtoms(rec, lig);
 
-  return score / cnt;
+    {
+      TELEMETRY_PHASE(forward_timer, PhaseCNNForward);
+      if (runner)
+        forward_ensemble();
+      else
+        net->Forward();
+    }
+
+    //each position is its own pose, averaged over the ensemble
+    for (unsigned i = start; i < end; i++) {
+      Dtype s = 0, a = 0;
+      unsigned naff = 0;
+      for (unsigned k = 0, nn = nets.size(); k < nn; k++) {
+        s += nets[k]->blob_by_name("output")->cpu_data()[2 * (i - start) + 1];
+        if (nets[k]->has_blob("predaff")) {
+          a += nets[k]->blob_by_name("predaff")->cpu_data()[i - start];
+          naff++;
+        }
+      }
+      scores.push_back(s / nets.size());
+      affinities.push_back(naff ? a / naff : 0);
+    }
+  }
+  mgrid->clearExcludedAtoms();
 }
 
 //return only score
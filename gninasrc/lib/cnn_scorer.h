@@ -17,6 +17,7 @@
 
 #include "model.h"
 #include "cnn_data.h"
+#include "receptor_conv_cache.h"
 
 /* This class evaluates protein-ligand poses according to a provided
  * Caffe convolutional neural net (CNN) model.
@@ -25,13 +26,21 @@
 class CNNScorer {
   public:
     typedef float Dtype;
+    struct weight_store;
+    struct ensemble_runner;
   private:
+    caffe::shared_ptr<weight_store> weights; //shared with other scorers of the same model
     caffe::shared_ptr<caffe::Net<Dtype> > net;
+    //further networks of an ensemble, reading the grid made by net
+    std::vector<caffe::shared_ptr<weight_store> > member_weights;
+    std::vector<caffe::shared_ptr<caffe::Net<Dtype> > > members;
+    caffe::shared_ptr<ensemble_runner> runner; //runs net and members concurrently
+    Dtype score_var, affinity_var; //over the ensemble at the last evaluation
     caffe::MolGridDataLayer<Dtype> *mgrid;
-    caffe::MolGridDataParameter *mgridparam;
     cnn_options cnnopts;
 
     caffe::shared_ptr<boost::recursive_mutex> mtx; //todo, enable parallel scoring
+    caffe::shared_ptr<ReceptorConvCache> rcache; //null unless cache_receptor_conv
 
     //scratch vectors to avoid memory reallocation
     std::vector<gfloat3> gradient;
@@ -50,10 +59,16 @@ class CNNScorer {
     void setReceptor(const model& m);
 
     void getGradient();
+    caffe::NetParameter get_param(const cnn_options& opts) const;
+    caffe::shared_ptr<weight_store> get_weights(const caffe::NetParameter& param,
+        const cnn_options& opts) const;
+    void add_ensemble_member(const cnn_options& opts);
+    void forward_ensemble();
+    void backward_ensemble();
 
   public:
     CNNScorer()
-        : mgrid(NULL), mtx(new boost::recursive_mutex), current_center(NAN,NAN,NAN) {
+        : score_var(0), affinity_var(0), mgrid(NULL), mtx(new boost::recursive_mutex), current_center(NAN,NAN,NAN) {
     }
     virtual ~CNNScorer() {
     }
@@ -66,8 +81,28 @@ class CNNScorer {
 
     bool has_affinity() const; //return true if can predict affinity
 
+    //cap on the threads running ensemble networks at once, over all scorers
+    static void set_max_threads(unsigned n);
+
+    //number of networks whose outputs are averaged
+    unsigned ensemble_size() const {
+      return members.size() + 1;
+    }
+    //variance over the ensemble of the last score and affinity returned
+    float score_variance() const {
+      return score_var;
+    }
+    float affinity_variance() const {
+      return affinity_var;
+    }
+
     float score(model& m); //score only - no gradient
     float score(model& m, bool compute_gradient, float& affinity, float& loss);
+    //score m with atoms left out, mask_batch variants per forward pass
+    void score_masked(model& m,
+        const std::vector<std::vector<unsigned> >& rec_excluded,
+        const std::vector<std::vector<unsigned> >& lig_excluded,
+        std::vector<float>& scores, std::vector<float>& affinities);
 
     void outputDX(const std::string& prefix, double scale = 1.0, bool relevance =
         false, std::string layer_to_ignore = "", bool zero_values = false);
@@ -101,6 +136,8 @@ class CNNScorer {
     caffe::MolGridDataLayer<Dtype> * get_mgrid() { return mgrid; }
   protected:
     void get_net_output(Dtype& score, Dtype& aff, Dtype& loss);
+    void get_net_output(caffe::Net<Dtype>& cnn, Dtype& score, Dtype& aff,
+        Dtype& loss) const;
     void check_gradient();
 };
 
@@ -520,8 +520,13 @@ struct output_type {
     conf c;
     fl e;
     vecv coords;
+    //centroid and radius of gyration of coords, used to cheaply bound rmsd;
+    //set by add_to_output_container and stale if coords change afterwards
+    vec centroid;
+    fl gyration;
+    bool summarized;
     output_type(const conf& c_, fl e_)
-        : c(c_), e(e_) {
+        : c(c_), e(e_), centroid(0, 0, 0), gyration(0), summarized(false) {
     }
 };
 
@@ -21,6 +21,8 @@
  */
 
 #include "coords.h"
+#include <algorithm>
+#include <memory>
 
 fl rmsd_upper_bound(const vecv& a, const vecv& b) {
   VINA_CHECK(a.size() == b.size());
@@ -30,6 +32,43 @@ fl rmsd_upper_bound(const vecv& a, const vecv& b) {
   return (a.size() > 0) ? std::sqrt(acc / a.size()) : 0;
 }
 
+//compute the centroid and radius of gyration of t's coordinates
+static void summarize(output_type& t) {
+  vec c(0, 0, 0);
+  VINA_FOR_IN(i, t.coords)
+    c += t.coords[i];
+  if (!t.coords.empty()) c *= 1.0 / t.coords.size();
+  fl acc = 0;
+  VINA_FOR_IN(i, t.coords)
+    acc += vec_distance_sqr(t.coords[i], c);
+  t.centroid = c;
+  t.gyration = t.coords.empty() ? 0 : std::sqrt(acc / t.coords.size());
+  t.summarized = true;
+}
+
+//Lower bound on the (unaligned) rmsd between two poses.  The squared
+//displacement of each atom splits into the displacement of the centroid plus
+//the displacement relative to it, and the norm of the latter is at least
+//the difference of the radii of gyration.
+static fl rmsd_lower_bound(const output_type& a, const output_type& b) {
+  fl dg = a.gyration - b.gyration;
+  return std::sqrt(vec_distance_sqr(a.centroid, b.centroid) + dg * dg);
+}
+
+//closest pose in b to t, not considering poses that can't be closer than cutoff
+static std::pair<sz, fl> find_closest(const output_type& t,
+    output_container& b, fl cutoff) {
+  std::pair<sz, fl> tmp(b.size(), max_fl);
+  VINA_FOR_IN(i, b) {
+    if (!b[i].summarized) summarize(b[i]);
+    fl bound = rmsd_lower_bound(t, b[i]);
+    if (bound >= cutoff || bound >= tmp.second) continue;
+    fl res = rmsd_upper_bound(t.coords, b[i].coords);
+    if (res < tmp.second) tmp = std::pair<sz, fl>(i, res);
+  }
+  return tmp;
+}
+
 std::pair<sz, fl> find_closest(const vecv& a, const output_container& b) {
   std::pair<sz, fl> tmp(b.size(), max_fl);
   VINA_FOR_IN(i, b) {
@@ -39,19 +78,33 @@ std::pair<sz, fl> find_closest(const vecv& a, const output_container& b) {
   return tmp;
 }
 
+//insert t keeping out sorted by energy
+static void insert_sorted(output_container& out, output_type *t) {
+  output_container::iterator pos = std::upper_bound(out.begin(), out.end(),
+      *t);
+  out.insert(pos, t);
+}
+
 void add_to_output_container(output_container& out, const output_type& t,
     fl min_rmsd, sz max_size) {
-  std::pair<sz, fl> closest_rmsd = find_closest(t.coords, out);
+  //out is kept sorted, so only the slot of the replaced pose and the slot of
+  //the new pose move; no rmsd is computed against poses that are provably
+  //further than min_rmsd away
+  std::unique_ptr<output_type> candidate(new output_type(t));
+  summarize(*candidate);
+  std::pair<sz, fl> closest_rmsd = find_closest(*candidate, out, min_rmsd);
   if (closest_rmsd.first < out.size() && closest_rmsd.second < min_rmsd) { // have a very similar one
     if (t.e < out[closest_rmsd.first].e) { // the new one is better, apparently
-      out[closest_rmsd.first] = t; // FIXME? slow
+      out.erase(out.begin() + closest_rmsd.first);
+      insert_sorted(out, candidate.release());
     }
   } else { // nothing similar
     if (out.size() < max_size)
-      out.push_back(new output_type(t)); // the last one had the worst energy - replacing 
+      insert_sorted(out, candidate.release());
     else
-      if (!out.empty() && t.e < out.back().e) // FIXME? - just changed
-      out.back() = t; // FIXME? slow
+      if (!out.empty() && t.e < out.back().e) { // the last one had the worst energy - replacing
+        out.pop_back();
+        insert_sorted(out, candidate.release());
+      }
   }
-  out.sort();
 }
@@ -27,16 +27,35 @@
 //evaluate using grid, if deriv is null, do not calc deriviative
 fl grid::evaluate(const atom& a, const vec& location, fl slope, fl c,
     vec *deriv /*=NULL*/) const {
+  switch (precision) {
+  case GridFP16:
+    return evaluate_charged<fp16_storage>(rdata, rchargedata, a, location,
+        slope, c, deriv);
+  case GridBF16:
+    return evaluate_charged<bf16_storage>(rdata, rchargedata, a, location,
+        slope, c, deriv);
+  default:
+    return evaluate_charged<fp32_storage>(data, chargedata, a, location, slope,
+        c, deriv);
+  }
+}
+
+template<typename Storage>
+fl grid::evaluate_charged(const array3d<typename Storage::value_type>& m_data,
+    const array3d<typename Storage::value_type>& m_chargedata, const atom& a,
+    const vec& location, fl slope, fl c, vec* deriv) const {
   //charge indep
-  fl ret = evaluate_aux(data, location, slope, c, deriv);
-  if (a.charge != 0 && chargedata.dim0() > 0) {
+  fl ret = evaluate_aux<Storage>(m_data, location, slope, c, deriv);
+  if (a.charge != 0 && m_chargedata.dim0() > 0) {
     //charge dependent
     if (deriv == NULL) {
-      ret += a.charge * evaluate_aux(chargedata, location, slope, c, NULL);
+      ret += a.charge
+          * evaluate_aux<Storage>(m_chargedata, location, slope, c, NULL);
     } else //otherwise, must add derivatives
     {
       vec cderiv(0, 0, 0);
-      ret += a.charge * evaluate_aux(chargedata, location, slope, c, &cderiv);
+      ret += a.charge
+          * evaluate_aux<Storage>(m_chargedata, location, slope, c, &cderiv);
       *deriv += a.charge * cderiv;
     }
   }
@@ -44,21 +63,33 @@ fl grid::evaluate(const atom& a, const vec& location, fl slope, fl c,
 }
 
 fl grid::evaluate_user(const vec& location, fl slope, vec *deriv) const {
-  return evaluate_aux(data, location, slope, (fl) 1000, deriv);
+  return evaluate_aux<fp32_storage>(data, location, slope, (fl) 1000, deriv);
+}
+
+sz grid::memory_bytes() const {
+  return sizeof(fl) * (data.dim0() * data.dim1() * data.dim2()
+      + chargedata.dim0() * chargedata.dim1() * chargedata.dim2())
+      + sizeof(uint16_t) * (rdata.dim0() * rdata.dim1() * rdata.dim2()
+          + rchargedata.dim0() * rchargedata.dim1() * rchargedata.dim2());
 }
 
 //allocate memory for grid (but don't fill in values)
 //only initialize charge dependent values if hashcharged is true
-void grid::init(const grid_dims& gd, bool hascharged) {
-  data.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
-  if (hascharged) chargedata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+void grid::init(const grid_dims& gd, bool hascharged, grid_precision p) {
+  precision = p;
+  if (p == GridFP32) {
+    data.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+    if (hascharged) chargedata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+  } else {
+    rdata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+    if (hascharged) rchargedata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+  }
   m_init = vec(gd[0].begin, gd[1].begin, gd[2].begin);
   m_range = vec(gd[0].span(), gd[1].span(), gd[2].span());
   assert(m_range[0] > 0);
   assert(m_range[1] > 0);
   assert(m_range[2] > 0);
-  m_dim_fl_minus_1 = vec(data.dim0() - 1.0, data.dim1() - 1.0,
-      data.dim2() - 1.0);
+  m_dim_fl_minus_1 = vec(gd[0].n, gd[1].n, gd[2].n);
   VINA_FOR(i, 3) {
     m_factor[i] = m_dim_fl_minus_1[i] / m_range[i];
     m_factor_inv[i] = 1 / m_factor[i];
@@ -92,8 +123,9 @@ void grid::init(const grid_dims& gd, std::istream& user_in,
   }
 }
 
-fl grid::evaluate_aux(const array3d<fl>& m_data, const vec& location, fl slope,
-    fl v, vec* deriv) const { // sets *deriv if not NULL
+template<typename Storage>
+fl grid::evaluate_aux(const array3d<typename Storage::value_type>& m_data,
+    const vec& location, fl slope, fl v, vec* deriv) const { // sets *deriv if not NULL
   vec s = elementwise_product(location - m_init, m_factor);
 
   vec miss(0, 0, 0);
@@ -134,14 +166,14 @@ fl grid::evaluate_aux(const array3d<fl>& m_data, const vec& location, fl slope,
   const sz y1 = y0 + 1;
   const sz z1 = z0 + 1;
 
-  const fl f000 = m_data(x0, y0, z0);
-  const fl f100 = m_data(x1, y0, z0);
-  const fl f010 = m_data(x0, y1, z0);
-  const fl f110 = m_data(x1, y1, z0);
-  const fl f001 = m_data(x0, y0, z1);
-  const fl f101 = m_data(x1, y0, z1);
-  const fl f011 = m_data(x0, y1, z1);
-  const fl f111 = m_data(x1, y1, z1);
+  const fl f000 = Storage::decode(m_data(x0, y0, z0));
+  const fl f100 = Storage::decode(m_data(x1, y0, z0));
+  const fl f010 = Storage::decode(m_data(x0, y1, z0));
+  const fl f110 = Storage::decode(m_data(x1, y1, z0));
+  const fl f001 = Storage::decode(m_data(x0, y0, z1));
+  const fl f101 = Storage::decode(m_data(x1, y0, z1));
+  const fl f011 = Storage::decode(m_data(x0, y1, z1));
+  const fl f111 = Storage::decode(m_data(x1, y1, z1));
 
   const fl x = s[0];
   const fl y = s[1];
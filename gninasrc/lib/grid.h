@@ -28,6 +28,8 @@
 #include "curl.h"
 #include "result_components.h"
 #include "atom.h"
+#include "reduced_precision.h"
+#include <boost/serialization/version.hpp>
 
 class grid { // FIXME rm 'm_', consistent with my new style
     vec m_init;
@@ -37,6 +39,10 @@ class grid { // FIXME rm 'm_', consistent with my new style
     vec m_factor_inv;
     array3d<fl> data;
     array3d<fl> chargedata; //needs to be multiplied by atom charge
+    //16 bit values used instead of data and chargedata for reduced precision
+    grid_precision precision;
+    array3d<uint16_t> rdata;
+    array3d<uint16_t> rchargedata;
 
     friend class cache;
     friend class non_cache;
@@ -44,26 +50,53 @@ class grid { // FIXME rm 'm_', consistent with my new style
   public:
     grid()
         : m_init(0, 0, 0), m_range(1, 1, 1), m_factor(1, 1, 1),
-            m_dim_fl_minus_1(-1, -1, -1), m_factor_inv(1, 1, 1) {
+            m_dim_fl_minus_1(-1, -1, -1), m_factor_inv(1, 1, 1),
+            precision(GridFP32) {
     } // not private
-    grid(const grid_dims& gd, bool hascharged) {
+    grid(const grid_dims& gd, bool hascharged)
+        : precision(GridFP32) {
       init(gd, hascharged);
     }
-    void init(const grid_dims& gd, bool hascharged);
+    //allocates the values at precision p; fl arrays are left empty for 16 bit
+    void init(const grid_dims& gd, bool hascharged,
+        grid_precision p = GridFP32);
     void init(const grid_dims& gd, std::istream& user_in, fl ug_scaling_factor);
     vec index_to_argument(sz x, sz y, sz z) const {
       return vec(m_init[0] + m_factor_inv[0] * x,
           m_init[1] + m_factor_inv[1] * y, m_init[2] + m_factor_inv[2] * z);
     }
     bool initialized() const {
+      if (precision != GridFP32) return rdata.dim0() > 0;
       return data.dim0() > 0 && data.dim1() > 0 && data.dim2() > 0;
     }
+    grid_precision get_precision() const {
+      return precision;
+    }
+    //store values at the grid's precision
+    void set(sz x, sz y, sz z, fl value) {
+      if (precision == GridFP32)
+        data(x, y, z) = value;
+      else
+        rdata(x, y, z) = fl_to_reduced(value, precision);
+    }
+    void set_charge(sz x, sz y, sz z, fl value) {
+      if (precision == GridFP32)
+        chargedata(x, y, z) = value;
+      else
+        rchargedata(x, y, z) = fl_to_reduced(value, precision);
+    }
+    sz memory_bytes() const;
     fl evaluate(const atom& a, const vec& location, fl slope, fl c, vec* deriv =
         NULL) const;
     fl evaluate_user(const vec& location, fl slope, vec* deriv = NULL) const;
   private:
-    fl evaluate_aux(const array3d<fl>& m_data, const vec& location, fl slope,
-        fl v, vec* deriv) const; // sets *deriv if not NULL
+    template<typename Storage>
+    fl evaluate_aux(const array3d<typename Storage::value_type>& m_data,
+        const vec& location, fl slope, fl v, vec* deriv) const; // sets *deriv if not NULL
+    template<typename Storage>
+    fl evaluate_charged(const array3d<typename Storage::value_type>& m_data,
+        const array3d<typename Storage::value_type>& m_chargedata,
+        const atom& a, const vec& location, fl slope, fl c, vec* deriv) const;
     friend class boost::serialization::access;
     template<class Archive>
     void serialize(Archive& ar, const unsigned version) {
@@ -74,7 +107,16 @@ class grid { // FIXME rm 'm_', consistent with my new style
       ar & m_factor;
       ar & m_dim_fl_minus_1;
       ar & m_factor_inv;
+      if (version > 0) {
+        ar & precision;
+        ar & rdata;
+        ar & rchargedata;
+      } else
+        precision = GridFP32; //written before reduced precision grids
     }
 };
 
+//version 1 added the storage precision and 16 bit values
+BOOST_CLASS_VERSION(grid, 1)
+
 #endif
@@ -32,6 +32,9 @@ struct gridoptions {
     bool gpu;
     bool separate;
     bool use_covalent_radius;
+    bool batch;
+    bool compress;
+    unsigned threads; //for batch, 0 for all cores
     gridoptions()
         :
             //a default dimension of 23.5 yields 48x48x48 gridpoints
@@ -39,7 +42,8 @@ struct gridoptions {
             verbosity(1), seed((int) time(NULL)),
             randrotate(false), help(false), version(false),
             timeit(false), outmap(false), binary(false), spherize(false),
-            gpu(false), separate(false), use_covalent_radius(false) {
+            gpu(false), separate(false), use_covalent_radius(false),
+            batch(false), compress(false), threads(0) {
     }
 };
 
@@ -5,7 +5,6 @@
 #include <boost/unordered_map.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include "non_cache_gpu.h"
-#include "loop_timer.h"
 
 /////////////////// begin MODEL::APPEND /////////////////////////
 
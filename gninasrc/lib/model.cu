@@ -13,7 +13,7 @@
 #include <boost/unordered_map.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include "non_cache_gpu.h"
-#include "loop_timer.h"
+#include "telemetry.h"
 #include "gpu_debug.h"
 #include "device_buffer.h"
 
@@ -151,8 +151,6 @@ void set_conf_kernel(tree_gpu *t, const vec *atom_coords, vec *coords,
 template<typename infoT>
 __device__ fl gpu_data::eval_deriv_gpu(const infoT& info, const vec& v,
     const conf_gpu& c, change_gpu& g) {
-  // static loop_timer t;
-  // t.resume();
   fl e, ie = 0;
   if (threadIdx.x == 0) {
     set_conf_kernel<<<1, treegpu->num_atoms>>>(treegpu, atom_coords,
@@ -200,8 +198,7 @@ fl gpu_data::eval_intramolecular(const GPUNonCacheInfo& info, const float v) {
 
 fl model::eval_deriv(const precalculate& p, const igrid& ig, const vec& v,
     const conf& c, change& g, const grid& user_grid) { // clean up
-  static loop_timer t;
-  t.resume();
+  TELEMETRY_COUNT(CountEvals);
 
   set(c);
 
@@ -22,7 +22,6 @@
 
 #include "non_cache.h"
 #include "curl.h"
-#include "loop_timer.h"
 
 non_cache::non_cache(szv_grid_cache& gcache, const grid_dims& gd_,
     const precalculate* p_, fl slope_)
@@ -1,5 +1,4 @@
 #include "non_cache_gpu.h"
-#include "loop_timer.h"
 #include "gpu_math.h"
 #include "device_buffer.h"
 
@@ -28,11 +28,13 @@
 #include "device_buffer.h"
 #include "non_cache_cnn.h"
 #include "user_opts.h"
+#include "telemetry.h"
 
 struct parallel_mc_task {
     model m;
     output_container out;
     rng generator;
+    ligand_stats stats; //recorded by the thread that ran this task
     parallel_mc_task(const model& m_, int seed)
         : m(m_), generator(static_cast<rng::result_type>(seed)) {
       if (m_.gpu_initialized()) {
@@ -76,6 +78,7 @@ struct parallel_mc_aux {
     }
 
     void operator()(parallel_mc_task& t) const {
+      TELEMETRY_CAPTURE(capture, t.stats);
       //TODO: remove when the CNN is using the device buffer
       const non_cache_cnn* cnn = dynamic_cast<const non_cache_cnn*>(ig);
       if (t.m.gpu_initialized() && !cnn) {
@@ -168,7 +171,6 @@ void merge_output_containers(const parallel_mc_task_container& many,
   min_rmsd = 2; // FIXME? perhaps it's necessary to separate min_rmsd during search and during output?
   VINA_FOR_IN(i, many)
     merge_output_containers(many[i].out, out, min_rmsd, max_size);
-  out.sort();
 }
 
 void parallel_mc::operator()(const model& m, output_container& out,
@@ -193,6 +195,8 @@ void parallel_mc::operator()(const model& m, output_container& out,
       decltype(thread_init), true> parallel_iter_instance(
       &parallel_mc_aux_instance, num_threads, thread_init);
   parallel_iter_instance.run(task_container);
+  VINA_FOR_IN(i, task_container)
+    TELEMETRY_MERGE(task_container[i].stats);
 
   merge_output_containers(task_container, out, mc.min_rmsd, mc.num_saved_mins);
 
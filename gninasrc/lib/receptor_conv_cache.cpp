@@ -0,0 +1,216 @@
+/*
+ * receptor_conv_cache.cpp
+ *
+ * Inference shortcut for the first convolution of a CNN scoring model.
+ */
+
+#include "receptor_conv_cache.h"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/math_functions.hpp"
+
+using namespace caffe;
+
+ReceptorConvCache::ReceptorConvCache(Net<Dtype>& net_,
+    unsigned num_receptor_channels)
+    : net(net_), conv_index(0), nrec(num_receptor_channels), input(NULL),
+        output(NULL), valid(false) {
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net.layers();
+  const vector<vector<Blob<Dtype>*> >& bottoms = net.bottom_vecs();
+  const vector<vector<Blob<Dtype>*> >& tops = net.top_vecs();
+
+  //follow the data blob through per channel layers to a convolution
+  Blob<Dtype>* blob = tops[0][0];
+  for (unsigned i = 1; i < layers.size(); i++) {
+    if (bottoms[i].size() != 1 || bottoms[i][0] != blob) break;
+    string type = layers[i]->type();
+    if (type == "Convolution") {
+      conv_index = i;
+      break;
+    }
+    if (type != "Pooling" || tops[i].size() != 1) break;
+    blob = tops[i][0];
+  }
+  if (conv_index == 0)
+    throw usage_error(
+        "Receptor convolution cache needs a convolution fed by the grid data, possibly through pooling.");
+
+  //every blob along the way must only feed the next layer
+  for (unsigned i = 0; i < layers.size(); i++) {
+    for (unsigned j = 0; j < bottoms[i].size(); j++) {
+      for (unsigned k = 0; k < conv_index; k++) {
+        if (bottoms[i][j] == tops[k][0] && i != k + 1)
+          throw usage_error(
+              "Receptor convolution cache needs the grid data to be used only by the first convolution.");
+      }
+    }
+  }
+
+  input = bottoms[conv_index][0];
+  output = tops[conv_index][0];
+  const LayerParameter& conv_param = layers[conv_index]->layer_param();
+  if (conv_param.convolution_param().group() != 1)
+    throw usage_error("Receptor convolution cache does not support grouped convolutions.");
+  if (output == input || input->num_axes() < 2 || input->shape(1) <= nrec)
+    throw usage_error("Receptor convolution cache needs separate receptor and ligand channels.");
+
+  const unsigned nlig = input->shape(1) - nrec;
+  vector<int> shape = input->shape();
+  shape[1] = nrec;
+  rec_in.Reshape(shape);
+  shape[1] = nlig;
+  lig_in.Reshape(shape);
+  rec_bottom.push_back(&rec_in);
+  rec_top.push_back(&rec_out);
+  lig_bottom.push_back(&lig_in);
+  lig_top.push_back(&lig_out);
+
+  LayerParameter rec_param(conv_param);
+  rec_param.set_name(conv_param.name() + "_receptor");
+  rec_param.set_phase(TEST);
+  rec_param.clear_blobs(); //weights are split below
+  //a fused activation has to wait until the halves are added
+  if (conv_param.convolution_param().fused_relu()) {
+    LayerParameter relu_param;
+    relu_param.set_name(conv_param.name() + "_relu");
+    relu_param.set_type("ReLU");
+    relu_param.mutable_relu_param()->set_negative_slope(
+        conv_param.convolution_param().fused_relu_negative_slope());
+    relu = LayerRegistry<Dtype>::CreateLayer(relu_param);
+    out_vec.push_back(output);
+    relu->SetUp(out_vec, out_vec);
+    rec_param.mutable_convolution_param()->set_fused_relu(false);
+  }
+  LayerParameter lig_param(rec_param);
+  lig_param.set_name(conv_param.name() + "_ligand");
+  lig_param.mutable_convolution_param()->set_bias_term(false);
+
+  rec_conv = LayerRegistry<Dtype>::CreateLayer(rec_param);
+  rec_conv->SetUp(rec_bottom, rec_top);
+  lig_conv = LayerRegistry<Dtype>::CreateLayer(lig_param);
+  lig_conv->SetUp(lig_bottom, lig_top);
+  CHECK(rec_out.shape() == output->shape());
+  CHECK(lig_out.shape() == output->shape());
+
+  //split the weights by input channel
+  const Blob<Dtype>& weights = *layers[conv_index]->blobs()[0];
+  const unsigned nout = weights.shape(0);
+  const unsigned ksize = weights.count(2);
+  Dtype* rec_weights = rec_conv->blobs()[0]->mutable_cpu_data();
+  Dtype* lig_weights = lig_conv->blobs()[0]->mutable_cpu_data();
+  for (unsigned o = 0; o < nout; o++) {
+    const Dtype* w = weights.cpu_data() + o * weights.count(1);
+    caffe_copy(nrec * ksize, w, rec_weights + o * nrec * ksize);
+    caffe_copy(nlig * ksize, w + nrec * ksize, lig_weights + o * nlig * ksize);
+  }
+  if (conv_param.convolution_param().bias_term())
+    rec_conv->blobs()[1]->CopyFrom(*layers[conv_index]->blobs()[1]);
+
+  for (unsigned i = 0; i < rec_conv->blobs().size(); i++)
+    rec_conv->set_param_propagate_down(i, false);
+  for (unsigned i = 0; i < lig_conv->blobs().size(); i++)
+    lig_conv->set_param_propagate_down(i, false);
+
+  //both halves receive the gradient of the full output
+  rec_out.ShareDiff(*output);
+  lig_out.ShareDiff(*output);
+}
+
+void ReceptorConvCache::set_receptor(const vec& center_, const vec& translate_,
+    const qt& rotate_, const std::vector<float3>& coords_,
+    const std::vector<smt>& types_) {
+  if (valid) {
+    bool same = coords_.size() == coords.size() && types_ == types;
+    for (unsigned i = 0; same && i < 3; i++)
+      same = center_[i] == center[i] && translate_[i] == translate[i];
+    same = same && rotate_.R_component_1() == rotate.R_component_1()
+        && rotate_.R_component_2() == rotate.R_component_2()
+        && rotate_.R_component_3() == rotate.R_component_3()
+        && rotate_.R_component_4() == rotate.R_component_4();
+    for (unsigned i = 0, n = coords_.size(); same && i < n; i++)
+      same = coords_[i].x == coords[i].x && coords_[i].y == coords[i].y
+          && coords_[i].z == coords[i].z;
+    if (same) return;
+  }
+  valid = false;
+  center = center_;
+  translate = translate_;
+  rotate = rotate_;
+  coords = coords_;
+  types = types_;
+}
+
+//copy count channels starting at first of every example in from
+void ReceptorConvCache::copy_channels(const Dtype* from,
+    unsigned from_channels, unsigned first, Dtype* to, unsigned count) const {
+  const unsigned spatial = input->count(2);
+  for (unsigned n = 0, num = input->shape(0); n < num; n++)
+    caffe_copy(count * spatial, from + (n * from_channels + first) * spatial,
+        to + n * count * spatial);
+}
+
+//inverse of copy_channels
+void ReceptorConvCache::copy_channels_back(const Dtype* from, unsigned count,
+    Dtype* to, unsigned to_channels, unsigned first) const {
+  const unsigned spatial = input->count(2);
+  for (unsigned n = 0, num = input->shape(0); n < num; n++)
+    caffe_copy(count * spatial, from + n * count * spatial,
+        to + (n * to_channels + first) * spatial);
+}
+
+void ReceptorConvCache::Forward() {
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  const unsigned nchannels = input->shape(1);
+  net.ForwardTo(conv_index - 1);
+
+  const Dtype* in = gpu ? input->gpu_data() : input->cpu_data();
+  if (!valid) {
+    copy_channels(in, nchannels, 0,
+        gpu ? rec_in.mutable_gpu_data() : rec_in.mutable_cpu_data(), nrec);
+    rec_conv->Forward(rec_bottom, rec_top);
+    valid = true;
+  }
+  copy_channels(in, nchannels, nrec,
+      gpu ? lig_in.mutable_gpu_data() : lig_in.mutable_cpu_data(),
+      nchannels - nrec);
+  lig_conv->Forward(lig_bottom, lig_top);
+
+  if (gpu)
+    caffe_gpu_add(output->count(), rec_out.gpu_data(), lig_out.gpu_data(),
+        output->mutable_gpu_data());
+  else
+    caffe_add(output->count(), rec_out.cpu_data(), lig_out.cpu_data(),
+        output->mutable_cpu_data());
+  if (relu) relu->Forward(out_vec, out_vec);
+
+  net.ForwardFrom(conv_index + 1);
+}
+
+void ReceptorConvCache::Backward(bool receptor_gradient) {
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  const unsigned nchannels = input->shape(1);
+  net.BackwardFromTo(net.layers().size() - 1, conv_index + 1);
+
+  Dtype* in_diff = gpu ? input->mutable_gpu_diff() : input->mutable_cpu_diff();
+  vector<bool> propagate(1, true);
+  if (relu) relu->Backward(out_vec, propagate, out_vec);
+  lig_conv->Backward(lig_top, propagate, lig_bottom);
+  copy_channels_back(gpu ? lig_in.gpu_diff() : lig_in.cpu_diff(),
+      nchannels - nrec, in_diff, nchannels, nrec);
+
+  if (receptor_gradient) {
+    //rec_in still holds the receptor channels the cached output came from
+    rec_conv->Backward(rec_top, propagate, rec_bottom);
+    copy_channels_back(gpu ? rec_in.gpu_diff() : rec_in.cpu_diff(), nrec,
+        in_diff, nchannels, 0);
+  } else {
+    const unsigned spatial = input->count(2);
+    for (unsigned n = 0, num = input->shape(0); n < num; n++) {
+      if (gpu)
+        caffe_gpu_set(nrec * spatial, Dtype(0), in_diff + n * nchannels * spatial);
+      else
+        caffe_set(nrec * spatial, Dtype(0), in_diff + n * nchannels * spatial);
+    }
+  }
+
+  net.BackwardFromTo(conv_index - 1, 0);
+}
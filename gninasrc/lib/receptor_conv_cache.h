@@ -0,0 +1,72 @@
+/*
+ * receptor_conv_cache.h
+ *
+ * Inference shortcut for the first convolution of a CNN scoring model.
+ */
+
+#ifndef SRC_LIB_RECEPTOR_CONV_CACHE_H_
+#define SRC_LIB_RECEPTOR_CONV_CACHE_H_
+
+#include "caffe/net.hpp"
+#include "caffe/layer.hpp"
+#include "common.h"
+#include "atom_constants.h"
+#include "quaternion.h"
+
+/* The first convolution after the MolGridDataLayer is linear in its input
+ * channels, and the receptor channels only change when the receptor or its
+ * placement on the grid does.  This keeps the receptor part of that
+ * convolution's output (bias included) and on each evaluation convolves
+ * only the ligand channels and adds the two.  Layers between the data layer
+ * and the convolution must work on each channel separately (pooling).
+ * Backward gives the same gradient as the full convolution; the receptor
+ * half is only propagated when receptor gradients are wanted.
+ */
+class ReceptorConvCache {
+  public:
+    typedef float Dtype;
+
+    //throws usage_error if net has no convolution this can be applied to
+    ReceptorConvCache(caffe::Net<Dtype>& net, unsigned num_receptor_channels);
+
+    //drops the cached output if anything that determines the receptor
+    //channels differs from the last call
+    void set_receptor(const vec& center, const vec& translate,
+        const qt& rotate, const std::vector<float3>& coords,
+        const std::vector<smt>& types);
+    void invalidate() {
+      valid = false;
+    }
+
+    //replacements for net.Forward() and net.Backward()
+    void Forward();
+    void Backward(bool receptor_gradient);
+
+  private:
+    caffe::Net<Dtype>& net;
+    unsigned conv_index; //layer replaced by rec_conv and lig_conv
+    unsigned nrec;
+    caffe::Blob<Dtype>* input; //bottom of the original convolution
+    caffe::Blob<Dtype>* output; //top of the original convolution
+
+    caffe::shared_ptr<caffe::Layer<Dtype> > rec_conv; //has the bias
+    caffe::shared_ptr<caffe::Layer<Dtype> > lig_conv;
+    caffe::Blob<Dtype> rec_in, rec_out, lig_in, lig_out;
+    std::vector<caffe::Blob<Dtype>*> rec_bottom, rec_top, lig_bottom, lig_top;
+    caffe::shared_ptr<caffe::Layer<Dtype> > relu; //fused activation, if any
+    std::vector<caffe::Blob<Dtype>*> out_vec;
+
+    bool valid;
+    vec center;
+    vec translate;
+    qt rotate;
+    std::vector<float3> coords;
+    std::vector<smt> types;
+
+    void copy_channels(const Dtype* from, unsigned from_channels,
+        unsigned first, Dtype* to, unsigned count) const;
+    void copy_channels_back(const Dtype* from, unsigned count, Dtype* to,
+        unsigned to_channels, unsigned first) const;
+};
+
+#endif /* SRC_LIB_RECEPTOR_CONV_CACHE_H_ */
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "common.h"
+
+/* 16 bit storage formats for precomputed energy grids.  Values are
+ * converted back to fl when read, so only storage precision is reduced.
+ * fp16 keeps 11 significant bits but saturates at +-65504; bf16 keeps the
+ * range of fl with 8 significant bits.
+ */
+enum grid_precision {
+  GridFP32, GridFP16, GridBF16
+};
+
+inline uint32_t fl_bits(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+inline float bits_fl(uint32_t u) {
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+//round to nearest even; out of range values saturate rather than becoming
+//infinite so interpolation never produces inf or nan
+inline uint16_t fl_to_fp16(float f) {
+  const uint32_t u = fl_bits(f);
+  const uint16_t sign = (u >> 16) & 0x8000;
+  const uint32_t absu = u & 0x7fffffff;
+  if (absu > 0x7f800000) return sign | 0x7e00; //nan
+  if (absu >= 0x477ff000) return sign | 0x7bff; //rounds to >= 65520
+  if (absu < 0x38800000) { //subnormal or zero in fp16
+    if (absu < 0x33000000) return sign; //below half the smallest subnormal
+    const uint32_t mant = (absu & 0x7fffff) | 0x800000;
+    const int shift = 126 - int(absu >> 23);
+    uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+  uint32_t h = ((absu >> 13) - (112 << 10));
+  const uint32_t rem = absu & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+  return sign | h;
+}
+
+inline float fp16_to_fl(uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  const uint32_t exp = (h >> 10) & 0x1f;
+  const uint32_t mant = h & 0x3ff;
+  if (exp == 0) {
+    //zero or subnormal, exactly representable as a scaled integer
+    const float f = std::ldexp(float(mant), -24);
+    return sign ? -f : f;
+  }
+  if (exp == 0x1f) return bits_fl(sign | 0x7f800000 | (mant << 13));
+  return bits_fl(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+inline uint16_t fl_to_bf16(float f) {
+  const uint32_t u = fl_bits(f);
+  if ((u & 0x7fffffff) > 0x7f800000) return (u >> 16) | 0x40; //nan
+  //saturate values that would round up to infinity
+  if ((u & 0x7fffffff) >= 0x7f7f8000) return ((u >> 16) & 0x8000) | 0x7f7f;
+  return (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+}
+
+inline float bf16_to_fl(uint16_t b) {
+  return bits_fl(uint32_t(b) << 16);
+}
+
+inline uint16_t fl_to_reduced(float f, grid_precision p) {
+  return p == GridBF16 ? fl_to_bf16(f) : fl_to_fp16(f);
+}
+
+//how grid values are decoded in evaluate_aux
+struct fp32_storage {
+    typedef fl value_type;
+    static fl decode(fl x) {
+      return x;
+    }
+};
+
+struct fp16_storage {
+    typedef uint16_t value_type;
+    static fl decode(uint16_t x) {
+      return fp16_to_fl(x);
+    }
+};
+
+struct bf16_storage {
+    typedef uint16_t value_type;
+    static fl decode(uint16_t x) {
+      return bf16_to_fl(x);
+    }
+};
@@ -49,6 +49,14 @@ class result_info {
         const weighted_terms *wt = NULL, int modelnum = 0);
 
     void writeFlex(std::ostream& out, std::string& ext, int modelnum = 0);
+
+    const std::string& getName() const {
+      return name;
+    }
+
+    fl getCNNScore() const {
+      return cnnscore;
+    }
 };
 
 #endif /* RESULT_INFO_H_ */
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <boost/thread/lock_guard.hpp>
+#include "screening.h"
+
+streaming_quantile::streaming_quantile(double p_)
+    : p(p_), count(0) {
+  for (int i = 0; i < 5; i++)
+    q[i] = n[i] = np[i] = dn[i] = 0;
+}
+
+void streaming_quantile::add(double x) {
+  if (count < 5) {
+    q[count++] = x;
+    if (count == 5) {
+      std::sort(q, q + 5);
+      for (int i = 0; i < 5; i++)
+        n[i] = i + 1;
+      np[0] = 1;
+      np[1] = 1 + 2 * p;
+      np[2] = 1 + 4 * p;
+      np[3] = 3 + 2 * p;
+      np[4] = 5;
+      dn[0] = 0;
+      dn[1] = p / 2;
+      dn[2] = p;
+      dn[3] = (1 + p) / 2;
+      dn[4] = 1;
+    }
+    return;
+  }
+  count++;
+
+  //cell the value falls in, extending the extremes if needed
+  int k;
+  if (x < q[0]) {
+    q[0] = x;
+    k = 0;
+  } else if (x >= q[4]) {
+    q[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while (x >= q[k + 1])
+      k++;
+  }
+  for (int i = k + 1; i < 5; i++)
+    n[i] += 1;
+  for (int i = 0; i < 5; i++)
+    np[i] += dn[i];
+
+  //move the middle markers back towards their desired positions
+  for (int i = 1; i < 4; i++) {
+    double d = np[i] - n[i];
+    if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+      int s = d > 0 ? 1 : -1;
+      double h = parabolic(i, s);
+      if (q[i - 1] < h && h < q[i + 1])
+        q[i] = h;
+      else
+        q[i] = linear(i, s);
+      n[i] += s;
+    }
+  }
+}
+
+double streaming_quantile::parabolic(int i, double d) const {
+  return q[i]
+      + d / (n[i + 1] - n[i - 1])
+          * ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i])
+              + (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+double streaming_quantile::linear(int i, int d) const {
+  return q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+}
+
+double streaming_quantile::estimate() const {
+  if (count == 0) return std::numeric_limits<double>::quiet_NaN();
+  if (count >= 5) return q[2];
+  double sorted[5];
+  std::copy(q, q + count, sorted);
+  std::sort(sorted, sorted + count);
+  sz rank = sz(std::floor(p * (count - 1) + 0.5));
+  return sorted[rank];
+}
+
+screen_filter::screen_filter(const screen_options& opts_)
+    : opts(opts_), affinities(opts_.top_percent / 100.0),
+        cnnscores(1 - opts_.cnn_top_percent / 100.0), rescored(0),
+        redocked(0) {
+}
+
+bool screen_filter::rescore(fl affinity) {
+  boost::lock_guard<boost::mutex> guard(mtx);
+  //a NaN cutoff compares false, so an unset cutoff never passes
+  bool pass = affinities.size() < opts.warmup || opts.top_percent >= 100
+      || affinity <= opts.affinity
+      || (opts.top_percent > 0 && affinity <= affinities.estimate());
+  affinities.add(affinity);
+  if (pass) rescored++;
+  return pass;
+}
+
+bool screen_filter::redock(fl cnnscore) {
+  boost::lock_guard<boost::mutex> guard(mtx);
+  bool pass = cnnscores.size() < opts.warmup || opts.cnn_top_percent >= 100
+      || cnnscore >= opts.cnn_score
+      || (opts.cnn_top_percent > 0 && cnnscore >= cnnscores.estimate());
+  cnnscores.add(cnnscore);
+  if (pass) redocked++;
+  return pass;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <boost/thread/mutex.hpp>
+#include "common.h"
+#include "user_opts.h"
+
+/* Estimate of the p quantile of a stream of values in constant memory
+ * (the P^2 algorithm of Jain and Chlamtac).  Five markers track the
+ * minimum, the p/2, p and (1+p)/2 quantiles and the maximum; their heights
+ * are adjusted with piecewise parabolic interpolation as values arrive.
+ * Until five values have been seen the estimate is exact.
+ */
+class streaming_quantile {
+  public:
+    explicit streaming_quantile(double p);
+
+    void add(double x);
+    double estimate() const; //NaN if nothing was added
+    sz size() const {
+      return count;
+    }
+
+  private:
+    double p;
+    sz count;
+    double q[5]; //marker heights
+    double n[5]; //marker positions
+    double np[5]; //desired marker positions
+    double dn[5]; //increments of the desired positions
+
+    double parabolic(int i, double d) const;
+    double linear(int i, int d) const;
+};
+
+/* Decides how far each ligand goes through the screening cascade: docking
+ * at screen_exhaustiveness with the empirical scoring function, then CNN
+ * rescoring of the reported modes, then a redock at full exhaustiveness
+ * with CNN refinement.  A ligand moves on if its result is at least as
+ * good as a fixed cutoff or in the requested top share of the ligands seen
+ * so far at that tier.  The first warmup ligands at each tier always move
+ * on while the quantile estimates settle.  Shared by the worker threads.
+ */
+class screen_filter {
+  public:
+    explicit screen_filter(const screen_options& opts);
+
+    //best empirical affinity (lower is better) of the quick docking
+    bool rescore(fl affinity);
+    //best cnn score (higher is better) of the rescored modes
+    bool redock(fl cnnscore);
+
+    sz num_docked() const {
+      return affinities.size();
+    }
+    sz num_rescored() const {
+      return rescored;
+    }
+    sz num_redocked() const {
+      return redocked;
+    }
+
+  private:
+    screen_options opts;
+    boost::mutex mtx;
+    streaming_quantile affinities;
+    streaming_quantile cnnscores;
+    sz rescored;
+    sz redocked;
+};
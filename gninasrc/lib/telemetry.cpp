@@ -0,0 +1,55 @@
+#include "telemetry.h"
+
+static const char* phase_names[NumPhases] = { "parse", "receptor", "populate",
+    "mc", "refine", "cnn_forward", "cnn_backward", "write" };
+
+static const char* count_names[NumCounts] = { "evals", "bfgs_iterations",
+    "line_searches" };
+
+#ifdef GNINA_TELEMETRY
+ligand_stats& thread_stats() {
+  static thread_local ligand_stats stats;
+  return stats;
+}
+#endif
+
+void ligand_stats::clear() {
+  for (unsigned i = 0; i < NumPhases; i++)
+    seconds[i] = 0;
+  for (unsigned i = 0; i < NumCounts; i++)
+    counts[i] = 0;
+}
+
+void ligand_stats::merge(const ligand_stats& other) {
+  for (unsigned i = 0; i < NumPhases; i++)
+    seconds[i] += other.seconds[i];
+  for (unsigned i = 0; i < NumCounts; i++)
+    counts[i] += other.counts[i];
+}
+
+static void write_json_string(std::ostream& out, const std::string& s) {
+  static const char hex[] = "0123456789abcdef";
+  out << '"';
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (c < 0x20)
+      out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+void ligand_stats::write_json(std::ostream& out, unsigned molid,
+    const std::string& name) const {
+  out << "{\"ligand\": " << molid << ", \"name\": ";
+  write_json_string(out, name);
+  out << ", \"seconds\": {";
+  for (unsigned i = 0; i < NumPhases; i++)
+    out << (i ? ", " : "") << '"' << phase_names[i] << "\": " << seconds[i];
+  out << "}";
+  for (unsigned i = 0; i < NumCounts; i++)
+    out << ", \"" << count_names[i] << "\": " << counts[i];
+  out << "}";
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+/* Per-ligand performance telemetry.  Each thread records into its own
+ * ligand_stats, so recording takes no locks; the stats travel with the
+ * ligand from the reading thread to a worker and on to the writer, which
+ * emits them as one JSON line (--stats).  Without GNINA_TELEMETRY the
+ * TELEMETRY_ macros expand to nothing.
+ */
+enum telemetry_phase {
+  PhaseParse,
+  PhaseReceptor,
+  PhasePopulate,
+  PhaseMC,
+  PhaseRefine,
+  PhaseCNNForward,
+  PhaseCNNBackward,
+  PhaseWrite,
+  NumPhases
+};
+
+enum telemetry_count {
+  CountEvals, CountBFGSIters, CountLineSearches, NumCounts
+};
+
+struct ligand_stats {
+    double seconds[NumPhases];
+    unsigned long counts[NumCounts];
+
+    ligand_stats() {
+      clear();
+    }
+    void clear();
+    void merge(const ligand_stats& other);
+    //a single JSON object, without a trailing newline
+    void write_json(std::ostream& out, unsigned molid,
+        const std::string& name) const;
+};
+
+#ifdef GNINA_TELEMETRY
+
+ligand_stats& thread_stats(); //stats of the ligand this thread is working on
+
+//adds its lifetime, or the time until stop, to a phase of this thread's stats
+class phase_timer {
+    telemetry_phase phase;
+    std::chrono::steady_clock::time_point start;
+    bool running;
+  public:
+    explicit phase_timer(telemetry_phase p)
+        : phase(p), start(std::chrono::steady_clock::now()), running(true) {
+    }
+    ~phase_timer() {
+      stop();
+    }
+    void stop() {
+      if (!running) return;
+      std::chrono::duration<double> d = std::chrono::steady_clock::now()
+          - start;
+      thread_stats().seconds[phase] += d.count();
+      running = false;
+    }
+};
+
+//stores what this thread records during its lifetime in into, leaving the
+//thread's own stats untouched; for work handed to helper threads
+class stats_capture {
+    ligand_stats outer;
+    ligand_stats& into;
+  public:
+    explicit stats_capture(ligand_stats& into_)
+        : outer(thread_stats()), into(into_) {
+      thread_stats().clear();
+    }
+    ~stats_capture() {
+      into = thread_stats();
+      thread_stats() = outer;
+    }
+};
+
+#define TELEMETRY_PHASE(name, phase) phase_timer name(phase)
+#define TELEMETRY_STOP(name) name.stop()
+#define TELEMETRY_CAPTURE(name, into) stats_capture name(into)
+#define TELEMETRY_COUNT(c) (++thread_stats().counts[c])
+#define TELEMETRY_MERGE(s) thread_stats().merge(s)
+#define TELEMETRY_RESET() thread_stats().clear()
+#define TELEMETRY_SAVE(s) ((s) = thread_stats())
+#define TELEMETRY_RESTORE(s) (thread_stats() = (s))
+
+#else
+
+#define TELEMETRY_PHASE(name, phase)
+#define TELEMETRY_STOP(name)
+#define TELEMETRY_CAPTURE(name, into)
+#define TELEMETRY_COUNT(c)
+#define TELEMETRY_MERGE(s)
+#define TELEMETRY_RESET()
+#define TELEMETRY_SAVE(s)
+#define TELEMETRY_RESTORE(s)
+
+#endif
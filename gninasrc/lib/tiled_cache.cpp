@@ -0,0 +1,332 @@
+#include <cmath>
+#include "tiled_cache.h"
+#include "brick.h"
+#include "curl.h"
+
+tiled_cache::tiled_cache(const model& m, const precalculate& p_,
+    const grid_dims& gd_, fl slope_, const std::vector<smt>& atom_types_needed,
+    const grid& user_grid_, fl saturation_)
+    : p(p_), user_grid(user_grid_), gd(gd_), slope(slope_),
+        saturation(saturation_), haschargeterms(p_.has_components()),
+        slots(num_atom_types(), -1), populated(0), saturated(0) {
+  saturated_tile.saturated = true;
+  VINA_FOR(i, 3) {
+    npoints[i] = gd[i].n + 1;
+    ntiles[i] = (gd[i].n + tile_cells - 1) / tile_cells;
+    if (ntiles[i] == 0) ntiles[i] = 1;
+    init[i] = gd[i].begin;
+    dim_fl_minus_1[i] = npoints[i] - 1.0;
+    factor[i] = dim_fl_minus_1[i] / gd[i].span();
+    factor_inv[i] = 1 / factor[i];
+  }
+
+  VINA_FOR_IN(i, atom_types_needed) {
+    smt t = atom_types_needed[i];
+    if (t < slots.size() && slots[t] < 0) {
+      slots[t] = needed.size();
+      needed.push_back(t);
+    }
+  }
+
+  sz n = num_tiles();
+  tiles.reset(new std::atomic<const tile*>[n]);
+  VINA_FOR(i, n)
+    tiles[i].store(NULL, std::memory_order_relaxed);
+
+  //bin the receptor atoms that can reach the box
+  const fl cutoff_sqr = p.cutoff_sqr();
+  cell_width = std::sqrt(cutoff_sqr);
+  vec start(gd[0].begin, gd[1].begin, gd[2].begin);
+  vec end(gd[0].end, gd[1].end, gd[2].end);
+  VINA_FOR(i, 3) {
+    cells_begin[i] = gd[i].begin - cell_width;
+    ncells[i] = sz(std::ceil(gd[i].span() / cell_width)) + 2;
+  }
+  cells.resize(ncells[0] * ncells[1] * ncells[2]);
+
+  VINA_FOR_IN(i, m.grid_atoms) {
+    const atom& a = m.grid_atoms[i];
+    if (!a.acceptable_type() || a.is_hydrogen()
+        || brick_distance_sqr(start, end, a.coords) >= cutoff_sqr) continue;
+    sz c[3];
+    VINA_FOR(j, 3) {
+      fl x = (a.coords[j] - cells_begin[j]) / cell_width;
+      c[j] = x < 0 ? 0 : std::min(sz(x), ncells[j] - 1);
+    }
+    cells[c[0] + ncells[0] * (c[1] + ncells[1] * c[2])].push_back(atoms.size());
+    rec_atom ra = { a.coords, a.get(), a.charge };
+    atoms.push_back(ra);
+  }
+}
+
+tiled_cache::~tiled_cache() {
+  VINA_FOR(i, num_tiles()) {
+    const tile* t = tiles[i].load(std::memory_order_relaxed);
+    if (t != &saturated_tile) delete t;
+  }
+}
+
+fl tiled_cache::eval(const model& m, fl v) const { // needs m.coords
+  fl e = 0;
+  sz nat = num_atom_types();
+
+  VINA_FOR(i, m.num_movable_atoms()) {
+    const atom& a = m.atoms[i];
+    smt t = a.get();
+    if (t >= nat || is_hydrogen(t)) continue;
+    assert(slots[t] >= 0);
+    e += evaluate(a, m.coords[i], v, NULL);
+  }
+  return e;
+}
+
+fl tiled_cache::eval_deriv(model& m, fl v, const grid& user_grid) const { // needs m.coords, sets m.minus_forces
+  fl e = 0;
+  sz nat = num_atom_types();
+
+  VINA_FOR(i, m.num_movable_atoms()) {
+    const atom& a = m.atoms[i];
+    smt t = a.get();
+    if (t >= nat || is_hydrogen(t)) {
+      m.minus_forces[i].assign(0);
+      continue;
+    }
+    assert(slots[t] >= 0);
+    vec deriv(0, 0, 0);
+    e += evaluate(a, m.coords[i], v, &deriv);
+    m.minus_forces[i] = deriv;
+  }
+  return e;
+}
+
+//return tile, computing and publishing it if nobody has yet
+const tiled_cache::tile* tiled_cache::get_tile(sz tx, sz ty, sz tz) const {
+  std::atomic<const tile*>& slot = tiles[tx + ntiles[0] * (ty + ntiles[1] * tz)];
+  const tile* t = slot.load(std::memory_order_acquire);
+  if (t) return t;
+
+  const tile* computed = compute_tile(tx, ty, tz);
+  if (slot.compare_exchange_strong(t, computed, std::memory_order_acq_rel,
+      std::memory_order_acquire)) {
+    if (computed->saturated)
+      saturated++;
+    else
+      populated++;
+    return computed;
+  }
+  //another thread got there first, t is now its tile
+  if (computed != &saturated_tile) delete computed;
+  return t;
+}
+
+//same computation as cache::populate, restricted to one tile
+const tiled_cache::tile* tiled_cache::compute_tile(sz tx, sz ty, sz tz) const {
+  const sz nslots = needed.size();
+  const sz stride = planes() * tile_size;
+  std::unique_ptr<fl[]> values(new fl[nslots * stride]());
+  const fl cutoff_sqr = p.cutoff_sqr();
+  const sz first[3] = { tx * tile_cells, ty * tile_cells, tz * tile_cells };
+  sz last[3]; //one past the last point inside the box
+  VINA_FOR(i, 3)
+    last[i] = std::min(first[i] + tile_points, npoints[i]);
+
+  vec begin, end;
+  VINA_FOR(i, 3) {
+    begin[i] = init[i] + factor_inv[i] * first[i];
+    end[i] = init[i] + factor_inv[i] * (last[i] - 1);
+  }
+
+  szv candidates;
+  sz clo[3], chi[3];
+  VINA_FOR(i, 3) {
+    fl lo = (begin[i] - cell_width - cells_begin[i]) / cell_width;
+    fl hi = (end[i] + cell_width - cells_begin[i]) / cell_width;
+    clo[i] = lo < 0 ? 0 : std::min(sz(lo), ncells[i] - 1);
+    chi[i] = hi < 0 ? 0 : std::min(sz(hi), ncells[i] - 1);
+  }
+  for (sz cz = clo[2]; cz <= chi[2]; cz++)
+    for (sz cy = clo[1]; cy <= chi[1]; cy++)
+      for (sz cx = clo[0]; cx <= chi[0]; cx++) {
+        const szv& cell = cells[cx + ncells[0] * (cy + ncells[1] * cz)];
+        VINA_FOR_IN(i, cell)
+          if (brick_distance_sqr(begin, end, atoms[cell[i]].coords)
+              < cutoff_sqr) candidates.push_back(cell[i]);
+      }
+
+  flv affinities(nslots);
+  flv chargeaffinities(nslots);
+  bool all_saturated = true;
+  for (sz x = first[0]; x < last[0]; x++) {
+    for (sz y = first[1]; y < last[1]; y++) {
+      for (sz z = first[2]; z < last[2]; z++) {
+        std::fill(affinities.begin(), affinities.end(), 0);
+        std::fill(chargeaffinities.begin(), chargeaffinities.end(), 0);
+        vec probe_coords(init[0] + factor_inv[0] * x,
+            init[1] + factor_inv[1] * y, init[2] + factor_inv[2] * z);
+        VINA_FOR_IN(ci, candidates) {
+          const rec_atom& a = atoms[candidates[ci]];
+          const fl r2 = vec_distance_sqr(a.coords, probe_coords);
+          if (r2 <= cutoff_sqr) {
+            VINA_FOR(j, nslots) {
+              result_components val = p.eval_fast(a.type, needed[j], r2);
+              if (haschargeterms) {
+                affinities[j] += val[result_components::TypeDependentOnly]
+                    + val[result_components::AbsAChargeDependent]
+                        * fabs(a.charge);
+                chargeaffinities[j] +=
+                    val[result_components::AbsBChargeDependent]
+                        + val[result_components::ABChargeDependent] * a.charge;
+              } else {
+                affinities[j] += val[result_components::TypeDependentOnly];
+              }
+            }
+          }
+        }
+        sz idx = (x - first[0])
+            + tile_points * ((y - first[1]) + tile_points * (z - first[2]));
+        VINA_FOR(j, nslots) {
+          fl* data = values.get() + j * stride;
+          data[idx] = affinities[j];
+          if (haschargeterms) data[tile_size + idx] = chargeaffinities[j];
+          if (user_grid.initialized())
+            data[idx] += user_grid.evaluate_user(vec(x, y, z), slope);
+          if (data[idx] < saturation) all_saturated = false;
+        }
+      }
+    }
+  }
+  std::unique_ptr<tile> ret(new tile);
+  ret->saturated = all_saturated && nslots > 0;
+  if (!ret->saturated)
+    ret->data = std::move(values);
+  else if (haschargeterms) {
+    //keep only the charge planes
+    ret->data.reset(new fl[nslots * tile_size]);
+    VINA_FOR(j, nslots)
+      std::copy(values.get() + j * stride + tile_size,
+          values.get() + (j + 1) * stride, ret->data.get() + j * tile_size);
+  } else
+    return &saturated_tile;
+  return ret.release();
+}
+
+fl tiled_cache::evaluate(const atom& a, const vec& location, fl v,
+    vec* deriv) const {
+  vec s = elementwise_product(location - init, factor);
+
+  vec miss(0, 0, 0);
+  boost::array<int, 3> region;
+  boost::array<sz, 3> t; //tile
+  boost::array<sz, 3> l; //cell within tile
+
+  VINA_FOR(i, 3) {
+    sz cell;
+    if (s[i] < 0) {
+      miss[i] = -s[i];
+      region[i] = -1;
+      cell = 0;
+      s[i] = 0;
+    } else
+      if (s[i] >= dim_fl_minus_1[i]) {
+        miss[i] = s[i] - dim_fl_minus_1[i];
+        region[i] = 1;
+        assert(npoints[i] >= 2);
+        cell = npoints[i] - 2;
+        s[i] = 1;
+      } else {
+        region[i] = 0;
+        cell = sz(s[i]);
+        s[i] -= cell;
+      }
+    t[i] = cell / tile_cells;
+    l[i] = cell - t[i] * tile_cells;
+  }
+  const fl penalty = slope * (miss * factor_inv);
+  assert(penalty > -epsilon_fl);
+
+  const tile* tl = get_tile(t[0], t[1], t[2]);
+  fl ret;
+  const fl* chargedata;
+  if (tl->saturated) {
+    fl f = saturation;
+    if (deriv) {
+      VINA_FOR(i, 3)
+        (*deriv)[i] = slope * region[i];
+    }
+    curl(f, v);
+    ret = f + penalty;
+    chargedata = tl->data.get() + slots[a.get()] * tile_size;
+  } else {
+    const fl* data = tl->data.get() + slots[a.get()] * planes() * tile_size;
+    ret = evaluate_aux(data, s, l, region, penalty, v, deriv);
+    chargedata = data + tile_size;
+  }
+
+  if (a.charge != 0 && haschargeterms) {
+    if (deriv == NULL) {
+      ret += a.charge
+          * evaluate_aux(chargedata, s, l, region, penalty, v, NULL);
+    } else {
+      vec cderiv(0, 0, 0);
+      ret += a.charge
+          * evaluate_aux(chargedata, s, l, region, penalty, v, &cderiv);
+      *deriv += a.charge * cderiv;
+    }
+  }
+  return ret;
+}
+
+//trilinear interpolation within a tile, as in grid::evaluate_aux
+fl tiled_cache::evaluate_aux(const fl* data, const vec& s,
+    const boost::array<sz, 3>& l, const boost::array<int, 3>& region,
+    fl penalty, fl v, vec* deriv) const {
+  const sz sy = tile_points;
+  const sz sz_ = tile_points * tile_points;
+  const fl* d = data + l[0] + sy * l[1] + sz_ * l[2];
+
+  const fl f000 = d[0];
+  const fl f100 = d[1];
+  const fl f010 = d[sy];
+  const fl f110 = d[sy + 1];
+  const fl f001 = d[sz_];
+  const fl f101 = d[sz_ + 1];
+  const fl f011 = d[sz_ + sy];
+  const fl f111 = d[sz_ + sy + 1];
+
+  const fl x = s[0];
+  const fl y = s[1];
+  const fl z = s[2];
+
+  const fl mx = 1 - x;
+  const fl my = 1 - y;
+  const fl mz = 1 - z;
+
+  fl f = f000 * mx * my * mz + f100 * x * my * mz + f010 * mx * y * mz
+      + f110 * x * y * mz + f001 * mx * my * z + f101 * x * my * z
+      + f011 * mx * y * z + f111 * x * y * z;
+
+  if (deriv) {
+    const fl x_g = f000 * (-1) * my * mz + f100 * 1 * my * mz
+        + f010 * (-1) * y * mz + f110 * 1 * y * mz + f001 * (-1) * my * z
+        + f101 * 1 * my * z + f011 * (-1) * y * z + f111 * 1 * y * z;
+
+    const fl y_g = f000 * mx * (-1) * mz + f100 * x * (-1) * mz
+        + f010 * mx * 1 * mz + f110 * x * 1 * mz + f001 * mx * (-1) * z
+        + f101 * x * (-1) * z + f011 * mx * 1 * z + f111 * x * 1 * z;
+
+    const fl z_g = f000 * mx * my * (-1) + f100 * x * my * (-1)
+        + f010 * mx * y * (-1) + f110 * x * y * (-1) + f001 * mx * my * 1
+        + f101 * x * my * 1 + f011 * mx * y * 1 + f111 * x * y * 1;
+
+    vec gradient(x_g, y_g, z_g);
+    curl(f, gradient, v);
+
+    VINA_FOR(i, 3)
+      (*deriv)[i] = factor[i] * ((region[i] == 0) ? gradient[i] : 0)
+          + slope * region[i];
+    return f + penalty;
+  } else {
+    curl(f, v);
+    return f + penalty;
+  }
+}
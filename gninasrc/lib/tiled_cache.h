@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "igrid.h"
+#include "grid.h"
+#include "model.h"
+#include "precalculate.h"
+
+/* Sparse alternative to cache for very large (e.g. whole protein) boxes.
+ * The box is split into tiles of tile_cells^3 grid cells which are computed
+ * the first time an atom lands in them, so memory and setup time scale with
+ * the region the search actually visits.  A tile stores its boundary points
+ * as well, so every interpolation reads from a single tile.  Tiles are
+ * published with a compare and swap; a thread that loses the race discards
+ * its own copy.  Where every type dependent value of a tile is at least the
+ * saturation energy (deep inside the receptor) those values are not stored
+ * and evaluate to that energy; the charge dependent planes, if the scoring
+ * function has any, are still stored and interpolated.
+ */
+class tiled_cache : public igrid {
+  public:
+    static const sz tile_cells = 8;
+    static const sz tile_points = tile_cells + 1;
+    static const sz tile_size = tile_points * tile_points * tile_points;
+
+    tiled_cache(const model& m, const precalculate& p, const grid_dims& gd,
+        fl slope, const std::vector<smt>& atom_types_needed,
+        const grid& user_grid, fl saturation = 1000);
+    virtual ~tiled_cache();
+
+    fl eval(const model& m, fl v) const; // needs m.coords
+    fl eval_deriv(model& m, fl v, const grid& user_grid) const; // needs m.coords, sets m.minus_forces
+
+    sz num_tiles() const {
+      return ntiles[0] * ntiles[1] * ntiles[2];
+    }
+    sz num_populated_tiles() const {
+      return populated;
+    }
+    sz num_saturated_tiles() const {
+      return saturated;
+    }
+
+  private:
+    //receptor atom reduced to what populating needs
+    struct rec_atom {
+        vec coords;
+        smt type;
+        fl charge;
+    };
+
+    //values of one tile; saturated tiles only have the charge planes, so
+    //without charge terms they have no data and are all shared
+    struct tile {
+        bool saturated;
+        std::unique_ptr<fl[]> data;
+    };
+
+    const precalculate& p;
+    const grid& user_grid;
+    grid_dims gd;
+    fl slope;
+    fl saturation;
+    bool haschargeterms;
+
+    vec init; //same conventions as grid
+    vec factor;
+    vec factor_inv;
+    vec dim_fl_minus_1;
+    sz npoints[3];
+    sz ntiles[3];
+
+    std::vector<smt> needed; //slot -> smina type
+    std::vector<int> slots; //smina type -> slot, -1 if not needed
+
+    //receptor atoms binned into cutoff sized cells for populating tiles
+    std::vector<rec_atom> atoms;
+    std::vector<szv> cells;
+    vec cells_begin;
+    fl cell_width;
+    sz ncells[3];
+
+    std::unique_ptr<std::atomic<const tile*>[]> tiles;
+    mutable std::atomic<sz> populated;
+    mutable std::atomic<sz> saturated;
+    tile saturated_tile; //shared by saturated tiles without charge planes
+
+    sz planes() const {
+      return haschargeterms ? 2 : 1;
+    }
+    const tile* get_tile(sz tx, sz ty, sz tz) const;
+    const tile* compute_tile(sz tx, sz ty, sz tz) const;
+    fl evaluate(const atom& a, const vec& location, fl v, vec* deriv) const;
+    fl evaluate_aux(const fl* data, const vec& s, const boost::array<sz, 3>& l,
+        const boost::array<int, 3>& region, fl penalty, fl v,
+        vec* deriv) const;
+};
@@ -1,6 +1,9 @@
 #pragma once
 #include "common.h"
+#include "reduced_precision.h"
+#include "random.h"
 #include <string>
+#include <vector>
 
 struct cnn_options {
     //stores options associated with cnn scoring
@@ -9,9 +12,16 @@ struct cnn_options {
     std::string cnn_recmap; //optional file specifying receptor atom typing to channel map
     std::string cnn_ligmap; //optional file specifying ligand atom typing to channel map
     std::string cnn_model_name; // name of builtin model
+    std::string cnn_quantization; //optional int8 input ranges from caffe calibrate
+    //further models averaged with the one above: built-in names, and model
+    //files paired with weights files in the same order
+    std::vector<std::string> ensemble_names;
+    std::vector<std::string> ensemble_models;
+    std::vector<std::string> ensemble_weights;
     vec cnn_center;
     fl resolution; //this isn't specified in model file, so be careful about straying from default
     unsigned cnn_rotations; //do we want to score multiple orientations?
+    unsigned mask_batch; //masked variants per forward pass in score_masked
     double subgrid_dim;
     bool cnn_scoring; //if true, do cnn_scoring of final pose
     bool cnn_refinement;
@@ -20,15 +30,17 @@ struct cnn_options {
     bool gradient_check;
     bool move_minimize_frame;  //recenter with every scoring evaluation
     bool fix_receptor;
+    bool cache_receptor_conv; //reuse receptor part of first convolution
+    bool forward_only; //gradients are never requested, build net for inference
     bool verbose;
     std::string xyzprefix;
     unsigned seed; //random seed
 
     cnn_options()
-        : cnn_model_name("default2017"), cnn_center(NAN, NAN, NAN), resolution(0.5), cnn_rotations(0),
+        : cnn_model_name("default2017"), cnn_center(NAN, NAN, NAN), resolution(0.5), cnn_rotations(0), mask_batch(1),
             subgrid_dim(0.0), cnn_scoring(false), cnn_refinement(false), outputdx(false),
             outputxyz(false), gradient_check(false), move_minimize_frame(false),
-            fix_receptor(false), verbose(false), seed(0) {
+            fix_receptor(false), cache_receptor_conv(false), forward_only(false), verbose(false), seed(0) {
     }
 
     bool moving_receptor() const {
@@ -39,6 +51,22 @@ struct cnn_options {
     }
 };
 
+struct screen_options {
+    //stores options of the tiered screening cascade
+    bool enabled;
+    int exhaustiveness; //of the first docking, scored empirically
+    fl top_percent; //share of docked ligands rescored with the cnn
+    fl affinity; //docked ligands at or below this always rescored; NaN if unset
+    fl cnn_top_percent; //share of rescored ligands redocked with cnn refinement
+    fl cnn_score; //rescored ligands at or above this always redocked; NaN if unset
+    sz warmup; //ligands passed on at each tier before thresholds are used
+
+    screen_options()
+        : enabled(false), exhaustiveness(2), top_percent(10), affinity(NAN),
+            cnn_top_percent(20), cnn_score(NAN), warmup(50) {
+    }
+};
+
 //just a collection of user-specified configurations
 struct user_settings {
     fl energy_range;
@@ -56,10 +84,15 @@ struct user_settings {
     bool randomize_only;
     bool local_only;
     bool dominimize;
+    bool minimize_grid; //local search against one grid shared by all ligands
+    bool sparse_grid; //populate the receptor grid lazily in tiles
+    grid_precision grid_prec; //storage of the precomputed receptor grid
+    bool check_grid_precision; //report error of grid_prec against fp32
     bool include_atom_info;
     bool gpu_on;
 
     cnn_options cnnopts;
+    screen_options screenopts;
 
     //reasonable defaults
     user_settings()
@@ -67,7 +100,9 @@ struct user_settings {
             seed(auto_seed()), verbosity(1), cpu(1), device(0),
             exhaustiveness(10), num_mc_steps(0), score_only(false),
             randomize_only(false), local_only(false), dominimize(false),
-            include_atom_info(false), gpu_on(false) {
+            minimize_grid(false), sparse_grid(false), grid_prec(GridFP32),
+            check_grid_precision(false), include_atom_info(false),
+            gpu_on(false) {
 
     }
 };
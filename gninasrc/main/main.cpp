@@ -18,6 +18,8 @@
 #include "file.h"
 #include "cache.h"
 #include "cache_gpu.h"
+#include "tiled_cache.h"
+#include "telemetry.h"
 #include "non_cache.h"
 #include "naive_non_cache.h"
 #include "non_cache_gpu.h"
@@ -29,6 +31,8 @@
 #include "tee.h"
 #include "custom_terms.h"
 #include "cnn_scorer.h"
+#include "screening.h"
+#include "caffe/util/parallel_for.hpp"
 #include <openbabel/babelconfig.h>
 #include <openbabel/mol.h>
 #include <openbabel/parsmart.h>
@@ -54,6 +58,8 @@
 #include <boost/ref.hpp>
 #include <boost/bind.hpp>
 #include <boost/lockfree/queue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
 #include <boost/unordered_map.hpp>
 #include "sem.h"
 #include "user_opts.h"
@@ -173,6 +179,22 @@ void refine_structure(model& m, const precalculate& prec, non_cache& nc,
   nc.setSlope(slope_orig);
 }
 
+//minimize against a precomputed receptor grid; poses that leave the grid
+//or their own box are refined again with pairwise interactions
+void refine_on_grid(model& m, const precalculate& prec, cache& c,
+    non_cache& nc, output_type& out, const vec& cap,
+    const minimization_params& minparm, grid& user_grid, bool gpu_on)
+    {
+  change g(m.get_size(), c.move_receptor());
+  quasi_newton quasi_newton_par(minparm);
+  quasi_newton_par(m, prec, c, out, g, cap, user_grid);
+  m.set(out.c);
+  if (c.within(m) && nc.within(m))
+    out.coords = m.get_heavy_atom_movable_coords();
+  else
+    refine_structure(m, prec, nc, out, cap, minparm, user_grid, gpu_on);
+}
+
 std::string vina_remark(fl e, fl lb, fl ub)
     {
   std::ostringstream remark;
@@ -217,6 +239,14 @@ static void get_cnn_info(model& m, CNNScorer& cnn, tee& log, float& cnnscore,
     log << "CNNaffinity: " << std::fixed << std::setprecision(10)
         << cnnaffinity;
     log.endl();
+    if (cnn.ensemble_size() > 1) {
+      log << "CNNvariance: " << std::fixed << std::setprecision(10)
+          << cnn.score_variance();
+      log.endl();
+      log << "CNNaffinity_variance: " << std::fixed << std::setprecision(10)
+          << cnn.affinity_variance();
+      log.endl();
+    }
   }
 }
 
@@ -228,10 +258,8 @@ void do_search(model& m, const boost::optional<model>& ref,
     const parallel_mc& par, const user_settings& settings,
     bool compute_atominfo, tee& log,
     const terms *t, grid& user_grid, CNNScorer& cnn,
-    std::vector<result_info>& results)
+    std::vector<result_info>& results, screen_filter* screen = NULL)
     {
-  boost::timer::cpu_timer time;
-
   precalculate_exact exact_prec(sf); //use exact computations for final score
   conf_size s = m.get_size();
   conf c = m.get_initial_conf(nc.move_receptor());
@@ -294,8 +322,15 @@ void do_search(model& m, const boost::optional<model>& ref,
     vecv origcoords = m.get_heavy_atom_movable_coords();
     output_type out(c, e);
     doing(settings.verbosity, "Performing local search", log);
-    refine_structure(m, prec, nc, out, authentic_v, par.mc.ssd_par.minparm,
-        user_grid, settings.gpu_on);
+    {
+      TELEMETRY_PHASE(refine_timer, PhaseRefine);
+      if (settings.minimize_grid)
+        refine_on_grid(m, prec, dynamic_cast<cache&>(ig), nc, out, authentic_v,
+            par.mc.ssd_par.minparm, user_grid, settings.gpu_on);
+      else
+        refine_structure(m, prec, nc, out, authentic_v, par.mc.ssd_par.minparm,
+            user_grid, settings.gpu_on);
+    }
     done(settings.verbosity, log);
     m.set(out.c);
 
@@ -340,13 +375,18 @@ void do_search(model& m, const boost::optional<model>& ref,
     log.endl();
     output_container out_cont;
     doing(settings.verbosity, "Performing search", log);
-    par(m, out_cont, prec, ig, corner1, corner2, generator, user_grid);
+    {
+      TELEMETRY_PHASE(mc_timer, PhaseMC);
+      par(m, out_cont, prec, ig, corner1, corner2, generator, user_grid);
+    }
     done(settings.verbosity, log);
     doing(settings.verbosity, "Refining results", log);
+    TELEMETRY_PHASE(refine_timer, PhaseRefine);
     VINA_FOR_IN(i, out_cont) {
       refine_structure(m, prec, nc, out_cont[i], authentic_v,
           par.mc.ssd_par.minparm, user_grid, settings.gpu_on);
-      get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnforces);
+      if (!screen)
+        get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnforces);
     }
 
     if (!out_cont.empty())
@@ -382,6 +422,15 @@ void do_search(model& m, const boost::optional<model>& ref,
     if (!out_cont.empty())
       best_mode_model.set(out_cont.front().c);
 
+    //when screening, only ligands that dock well enough are scored by the cnn
+    bool cnn_rescore = true;
+    if (screen && !out_cont.empty() && not_max(out_cont[0].e))
+    {
+      cnn_rescore = screen->rescore(out_cont[0].e);
+      if (cnn_rescore)
+        cnn.set_center_from_model(best_mode_model);
+    }
+
     sz how_many = 0;
     VINA_FOR_IN(i, out_cont)
     {
@@ -403,8 +452,14 @@ void do_search(model& m, const boost::optional<model>& ref,
       float cnnaffinity = -1;
       float cnnforces = -1;
       float loss = 0;
-      cnnscore = cnn.score(m, true, cnnaffinity, loss);
-      cnnforces = m.get_minus_forces_sum_magnitude();
+      //only the score is reported, so skip the backward pass
+      if (cnn_rescore)
+        cnnscore = cnn.score(m, false, cnnaffinity, loss);
+      else
+      {
+        cnnscore = -1;
+        cnnaffinity = 0;
+      }
       //dkoes - setup result_info
       results.push_back(
           result_info(out_cont[i].e, cnnscore, cnnaffinity, cnnforces, -1, m));
@@ -423,7 +478,6 @@ void do_search(model& m, const boost::optional<model>& ref,
       log.endl();
     }
   }
-  std::cout << "Refine time " << time.elapsed().wall / 1000000000.0 << "\n";
 }
 
 void load_ent_values(const grid_dims& gd, std::istream& user_in,
@@ -446,13 +500,71 @@ void load_ent_values(const grid_dims& gd, std::istream& user_in,
   std::cout << user_data(gd[0].n - 3, gd[1].n, gd[2].n) << "\n";
 }
 
+//receptor grid shared by every ligand with --minimize_grid; atom types are
+//populated the first time a ligand needs them
+struct shared_grid
+{
+    cache c;
+    boost::mutex mutex;
+
+    shared_grid(const grid_dims& gd, fl slope, grid_precision precision)
+        :
+            c("scoring_function_version001", gd, slope)
+    {
+      c.set_precision(precision);
+    }
+
+    void populate(const model& m, const precalculate& prec, grid& user_grid)
+        {
+      std::vector<smt> atom_types_needed;
+      m.get_movable_atom_types(atom_types_needed);
+      boost::lock_guard<boost::mutex> lock(mutex);
+      c.populate(m, prec, atom_types_needed, user_grid, false);
+    }
+};
+
+//smallest box containing the boxes of every input ligand
+grid_dims ligand_union_box(MolGetter& mols,
+    const std::vector<std::string>& ligand_names, fl autobox_add,
+    fl granularity)
+    {
+  grid_dims gd;
+  bool first = true;
+  VINA_FOR_IN(l, ligand_names)
+  {
+    mols.setInputFile(ligand_names[l]);
+    for (;;)
+    {
+      model m;
+      if (!mols.readMoleculeIntoModel(m))
+        break;
+      grid_dims lgd = m.movable_atoms_box(autobox_add, granularity);
+      VINA_FOR_IN(i, gd)
+      {
+        if (first || lgd[i].begin < gd[i].begin) gd[i].begin = lgd[i].begin;
+        if (first || lgd[i].end > gd[i].end) gd[i].end = lgd[i].end;
+      }
+      first = false;
+    }
+  }
+  if (first)
+    throw usage_error("No ligands to compute --minimize_grid box from");
+  VINA_FOR_IN(i, gd)
+  {
+    gd[i].n = sz(std::ceil((gd[i].end - gd[i].begin) / granularity));
+    gd[i].end = gd[i].begin + granularity * gd[i].n;
+  }
+  return gd;
+}
+
 void main_procedure(model& m, precalculate& prec,
     const boost::optional<model>& ref, // m is non-const (FIXME?)
     const user_settings& settings,
     bool no_cache, bool compute_atominfo,
     const grid_dims& gd, minimization_params minparm,
     const weighted_terms& wt, tee& log,
-    std::vector<result_info>& results, grid& user_grid, CNNScorer& cnn)
+    std::vector<result_info>& results, grid& user_grid, CNNScorer& cnn,
+    shared_grid* sgrid, screen_filter* screen = NULL)
     {
   doing(settings.verbosity, "Setting up the scoring function", log);
 
@@ -481,7 +593,6 @@ void main_procedure(model& m, precalculate& prec,
   par.num_threads = settings.cpu;
   par.display_progress = true;
 
-  szv_grid_cache gridcache(m, prec.cutoff_sqr());
   const fl slope = 1e3; // FIXME: too large? used to be 100
   if (settings.randomize_only)
   {
@@ -494,6 +605,9 @@ void main_procedure(model& m, precalculate& prec,
   }
   else
   {
+    //randomize_only does no receptor setup, so only time it here
+    TELEMETRY_PHASE(receptor_timer, PhaseReceptor);
+    szv_grid_cache gridcache(m, prec.cutoff_sqr());
     non_cache *nc = NULL;
     if (settings.gpu_on)
     {
@@ -519,12 +633,38 @@ void main_procedure(model& m, precalculate& prec,
         nc = new non_cache(gridcache, gd, &prec, slope);
       }
     }
+    TELEMETRY_STOP(receptor_timer);
 
-    if (no_cache || settings.cnnopts.cnn_scoring)  {
+    if (sgrid && settings.local_only)
+    {
+      {
+        TELEMETRY_PHASE(populate_timer, PhasePopulate);
+        sgrid->populate(m, prec, user_grid);
+      }
+      do_search(m, ref, wt, prec, sgrid->c, *nc, corner1, corner2, par,
+          settings, compute_atominfo, log,
+          wt.unweighted_terms(), user_grid, cnn, results, screen);
+    }
+    else if (no_cache || settings.cnnopts.cnn_scoring)  {
       do_search(m, ref, wt, prec, *nc, *nc, corner1, corner2, par,
           settings, compute_atominfo, log,
           wt.unweighted_terms(), user_grid, cnn,
-          results);
+          results, screen);
+    }
+    else if (settings.sparse_grid && !(settings.score_only
+        || settings.randomize_only || settings.local_only))
+    {
+      //tiles are computed on demand during the search
+      std::vector<smt> atom_types_needed;
+      m.get_movable_atom_types(atom_types_needed);
+      tiled_cache tc(m, prec, gd, slope, atom_types_needed, user_grid);
+      do_search(m, ref, wt, prec, tc, *nc, corner1, corner2, par,
+          settings, compute_atominfo, log,
+          wt.unweighted_terms(), user_grid, cnn, results, screen);
+      if (settings.verbosity > 1)
+        log << "Grid tiles computed: " << tc.num_populated_tiles()
+            << " saturated: " << tc.num_saturated_tiles() << " of "
+            << tc.num_tiles() << '\n';
     }
     else
     {
@@ -540,16 +680,33 @@ void main_procedure(model& m, precalculate& prec,
               new cache_gpu("scoring_function_version001",
                   gd, slope, dynamic_cast<precalculate_gpu*>(&prec)) :
               new cache("scoring_function_version001", gd, slope));
+      if (!settings.gpu_on)
+        c->set_precision(settings.grid_prec);
       if (cache_needed)
       {
         std::vector<smt> atom_types_needed;
         m.get_movable_atom_types(atom_types_needed);
-        c->populate(m, prec, atom_types_needed, user_grid);
+        {
+          TELEMETRY_PHASE(populate_timer, PhasePopulate);
+          c->populate(m, prec, atom_types_needed, user_grid);
+        }
         done(settings.verbosity, log);
+        if (settings.check_grid_precision)
+        {
+          cache reference("scoring_function_version001", gd, slope);
+          reference.populate(m, prec, atom_types_needed, user_grid);
+          fl edev = 0, gdev = 0;
+          c->max_deviation(reference, atom_types_needed, 10000, 1000, edev,
+              gdev);
+          log << "Grid precision check: max energy deviation " << edev
+              << " max gradient deviation " << gdev << " grid bytes "
+              << c->memory_bytes() << " (fp32 " << reference.memory_bytes()
+              << ")\n";
+        }
       }
       do_search(m, ref, wt, prec, *c, *nc, corner1, corner2, par,
           settings, compute_atominfo, log,
-          wt.unweighted_terms(), user_grid, cnn, results);
+          wt.unweighted_terms(), user_grid, cnn, results, screen);
     }
 
     delete nc;
@@ -762,6 +919,23 @@ std::istream& operator>>(std::istream& in, ApproxType& type)
   return in;
 }
 
+std::istream& operator>>(std::istream& in, grid_precision& precision)
+    {
+  using namespace boost::program_options;
+
+  std::string token;
+  in >> token;
+  if (token == "fp32")
+    precision = GridFP32;
+  else if (token == "fp16")
+    precision = GridFP16;
+  else if (token == "bf16")
+    precision = GridBF16;
+  else
+    throw validation_error(validation_error::invalid_option_value);
+  return in;
+}
+
 //set the default device to device and exit with error if there are any problems
 void initializeCUDA(int device)
     {
@@ -810,6 +984,7 @@ struct worker_job
     model* m;
     std::vector<result_info>* results;
     grid_dims gd;
+    ligand_stats stats; //telemetry so far, i.e. parsing
 
     worker_job(unsigned int molid, model* m, std::vector<result_info>* results,
         grid_dims gd)
@@ -837,6 +1012,7 @@ struct writer_job
 {
     unsigned int molid;
     std::vector<result_info>* results;
+    ligand_stats stats;
 
     writer_job(unsigned int molid, std::vector<result_info>* results)
         :
@@ -901,45 +1077,96 @@ struct global_state
     tee* log;
     std::ofstream* atomoutfile;
     cnn_options cnnopts;
+    shared_grid* sgrid;
+    std::ofstream* statsfile; //per-ligand telemetry, if open
+    screen_filter* screen; //tiered screening thresholds, if screening
 
     global_state(user_settings* settings, boost::shared_ptr<precalculate> prec,
         minimization_params* minparms, weighted_terms* wt,
-        grid* user_grid, tee* log, std::ofstream* atomoutfile, const cnn_options& co):
+        grid* user_grid, tee* log, std::ofstream* atomoutfile, const cnn_options& co,
+        shared_grid* sgrid = NULL, std::ofstream* statsfile = NULL,
+        screen_filter* screen = NULL):
         settings(settings), prec(prec), minparms(minparms), wt(wt),
             user_grid(user_grid), log(log), atomoutfile(atomoutfile),
-            cnnopts(co)
+            cnnopts(co), sgrid(sgrid), statsfile(statsfile), screen(screen)
     {
     }
     ;
 };
 
+//run one ligand through the screening tiers: docking at screen_exhaustiveness
+//scored empirically, cnn rescoring of its modes if the docking score passes,
+//and if the cnn score passes too, redocking at full exhaustiveness with cnn
+//refinement; the results of the last tier reached are kept
+static void screen_ligand(worker_job& j, global_state* gs, CNNScorer& cnn,
+    bool compute_atominfo)
+    {
+  tee& log = *gs->log;
+  model redock_m = *j.m; //before the first docking touches it
+  redock_m.gdata.device_on = j.m->gdata.device_on;
+  redock_m.gdata.device_id = j.m->gdata.device_id;
+  user_settings quick = *gs->settings;
+  quick.exhaustiveness = quick.screenopts.exhaustiveness;
+  main_procedure(*j.m, *gs->prec, boost::optional<model>(), quick,
+      false, compute_atominfo, j.gd, *gs->minparms, *gs->wt, log,
+      *j.results, *gs->user_grid, cnn, gs->sgrid, gs->screen);
+
+  fl best = -1;
+  for (unsigned i = 0, n = j.results->size(); i < n; i++)
+    best = std::max(best, (*j.results)[i].getCNNScore());
+  if (best < 0 || !gs->screen->redock(best))
+  {
+    log << "Screening tier: " << (best < 0 ? 1 : 2);
+    log.endl();
+    return;
+  }
+
+  j.results->clear();
+  user_settings full = *gs->settings;
+  full.cnnopts.cnn_refinement = true;
+  main_procedure(redock_m, *gs->prec, boost::optional<model>(), full,
+      false, compute_atominfo, j.gd, *gs->minparms, *gs->wt, log,
+      *j.results, *gs->user_grid, cnn, gs->sgrid);
+  log << "Screening tier: 3";
+  log.endl();
+}
+
 //function to occupy the worker threads with individual ligands from the work queue
-//TODO: see if implementing weight sharing between CNNScorer instances results
-//in enough memory efficiency to avoid using a single one
 void threads_at_work(job_queue<worker_job>* wrkq,
     job_queue<writer_job>* writerq, global_state* gs,
-    MolGetter* mols, int* nligs, CNNScorer cnn_scorer) //copy cnn_scorer so it can maintain state
+    MolGetter* mols, int* nligs)
     {
   if (gs->settings->gpu_on) {
     initializeCUDA(gs->settings->device);
-    if (!(gs->cnnopts.cnn_scoring || gs->cnnopts.cnn_refinement))
+    //screening docks without the cnn first, so check the settings rather
+    //than the scorer's options
+    if (!(gs->settings->cnnopts.cnn_scoring
+        || gs->settings->cnnopts.cnn_refinement))
       thread_buffer.init(available_mem(gs->settings->cpu));
   }
+  //own activations so threads score in parallel; weights are shared
+  CNNScorer cnn_scorer(gs->cnnopts);
 
   worker_job j;
   while (!wrkq->wait_and_pop(j))
   {
     __sync_fetch_and_add(nligs, 1);
+    TELEMETRY_RESTORE(j.stats);
 
-    main_procedure(*(j.m), *gs->prec, boost::optional<model>(),
-        *gs->settings,
-        false, // no_cache == false
-        gs->atomoutfile->is_open()
-            || gs->settings->include_atom_info, j.gd,
-        *gs->minparms, *gs->wt, *gs->log, *(j.results),
-        *gs->user_grid, cnn_scorer);
+    bool compute_atominfo = gs->atomoutfile->is_open()
+        || gs->settings->include_atom_info;
+    if (gs->screen)
+      screen_ligand(j, gs, cnn_scorer, compute_atominfo);
+    else
+      main_procedure(*(j.m), *gs->prec, boost::optional<model>(),
+          *gs->settings,
+          false, // no_cache == false
+          compute_atominfo, j.gd,
+          *gs->minparms, *gs->wt, *gs->log, *(j.results),
+          *gs->user_grid, cnn_scorer, gs->sgrid);
 
     writer_job k(j.molid, j.results);
+    TELEMETRY_SAVE(k.stats);
     writerq->push(k);
     delete j.m;
   }
@@ -973,6 +1200,26 @@ void write_out(std::vector<result_info> &results, ozfile &outfile,
   }
 }
 
+//write out one ligand's results, followed by its telemetry line if requested
+void write_ligand(writer_job& j, global_state* gs, ozfile* outfile,
+    std::string* outext, ozfile* outflex, std::string* outfext)
+    {
+  TELEMETRY_RESTORE(j.stats);
+  {
+    TELEMETRY_PHASE(write_timer, PhaseWrite);
+    write_out(*j.results, *outfile, *outext, *gs->settings, *gs->wt,
+        *outflex, *outfext, *gs->atomoutfile);
+  }
+  if (gs->statsfile && gs->statsfile->is_open())
+  {
+    TELEMETRY_SAVE(j.stats);
+    j.stats.write_json(*gs->statsfile, j.molid,
+        j.results->empty() ? std::string() : j.results->front().getName());
+    *gs->statsfile << '\n';
+  }
+  delete j.results;
+}
+
 //function for the writing thread to write ligands in order to output file
 void thread_a_writing(job_queue<writer_job>* writerq,
     global_state* gs,
@@ -981,26 +1228,22 @@ void thread_a_writing(job_queue<writer_job>* writerq,
     int* nligs) {
   try {
     int nwritten = 0;
-    boost::unordered_map<int, std::vector<result_info>*> proc_out;
+    boost::unordered_map<int, writer_job> proc_out;
     writer_job j;
     while (!writerq->wait_and_pop(j))
     {
       if (j.molid == nwritten) {
-        write_out(*j.results, *outfile, *outext, *gs->settings, *gs->wt,
-            *outflex, *outfext, *gs->atomoutfile);
+        write_ligand(j, gs, outfile, outext, outflex, outfext);
         nwritten++;
-        delete j.results;
-        for (boost::unordered_map<int, std::vector<result_info>*>::iterator i;
+        for (boost::unordered_map<int, writer_job>::iterator i;
             (i = proc_out.find(nwritten)) != proc_out.end();)
             {
-          write_out(*i->second, *outfile, *outext, *gs->settings,
-              *gs->wt, *outflex, *outfext, *gs->atomoutfile);
+          write_ligand(i->second, gs, outfile, outext, outflex, outfext);
           nwritten++;
-          delete i->second;
         }
       }
       else {
-        proc_out[j.molid] = j.results;
+        proc_out[j.molid] = j;
       }
     }
   } catch (file_error& e)
@@ -1054,7 +1297,8 @@ Thank you!\n";
 
   try
   {
-    std::string rigid_name, flex_name, config_name, log_name, atom_name;
+    std::string rigid_name, flex_name, config_name, log_name, atom_name,
+        stats_name;
     std::vector<std::string> ligand_names;
     std::string out_name;
     std::string outf_name;
@@ -1142,7 +1386,9 @@ Thank you!\n";
         "optionally write per-atom interaction term values")
     ("atom_term_data",
         bool_switch(&settings.include_atom_info)->default_value(false),
-        "embedded per-atom interaction terms in output sd data");
+        "embedded per-atom interaction terms in output sd data")
+    ("stats", value<std::string>(&stats_name),
+        "write per-ligand timings and evaluation counts to this file as JSON lines");
 
     options_description scoremin("Scoring and minimization options");
     scoremin.add_options()
@@ -1158,6 +1404,14 @@ Thank you!\n";
         "local search only using autobox (you probably want to use --minimize)")
     ("minimize", bool_switch(&settings.dominimize)->default_value(false),
         "energy minimization")
+    ("minimize_grid", bool_switch(&settings.minimize_grid)->default_value(false),
+        "with --minimize or --local_only, minimize every ligand against one receptor grid covering all of them (or the search box, if given); final scores are still exact")
+    ("sparse_grid", bool_switch(&settings.sparse_grid)->default_value(false),
+        "compute the receptor grid in tiles as the search reaches them; use for very large (e.g. whole protein) search boxes")
+    ("grid_precision", value<grid_precision>(&settings.grid_prec),
+        "storage precision of the receptor grid (fp32, fp16, or bf16); 16 bit grids use half the memory")
+    ("check_grid_precision", bool_switch(&settings.check_grid_precision)->default_value(false),
+        "also compute an fp32 grid and report the largest energy and gradient deviation of --grid_precision from it")
     ("randomize_only", bool_switch(&settings.randomize_only),
         "generate random poses, attempting to avoid clashes")
     ("num_mc_steps", value<int>(&settings.num_mc_steps),
@@ -1206,6 +1460,12 @@ Thank you!\n";
         "caffe cnn model file; if not specified a default model will be used")
     ("cnn_weights", value<std::string>(&cnnopts.cnn_weights),
         "caffe cnn weights file (*.caffemodel); if not specified default weights (trained on the default model) will be used")
+    ("cnn_ensemble", value<std::vector<std::string> >(&cnnopts.ensemble_names)->multitoken(),
+        "further built-in models to score with; scores and affinities are averaged over all models, which must use the same grid")
+    ("cnn_ensemble_model", value<std::vector<std::string> >(&cnnopts.ensemble_models),
+        "further caffe cnn model file to score with (may be repeated), each with a cnn_ensemble_weights")
+    ("cnn_ensemble_weights", value<std::vector<std::string> >(&cnnopts.ensemble_weights),
+        "weights for each cnn_ensemble_model, in the same order")
     ("cnn_resolution", value<fl>(&cnnopts.resolution)->default_value(0.5),
         "resolution of grids, don't change unless you really know what you are doing")
     ("cnn_rotation", value<unsigned>(&cnnopts.cnn_rotations)->default_value(0),
@@ -1218,6 +1478,10 @@ Thank you!\n";
         "During minimization, recenter coordinate frame as ligand moves")
     ("cnn_freeze_receptor", bool_switch(&cnnopts.fix_receptor),
         "Don't move the receptor with respect to a fixed coordinate system")
+    ("cnn_cache_receptor", bool_switch(&cnnopts.cache_receptor_conv),
+        "Reuse the receptor contribution to the first convolution while the receptor grid is unchanged")
+    ("cnn_quantization", value<std::string>(&cnnopts.cnn_quantization),
+        "int8 quantization parameters written by 'caffe calibrate' for the model; CPU score only runs. Currently slower than fp32 with an optimized BLAS")
     ("cnn_outputdx", bool_switch(&cnnopts.outputdx),
         "Dump .dx files of atom grid gradient.")
     ("cnn_outputxyz", bool_switch(&cnnopts.outputxyz),
@@ -1234,6 +1498,27 @@ Thank you!\n";
     ("cnn_verbose", bool_switch(&cnnopts.verbose),
         "Enable verbose output for CNN debugging");
 
+    screen_options& screenopts = settings.screenopts;
+    options_description screen("Tiered screening (optional)");
+    screen.add_options()
+    ("screen", bool_switch(&screenopts.enabled),
+        "dock each ligand quickly with the empirical scoring function, rescore only the best with the CNN, and redock only the best of those at full exhaustiveness with CNN refinement")
+    ("screen_exhaustiveness",
+        value<int>(&screenopts.exhaustiveness)->default_value(2),
+        "exhaustiveness of the quick docking")
+    ("screen_top_percent",
+        value<fl>(&screenopts.top_percent)->default_value(10),
+        "rescore ligands whose best affinity is in this top percent of the ligands docked so far")
+    ("screen_affinity", value<fl>(&screenopts.affinity),
+        "always rescore ligands with a best affinity at or below this (kcal/mol)")
+    ("screen_cnn_top_percent",
+        value<fl>(&screenopts.cnn_top_percent)->default_value(20),
+        "redock rescored ligands whose best CNNscore is in this top percent of the ligands rescored so far")
+    ("screen_cnn_score", value<fl>(&screenopts.cnn_score),
+        "always redock rescored ligands with a best CNNscore at or above this")
+    ("screen_warmup", value<sz>(&screenopts.warmup)->default_value(50),
+        "ligands passed on at each tier before the top percent thresholds are applied");
+
     options_description misc("Misc (optional)");
     misc.add_options()
     ("cpu", value<int>(&settings.cpu),
@@ -1269,9 +1554,9 @@ Thank you!\n";
 
     options_description desc, desc_simple;
     desc.add(inputs).add(search_area).add(outputs).add(scoremin).add(cnn).
-        add(hidden).add(misc).add(config).add(info);
+        add(screen).add(hidden).add(misc).add(config).add(info);
     desc_simple.add(inputs).add(search_area).add(scoremin).add(cnn).
-        add(outputs).add(misc).add(config).add(info);
+        add(screen).add(outputs).add(misc).add(config).add(info);
 
     variables_map vm;
     try
@@ -1386,6 +1671,10 @@ Thank you!\n";
         &&
         !(settings.score_only || settings.local_only || settings.randomize_only))
       cnnopts.move_minimize_frame = true;
+    //scoring only never needs cnn gradients unless they are being output
+    if (settings.score_only
+        && !(cnnopts.outputxyz || cnnopts.outputdx || cnnopts.gradient_check))
+      cnnopts.forward_only = true;
 
     if (receptor_needed)
     {
@@ -1421,6 +1710,22 @@ Thank you!\n";
       throw usage_error("exhaustiveness must be 1 or greater");
     if (settings.num_modes < 1)
       throw usage_error("num_modes must be 1 or greater");
+    if (screenopts.enabled)
+    {
+      if (settings.score_only || settings.local_only
+          || settings.randomize_only)
+        throw usage_error(
+            "--screen requires docking and cannot be combined with --score_only, --minimize, --local_only or --randomize_only");
+      if (cnnopts.cnn_scoring || cnnopts.cnn_refinement)
+        throw usage_error(
+            "--screen decides where the CNN is used and cannot be combined with --cnn_scoring or --cnn_refinement");
+      if (screenopts.exhaustiveness < 1)
+        throw usage_error("screen_exhaustiveness must be 1 or greater");
+      if (screenopts.top_percent < 0 || screenopts.top_percent > 100
+          || screenopts.cnn_top_percent < 0
+          || screenopts.cnn_top_percent > 100)
+        throw usage_error("screening percentages must be between 0 and 100");
+    }
 
     boost::optional<std::string> flex_name_opt;
     if (vm.count("flex"))
@@ -1438,6 +1743,18 @@ Thank you!\n";
     if (vm.count("atom_terms") > 0)
       atomoutfile.open(atom_name.c_str());
 
+    std::ofstream statsfile;
+    if (vm.count("stats") > 0)
+    {
+#ifdef GNINA_TELEMETRY
+      statsfile.open(stats_name.c_str());
+      if (!statsfile)
+        throw file_error(stats_name, false);
+#else
+      throw usage_error("--stats requires building with GNINA_TELEMETRY");
+#endif
+    }
+
     FlexInfo finfo(flex_res, flex_dist, flexdist_ligand, log);
 
     // dkoes - parse in receptor once
@@ -1509,8 +1826,9 @@ Thank you!\n";
     // Print out flexible residues 
     finfo.printFlex();
 
-    // Print information about flexible residues use
-    if (finfo.hasContent() && (cnnopts.cnn_refinement ||
+    // Print information about flexible residues use; screening redocks with
+    // cnn refinement
+    if (finfo.hasContent() && (cnnopts.cnn_refinement || screenopts.enabled ||
                                (cnnopts.cnn_scoring && settings.dominimize))) {
       cnnopts.fix_receptor = true; // Fix receptor position and orientation
 
@@ -1531,8 +1849,26 @@ Thank you!\n";
       user_grid.init(user_gd, user_in, ug_scaling_factor); //initialize user grid
     }
 
+    if (settings.minimize_grid && !settings.local_only)
+      throw usage_error("--minimize_grid requires --minimize or --local_only");
+    if (settings.minimize_grid && (settings.gpu_on || cnnopts.cnn_scoring))
+      throw usage_error(
+          "--minimize_grid cannot be combined with --gpu or --cnn_scoring");
+    if (settings.sparse_grid && settings.gpu_on)
+      throw usage_error("--sparse_grid cannot be combined with --gpu");
+    if (cnnopts.cnn_quantization.size() > 0 && settings.gpu_on)
+      throw usage_error("--cnn_quantization cannot be combined with --gpu");
+    if (settings.grid_prec != GridFP32
+        && (settings.gpu_on || settings.sparse_grid))
+      throw usage_error(
+          "--grid_precision cannot be combined with --gpu or --sparse_grid");
+    bool box_given = autobox_ligand.length() > 0
+        || get_occurrence(vm, search_area).all;
+    if (settings.minimize_grid && no_lig && !box_given)
+      throw usage_error("--minimize_grid with --no_lig requires a search box");
+
     const fl granularity = 0.375;
-    if (search_box_needed)
+    if (search_box_needed || (settings.minimize_grid && box_given))
     {
       vec span(size_x, size_y, size_z);
       vec center(center_x, center_y, center_z);
@@ -1558,6 +1894,8 @@ Thank you!\n";
     }
     if (settings.cpu < 1)
       settings.cpu = 1;
+    CNNScorer::set_max_threads(settings.cpu);
+    caffe::caffe_set_parallel_threads(settings.cpu);
     if (settings.verbosity > 1 && settings.exhaustiveness < settings.cpu)
       log  << "WARNING: at low exhaustiveness, it may be impossible to utilize all CPUs\n";
 
@@ -1615,15 +1953,34 @@ Thank you!\n";
       log << "\n";
     }
 
+    std::unique_ptr<shared_grid> sgrid;
+    if (settings.minimize_grid)
+    {
+      grid_dims sgd = box_given ? gd :
+          ligand_union_box(mols, ligand_names, autobox_add, granularity);
+      sgrid.reset(new shared_grid(sgd, 1e3, settings.grid_prec)); //same slope as main_procedure
+    }
+
+    //when screening the scorers need the network for the later tiers, while
+    //settings keeps the first docking free of it
+    cnn_options scorer_opts = cnnopts;
+    std::unique_ptr<screen_filter> screener;
+    if (screenopts.enabled)
+    {
+      scorer_opts.cnn_refinement = true;
+      screener.reset(new screen_filter(screenopts));
+    }
+
     job_queue<worker_job> wrkq;
     job_queue<writer_job> writerq;
     int nligs = 0;
     size_t nthreads = settings.cpu;
     global_state gs(&settings, prec, &minparms, &wt, &user_grid,
-        &log, &atomoutfile, cnnopts);
+        &log, &atomoutfile, scorer_opts, sgrid.get(), &statsfile,
+        screener.get());
     boost::thread_group worker_threads;
     boost::timer::cpu_timer time;
-    CNNScorer cnn_scorer(cnnopts); //shared network
+    CNNScorer cnn_scorer(scorer_opts); //loads the weights the workers' scorers share
 
     if (!settings.local_only)
       nthreads = 1; //docking is multithreaded already, don't add additional parallelism other than pipeline
@@ -1632,7 +1989,7 @@ Thank you!\n";
     for (int i = 0; i < nthreads; i++)
         {
       worker_threads.create_thread(boost::bind(threads_at_work, &wrkq,
-          &writerq, &gs, &mols, &nligs, cnn_scorer));
+          &writerq, &gs, &mols, &nligs));
 
     }
 
@@ -1652,11 +2009,14 @@ Thank you!\n";
         for (;;)  {
           model* m = new model;
 
+          TELEMETRY_RESET();
+          TELEMETRY_PHASE(parse_timer, PhaseParse);
           if (!mols.readMoleculeIntoModel(*m))
               {
             delete m;
             break;
           }
+          TELEMETRY_STOP(parse_timer);
           m->set_pose_num(i);
           m->gdata.device_on = settings.gpu_on;
           m->gdata.device_id = settings.device;
@@ -1670,6 +2030,7 @@ Thank you!\n";
           std::vector<result_info>* results =
               new std::vector<result_info>();
           worker_job j(i, m, results, gd);
+          TELEMETRY_SAVE(j.stats);
           wrkq.push(j);
 
           i++;
@@ -1696,7 +2057,18 @@ Thank you!\n";
 
     cudaDeviceSynchronize();
 
-    std::cout << "Loop time " << time.elapsed().wall / 1000000000.0 << "\n";
+    if (screener)
+    {
+      log << "Screened " << screener->num_docked() << " ligands: "
+          << screener->num_rescored() << " rescored with the CNN, "
+          << screener->num_redocked() << " redocked with CNN refinement";
+      log.endl();
+    }
+
+    if (statsfile.is_open())
+      statsfile << "{\"total_seconds\": "
+          << time.elapsed().wall / 1000000000.0 << ", \"ligands\": " << nligs
+          << "}\n";
 
   } catch (file_error& e)
   {
@@ -185,3 +185,97 @@ def test_molgrid():
     
     assert np.sum(np.abs(res['affinity']) < 4) == 4
     assert np.sum(res['label']) == 4
+
+def test_molgrid_prefetch():
+    '''prefetched batches match those gridded in forward, and randomly
+    transformed batches are reproducible from the seed with and without
+    prefetching'''
+    caffe.set_mode_cpu()
+
+    def runmodel(prefetch, randomize=False):
+        caffe.set_random_seed(800)
+        m = open('tmp.model','w')
+        m.write('''layer {
+      name: "data"
+      type: "MolGridData"
+      top: "data"
+      top: "label"
+      top: "affinity"
+      molgrid_data_param {
+        source: "typesfiles/smallaff.types"
+        batch_size: 4
+        dimension: 23.5
+        resolution: 0.5
+        shuffle: false
+        balanced: false
+        has_affinity: true
+        root_folder: "typesfiles"
+        prefetch: %d
+        random_rotation: %s
+        random_translate: %f
+      }
+    }''' % (prefetch, 'true' if randomize else 'false', 2.0 if randomize else 0))
+        m.close()
+        net = caffe.Net('tmp.model',caffe.TRAIN)
+        res = [ {k: v.copy() for k,v in net.forward().items()} for i in range(3)]
+        os.remove('tmp.model')
+        return res
+
+    plain = runmodel(0)
+    prefetched = runmodel(2)
+    for a, b in zip(plain, prefetched):
+        assert list(a['label']) == list(b['label'])
+        assert list(a['affinity']) == approx(list(b['affinity']))
+        assert np.abs(a['data'] - b['data']).max() == approx(0, abs=1e-5)
+
+    for prefetch in [0, 2]:
+        first = runmodel(prefetch, True)
+        second = runmodel(prefetch, True)
+        for a, b in zip(first, second):
+            assert list(a['label']) == list(b['label'])
+            assert np.array_equal(a['data'], b['data'])
+        #the transformations are applied
+        unrotated = runmodel(prefetch)
+        assert any(np.abs(a['data'] - b['data']).max() > 1e-3
+                for a, b in zip(first, unrotated))
+
+def test_molgrid_test_cache():
+    '''cached test grids match those gridded on every pass'''
+    caffe.set_mode_cpu()
+
+    def runmodel(cache):
+        m = open('tmp.model','w')
+        m.write('''layer {
+      name: "data"
+      type: "MolGridData"
+      top: "data"
+      top: "label"
+      top: "affinity"
+      molgrid_data_param {
+        source: "typesfiles/smallaff.types"
+        batch_size: 3
+        dimension: 23.5
+        resolution: 0.5
+        shuffle: false
+        balanced: false
+        has_affinity: true
+        root_folder: "typesfiles"
+        cache_test_grids: %s
+        cache_file: "%s"
+      }
+    }''' % ('true' if cache is not None else 'false', cache or ''))
+        m.close()
+        net = caffe.Net('tmp.model',caffe.TEST)
+        #batches do not line up with passes through the data
+        res = [ {k: v.copy() for k,v in net.forward().items()} for i in range(7)]
+        os.remove('tmp.model')
+        return res
+
+    plain = runmodel(None)
+    for cache in ['', 'tmp.gridcache']:
+        cached = runmodel(cache)
+        for a, b in zip(plain, cached):
+            assert list(a['label']) == list(b['label'])
+            assert list(a['affinity']) == approx(list(b['affinity']))
+            assert np.abs(a['data'] - b['data']).max() == 0
+    assert not os.path.exists('tmp.gridcache')
@@ -5,31 +5,22 @@ import numpy as np
 import itertools
 import matplotlib.pyplot as plt
 from plumbum import local
-import os, gzip, sys, math
+import os, gzip, sys, math, json, time
 from rdkit import Chem
 from rdkit.Chem import rdMolDescriptors as rdMD
 
 plt.style.use('seaborn-white')
 
-def get_time(out):
+def get_time(statsfile):
     '''
-    Returns loop time for gnina run; does this by parsing the stdout to get the
-    value computed by the internal loop timer. This might be a crappy way of
-    doing things (e.g. what if we decide to disable timer printing?) so
-    probably this should be changed to use /usr/bin/time or a python timing
-    utility
+    Returns loop time for a gnina run, taken from the summary line that
+    gnina appends to the file given to --stats
     '''
-    tstring = ''
-    
-    for char in out:
-        if char == "\n":
-            if tstring.startswith('Loop time'):
-                return float(tstring.split()[-1])
-                break
-            else:
-                tstring = ''
-        else:
-            tstring = tstring + char
+    with open(statsfile) as f:
+        for line in f:
+            record = json.loads(line)
+            if 'total_seconds' in record:
+                return record['total_seconds']
 
 def get_torsions(ligand):
     '''
@@ -52,6 +43,39 @@ def get_torsions(ligand):
     f.close()
     return torsions
 
+stats_support = {}
+def supports_stats(cmd):
+    '''
+    Returns True if the binary lists --stats in its help; older builds
+    don't have the option
+    '''
+    if cmd not in stats_support:
+        try:
+            stats_support[cmd] = '--stats' in run_command(cmd, '--help')
+        except Exception:
+            stats_support[cmd] = False
+    return stats_support[cmd]
+
+def timed_run(cmd, *args):
+    '''
+    Runs gnina and returns its loop time, from --stats when the binary
+    supports it and from the wall clock otherwise (including builds that
+    list --stats but were built without telemetry and reject it)
+    '''
+    if supports_stats(cmd):
+        if os.path.exists(statsfile):
+            os.remove(statsfile)
+        try:
+            run_command(cmd, *(args + ('--stats', statsfile)))
+            t = get_time(statsfile)
+            if t is not None:
+                return t
+        except Exception:
+            stats_support[cmd] = False
+    start = time.time()
+    run_command(cmd, *args)
+    return time.time() - start
+
 def run_command(cmd, *args):
     '''
     Runs a command and returns stdout. Includes somewhat convoluted existence
@@ -115,6 +139,7 @@ if not args.ligands:
     assert not args.receptor
     args.receptor = 'performance/a17/a17_rec.pdb'
 
+statsfile = 'speed_stats.json'
 out_filebase = {}
 #generate basenames for plot labels
 for bin in args.input:
@@ -172,15 +197,13 @@ for idx,bin in enumerate(args.input):
             if run==0 and lignum==0: gpu_time = [[0] * 3 for
                     i in range(len(args.ligands))]
             if args.cpu and idx == 0:
-                out = run_command(args.cpu, '-r', args.receptor, '-l', ligand, '--minimize')
-                cpu_time[lignum][run] = get_time(out)
+                cpu_time[lignum][run] = timed_run(args.cpu, '-r', args.receptor,
+                        '-l', ligand, '--minimize')
             elif args.paired_test or not args.paired_test and idx == 0:
-                out = run_command(bin, '-r', args.receptor, '-l', ligand,
-                        '--minimize')
-                cpu_time[lignum][run] = get_time(out)
-            out = run_command(bin, '-r', args.receptor, '-l', ligand, '--minimize',
-            '--gpu', '--cpu', '3')
-            gpu_time[lignum][run] = get_time(out)
+                cpu_time[lignum][run] = timed_run(bin, '-r', args.receptor,
+                        '-l', ligand, '--minimize')
+            gpu_time[lignum][run] = timed_run(bin, '-r', args.receptor, '-l',
+                    ligand, '--minimize', '--gpu', '--cpu', '3')
 
     torsions_speedup[bin] = []
     torsions_err[bin] = []
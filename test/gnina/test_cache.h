@@ -1,3 +1,47 @@
 #pragma once
+#include <memory>
+#include <vector>
+#include "custom_terms.h"
+#include "model.h"
+#include "test_utils.h"
 
 void test_cache_eval_deriv();
+void test_tiled_cache_eval_deriv();
+void test_tiled_cache_saturated();
+
+//vina scoring function shared by the cache tests
+inline void add_cache_test_terms(custom_terms& t) {
+  t.add("gauss(o=0,_w=0.5,_c=8)", -0.035579);
+  t.add("gauss(o=3,_w=2,_c=8)", -0.005156);
+  t.add("repulsion(o=0,_c=8)", 0.840245);
+  t.add("hydrophobic(g=0.5,_b=1.5,_c=8)", -0.035069);
+  t.add("non_dir_h_bond(g=-0.7,_b=0,_c=8)", -0.587439);
+  t.add("num_tors_div", 5 * 0.05846 / 0.1 - 1);
+}
+
+//manually initialize a model with lig as its movable atoms and rec as the
+//grid atoms
+inline std::unique_ptr<model> make_cache_test_model(
+    const std::vector<atom_params>& lig_atoms, const std::vector<smt>& lig_types,
+    const std::vector<atom_params>& rec_atoms,
+    const std::vector<smt>& rec_types) {
+  std::unique_ptr<model> m(new model);
+  m->m_num_movable_atoms = lig_atoms.size();
+  m->minus_forces = std::vector<vec>(m->m_num_movable_atoms);
+
+  for (size_t i = 0; i < lig_atoms.size(); ++i) {
+    m->coords.push_back(*(vec*) &lig_atoms[i]);
+    m->atoms.push_back(atom());
+    m->atoms[i].sm = lig_types[i];
+    m->atoms[i].charge = lig_atoms[i].charge;
+    m->atoms[i].coords = *(vec*) &lig_atoms[i];
+  }
+
+  for (size_t i = 0; i < rec_atoms.size(); ++i) {
+    m->grid_atoms.push_back(atom());
+    m->grid_atoms[i].sm = rec_types[i];
+    m->grid_atoms[i].charge = rec_atoms[i].charge;
+    m->grid_atoms[i].coords = *(vec*) &rec_atoms[i];
+  }
+  return m;
+}
@@ -2,5 +2,6 @@
 
 void test_set_atom_gradients();
 void test_vanilla_grids();
+void test_score_masked();
 void test_subcube_grids();
 void test_strided_cube_datagetter();
@@ -0,0 +1,65 @@
+#include <random>
+#include "coords.h"
+#include "parsed_args.h"
+#include "test_coords.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+//the original vina algorithm: full rmsd to every pose and a re-sort per insert
+static void reference_add(output_container& out, const output_type& t,
+    fl min_rmsd, sz max_size) {
+  std::pair<sz, fl> closest_rmsd = find_closest(t.coords, out);
+  if (closest_rmsd.first < out.size() && closest_rmsd.second < min_rmsd) {
+    if (t.e < out[closest_rmsd.first].e) out[closest_rmsd.first] = t;
+  } else {
+    if (out.size() < max_size)
+      out.push_back(new output_type(t));
+    else
+      if (!out.empty() && t.e < out.back().e) out.back() = t;
+  }
+  out.sort();
+}
+
+void test_output_container() {
+  p_args.log << "Output Container Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  //poses are random perturbations of a few base poses so that some are within
+  //min_rmsd of each other and many are not
+  const sz natoms = 30;
+  const sz nbase = 8;
+  const fl min_rmsd = 1.0;
+  const sz max_size = 20;
+  std::uniform_real_distribution<fl> place(-10, 10);
+  std::normal_distribution<fl> jitter(0, 0.7);
+  std::uniform_real_distribution<fl> energy(-12, 0);
+  std::uniform_int_distribution<int> pick(0, nbase - 1);
+
+  std::vector<vecv> bases(nbase, vecv(natoms));
+  for (auto& b : bases)
+    for (auto& v : b)
+      v = vec(place(engine), place(engine), place(engine));
+
+  conf c;
+  output_container fast, slow;
+  for (sz i = 0; i < 500; i++) {
+    output_type t(c, energy(engine));
+    const vecv& b = bases[pick(engine)];
+    vec shift(jitter(engine), jitter(engine), jitter(engine));
+    for (const auto& v : b)
+      t.coords.push_back(
+          v + shift + 0.3 * vec(jitter(engine), jitter(engine), jitter(engine)));
+    add_to_output_container(fast, t, min_rmsd, max_size);
+    reference_add(slow, t, min_rmsd, max_size);
+
+    BOOST_REQUIRE_EQUAL(fast.size(), slow.size());
+    for (sz j = 0; j < fast.size(); j++) {
+      BOOST_REQUIRE_EQUAL(fast[j].e, slow[j].e);
+      if (j > 0) BOOST_REQUIRE_LE(fast[j - 1].e, fast[j].e);
+    }
+  }
+}
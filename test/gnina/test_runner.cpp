@@ -6,6 +6,8 @@
 #include "test_tree.h"
 #include "test_cache.h"
 #include "test_cnn.h"
+#include "test_coords.h"
+#include "test_screening.h"
 #include "test_utils.h"
 #define N_ITERS 5
 #define BOOST_TEST_DYN_LINK
@@ -56,6 +58,38 @@ BOOST_AUTO_TEST_CASE(eval_deriv) {
 
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_AUTO_TEST_SUITE(tiled_cache)
+
+BOOST_AUTO_TEST_CASE(eval_deriv) {
+  boost_loop_test(&test_tiled_cache_eval_deriv);
+}
+
+BOOST_AUTO_TEST_CASE(saturated) {
+  boost_loop_test(&test_tiled_cache_saturated);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(coords)
+
+BOOST_AUTO_TEST_CASE(output_container) {
+  boost_loop_test(&test_output_container);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(screening)
+
+BOOST_AUTO_TEST_CASE(streaming_quantile) {
+  boost_loop_test(&test_streaming_quantile);
+}
+
+BOOST_AUTO_TEST_CASE(screen_filter) {
+  boost_loop_test(&test_screen_filter);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 BOOST_AUTO_TEST_SUITE(test_cnn)
 
 BOOST_AUTO_TEST_CASE(set_atom_gradients) {
@@ -66,6 +100,10 @@ BOOST_AUTO_TEST_CASE(vanilla_grids) {
   boost_loop_test(&test_vanilla_grids);
 }
 
+BOOST_AUTO_TEST_CASE(score_masked) {
+  boost_loop_test(&test_score_masked);
+}
+
 #if 0
 BOOST_AUTO_TEST_CASE(subcube_grids) {
   boost_loop_test(&test_subcube_grids);
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "screening.h"
+#include "parsed_args.h"
+#include "test_screening.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+//nearest rank p quantile, what the estimate is exact for below five values
+static double exact_quantile(std::vector<double> values, double p) {
+  std::sort(values.begin(), values.end());
+  return values[sz(std::floor(p * (values.size() - 1) + 0.5))];
+}
+
+void test_streaming_quantile() {
+  p_args.log << "Streaming Quantile Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  const double ps[] = { 0.01, 0.1, 0.5, 0.9, 0.99 };
+  for (sz k = 0; k < sizeof(ps) / sizeof(ps[0]); ++k) {
+    const double p = ps[k];
+    streaming_quantile q(p);
+    BOOST_REQUIRE(std::isnan(q.estimate()));
+
+    std::vector<double> values;
+    for (sz i = 0; i < 4; ++i) {
+      values.push_back(uniform(engine));
+      q.add(values.back());
+      BOOST_REQUIRE_EQUAL(q.size(), values.size());
+      BOOST_REQUIRE_EQUAL(q.estimate(), exact_quantile(values, p));
+    }
+
+    while (values.size() < 2000) {
+      values.push_back(uniform(engine));
+      q.add(values.back());
+    }
+    p_args.log << "p " << p << " exact: " << exact_quantile(values, p)
+        << " estimate: " << q.estimate() << "\n";
+    BOOST_REQUIRE_SMALL(q.estimate() - exact_quantile(values, p), 0.03);
+  }
+  p_args.log.endl();
+}
+
+void test_screen_filter() {
+  p_args.log << "Screen Filter Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  //warmup ligands always pass, later ones only by a rule
+  screen_options opts;
+  opts.top_percent = 0;
+  opts.cnn_top_percent = 0;
+  opts.warmup = 5;
+  {
+    screen_filter f(opts);
+    for (sz i = 0; i < opts.warmup; ++i) {
+      BOOST_REQUIRE(f.rescore(0));
+      BOOST_REQUIRE(f.redock(0));
+    }
+    BOOST_REQUIRE(!f.rescore(-20));
+    BOOST_REQUIRE(!f.redock(1));
+    BOOST_REQUIRE_EQUAL(f.num_docked(), opts.warmup + 1);
+    BOOST_REQUIRE_EQUAL(f.num_rescored(), opts.warmup);
+    BOOST_REQUIRE_EQUAL(f.num_redocked(), opts.warmup);
+  }
+
+  //fixed cutoffs pass results at least as good as them
+  opts.warmup = 0;
+  opts.affinity = -8;
+  opts.cnn_score = 0.7;
+  {
+    screen_filter f(opts);
+    BOOST_REQUIRE(f.rescore(-9));
+    BOOST_REQUIRE(f.rescore(-8));
+    BOOST_REQUIRE(!f.rescore(-7.9));
+    BOOST_REQUIRE(f.redock(0.8));
+    BOOST_REQUIRE(f.redock(0.7));
+    BOOST_REQUIRE(!f.redock(0.69));
+  }
+
+  //everything passes at 100 percent
+  opts.affinity = NAN;
+  opts.cnn_score = NAN;
+  opts.top_percent = 100;
+  opts.cnn_top_percent = 100;
+  {
+    screen_filter f(opts);
+    BOOST_REQUIRE(f.rescore(0));
+    BOOST_REQUIRE(f.redock(0));
+  }
+
+  //after warmup, about the requested share of each tier passes
+  opts.top_percent = 10;
+  opts.cnn_top_percent = 20;
+  opts.warmup = 50;
+  {
+    std::uniform_real_distribution<fl> affinities(-12, -2);
+    std::uniform_real_distribution<fl> cnnscores(0, 1);
+    const sz n = 1000;
+    screen_filter f(opts);
+    for (sz i = 0; i < n; ++i) {
+      f.rescore(affinities(engine));
+      f.redock(cnnscores(engine));
+    }
+    const fl rescored = fl(f.num_rescored() - opts.warmup) / (n - opts.warmup);
+    const fl redocked = fl(f.num_redocked() - opts.warmup) / (n - opts.warmup);
+    p_args.log << "Rescored " << rescored << " redocked " << redocked
+        << " after warmup\n\n";
+    BOOST_REQUIRE_SMALL(rescored - opts.top_percent / 100, (fl )0.06);
+    BOOST_REQUIRE_SMALL(redocked - opts.cnn_top_percent / 100, (fl )0.06);
+  }
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+void test_streaming_quantile();
+void test_screen_filter();
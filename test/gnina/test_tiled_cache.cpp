@@ -0,0 +1,148 @@
+#include <cmath>
+#include <random>
+#include "common.h"
+#include "cache.h"
+#include "tiled_cache.h"
+#include "weighted_terms.h"
+#include "custom_terms.h"
+#include "precalculate.h"
+#include "test_cache.h"
+#include "parsed_args.h"
+#include "test_utils.h"
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+
+//box deliberately smaller than the ligand so the penalty path is covered
+static grid_dims tiled_test_box() {
+  const fl granularity = 0.375;
+  grid_dims gd;
+  for (size_t i = 0; i < 3; ++i) {
+    gd[i].n = 40;
+    gd[i].begin = 5;
+    gd[i].end = gd[i].begin + granularity * gd[i].n;
+  }
+  return gd;
+}
+
+static std::unique_ptr<model> make_tiled_test_model(std::mt19937& engine) {
+  std::vector<atom_params> lig_atoms;
+  std::vector<smt> lig_types;
+  make_mol(lig_atoms, lig_types, engine, 0);
+  std::vector<atom_params> rec_atoms;
+  std::vector<smt> rec_types;
+  make_mol(rec_atoms, rec_types, engine, 0, 10, 2500);
+  return make_cache_test_model(lig_atoms, lig_types, rec_atoms, rec_types);
+}
+
+void test_tiled_cache_eval_deriv() {
+  p_args.log << "Tiled Cache Eval Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  custom_terms t;
+  add_cache_test_terms(t);
+
+  const fl approx_factor = 10;
+  const fl v = 10;
+  const fl slope = 10;
+
+  weighted_terms wt(&t, t.weights());
+  std::unique_ptr<precalculate_splines> prec(
+      new precalculate_splines(wt, approx_factor));
+
+  grid_dims gd = tiled_test_box();
+  grid user_grid;
+  std::unique_ptr<model> m = make_tiled_test_model(engine);
+
+  std::vector<smt> atom_types_needed;
+  m->get_movable_atom_types(atom_types_needed);
+
+  cache c("scoring_function_version001", gd, slope);
+  c.populate(*m, *prec, atom_types_needed, user_grid);
+  //no saturation, so every tile must match the dense grid
+  tiled_cache tc(*m, *prec, gd, slope, atom_types_needed, user_grid,
+      HUGE_VALF);
+
+  fl c_out = c.eval_deriv(*m, v, user_grid);
+  std::vector<vec> c_forces = m->minus_forces;
+  fl t_out = tc.eval_deriv(*m, v, user_grid);
+
+  p_args.log << "Dense energy: " << c_out << " Tiled energy: " << t_out
+      << "\n\n";
+
+  BOOST_REQUIRE_SMALL(c_out - t_out, (float )0.01);
+  for (size_t i = 0; i < m->minus_forces.size(); ++i)
+    for (size_t j = 0; j < 3; ++j)
+      BOOST_REQUIRE_SMALL(m->minus_forces[i][j] - c_forces[i][j],
+          (float )0.01);
+  BOOST_REQUIRE(tc.num_populated_tiles() <= tc.num_tiles());
+  BOOST_REQUIRE_EQUAL(tc.num_saturated_tiles(), (sz) 0);
+}
+
+//saturated tiles replace the type dependent values only; the charge
+//dependent contribution must still match the dense grid
+void test_tiled_cache_saturated() {
+  p_args.log << "Tiled Cache Saturation Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  custom_terms t;
+  add_cache_test_terms(t);
+  t.add("electrostatic(i=1,_^=100,_c=8)", 0.1465);
+
+  const fl approx_factor = 10;
+  const fl v = 10;
+  const fl slope = 10;
+  //below any type dependent value, so every tile saturates
+  const fl saturation = -1000;
+
+  weighted_terms wt(&t, t.weights());
+  std::unique_ptr<precalculate_splines> prec(
+      new precalculate_splines(wt, approx_factor));
+  BOOST_REQUIRE(prec->has_components());
+
+  grid_dims gd = tiled_test_box();
+  grid user_grid;
+  std::unique_ptr<model> m = make_tiled_test_model(engine);
+
+  std::vector<smt> atom_types_needed;
+  m->get_movable_atom_types(atom_types_needed);
+
+  cache c("scoring_function_version001", gd, slope);
+  c.populate(*m, *prec, atom_types_needed, user_grid);
+  tiled_cache tc(*m, *prec, gd, slope, atom_types_needed, user_grid,
+      saturation);
+
+  //charge contribution of each grid is the difference from the uncharged
+  //ligand
+  fl c_charged = c.eval_deriv(*m, v, user_grid);
+  std::vector<vec> c_charged_forces = m->minus_forces;
+  fl t_charged = tc.eval_deriv(*m, v, user_grid);
+  std::vector<vec> t_charged_forces = m->minus_forces;
+
+  for (size_t i = 0; i < m->atoms.size(); ++i)
+    m->atoms[i].charge = 0;
+  fl c_neutral = c.eval_deriv(*m, v, user_grid);
+  std::vector<vec> c_neutral_forces = m->minus_forces;
+  fl t_neutral = tc.eval_deriv(*m, v, user_grid);
+  std::vector<vec> t_neutral_forces = m->minus_forces;
+
+  p_args.log << "Dense charge energy: " << c_charged - c_neutral
+      << " Tiled charge energy: " << t_charged - t_neutral << "\n\n";
+
+  BOOST_REQUIRE_EQUAL(tc.num_populated_tiles(), (sz) 0);
+  BOOST_REQUIRE(tc.num_saturated_tiles() > 0);
+  BOOST_REQUIRE_SMALL((c_charged - c_neutral) - (t_charged - t_neutral),
+      (float )0.01);
+  for (size_t i = 0; i < m->minus_forces.size(); ++i)
+    for (size_t j = 0; j < 3; ++j)
+      BOOST_REQUIRE_SMALL(
+          (c_charged_forces[i][j] - c_neutral_forces[i][j])
+              - (t_charged_forces[i][j] - t_neutral_forces[i][j]),
+          (float )0.01);
+}
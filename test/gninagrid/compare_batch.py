@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+
+'''Compare each molecule of a gninagrid --batch file with the binmap gridded
+for it on its own.
+Usage: compare_batch.py file.gridbatch refbase
+Molecule i is compared with refbase_i.*.binmap.'''
+
+import sys,struct,glob
+import pytest
+
+from pytest import approx
+
+buf = open(sys.argv[1],'rb').read()
+refbase = sys.argv[2]
+
+assert buf[:8] == b'GNINAGRD'
+version, flags, nmols, indexpos, N, res, nchannels, zero = struct.unpack('<IIQQIfII',buf[8:48])
+assert version == 1
+compressed = flags == 1
+npts = N*N*N
+
+offsets = struct.unpack('<%dQ'%nmols,buf[indexpos:indexpos+8*nmols])
+assert len(buf) == indexpos+8*nmols
+assert nmols == len(glob.glob(refbase+'_*.binmap'))
+
+for i, offset in enumerate(offsets):
+    refs = glob.glob('%s_%d.*.binmap'%(refbase,i))
+    assert len(refs) == 1
+    refbuf = open(refs[0],'rb').read()
+    assert len(refbuf) == 4*npts*nchannels
+
+    stored, = struct.unpack('<I',buf[offset+12:offset+16])
+    pos = offset+16
+    present = [1]*nchannels
+    if compressed:
+        present = list(buf[pos:pos+nchannels])
+        pos += (nchannels+3)//4*4
+    assert stored == sum(present)
+    for c in range(nchannels):
+        ref = struct.unpack('%df'%npts,refbuf[4*npts*c:4*npts*(c+1)])
+        if present[c]:
+            chan = struct.unpack('%df'%npts,buf[pos:pos+4*npts])
+            pos += 4*npts
+            assert chan == approx(ref,abs=1e-4)
+            #only empty channels are left out
+            assert not compressed or any(ref)
+        else:
+            assert not any(ref)
+    #chunks are back to back, the index 8 byte aligned after the last
+    assert pos == offsets[i+1] if i+1 < nmols else (pos+7)//8*8 == indexpos
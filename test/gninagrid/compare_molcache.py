@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+
+'''Check a molcache2 file against the .gninatypes files of the same molecules.
+Usage: compare_molcache.py file.molcache2 refprefix
+The molecule named dir/name.gninatypes in the cache must match the file
+refprefix + name.gninatypes, and every such file must be in the cache.'''
+
+import sys,os,struct,glob
+
+cachename = sys.argv[1]
+refprefix = sys.argv[2]
+
+buf = open(cachename,'rb').read()
+version, start = struct.unpack('<iQ',buf[:12])
+assert version == -1
+
+#index of names and offsets
+index = []
+pos = start
+while pos < len(buf):
+    n = buf[pos]
+    name = buf[pos+1:pos+1+n].decode()
+    offset, = struct.unpack('<Q',buf[pos+1+n:pos+9+n])
+    index.append((name,offset))
+    pos += 9+n
+assert pos == len(buf)
+
+#molecules are stored back to back in index order after the header
+expected = 12
+for name, offset in index:
+    assert offset == expected, name
+    natoms, = struct.unpack('<i',buf[offset:offset+4])
+    atoms = buf[offset+4:offset+4+16*natoms]
+    ref = open(refprefix+os.path.basename(name),'rb').read()
+    assert atoms == ref, name
+    expected = offset+4+16*natoms
+assert expected == start
+
+refs = set(glob.glob(refprefix+'*.gninatypes'))
+assert refs == set(refprefix+os.path.basename(name) for name,offset in index)
+
+#worker part files are removed
+assert not glob.glob(cachename+'.part*')